@@ -0,0 +1,420 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/multiprecision/float128.hpp>
+#include <boost/random.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../DiffusionCDF/diffusionCDF.hpp"
+#include "../DiffusionPDF/diffusionPDF.hpp"
+#include "../DiffusionPDF/diffusionPDFReplicas.hpp"
+#include "../Random/betaSampler.h"
+#include "../Random/philox.h"
+#include "../Scalars/doubleDouble.h"
+#include "../Scalars/scaledDouble.h"
+#include "../Stats/stat.h"
+
+/*
+Microbenchmarks for the hot paths of the engines, with Google Benchmark:
+
+  ./compile.sh && ./benchmarks --benchmark_filter=PDFStep
+
+Most of them are templated on the scalar type and take t as their argument.
+The steps report sites=<sites per second>, the queries the time per call.
+
+Every system is evolved to t once per (type, t, mode) and kept, each run then
+starts from a copy of that state. A step benchmark goes at most stepsPerReset
+steps past t before it's put back (outside the timing), so the window it
+sweeps stays ~t sites wide however many iterations the library picks.
+*/
+
+using RealType = boost::multiprecision::float128;
+
+namespace
+{
+  const double beta = 1;
+  const unsigned int seed = 0;
+  const unsigned long int stepsPerReset = 64;
+
+  void tArgs(benchmark::internal::Benchmark *b)
+  {
+    b->Arg(1000)->Arg(10000);
+  }
+
+  template <class T>
+  std::vector<T> quantiles()
+  {
+    std::vector<T> q;
+    for (int e = 2; e <= 20; e += 2)
+    {
+      q.push_back(T(std::pow(10.0, e)));
+    }
+    return q;
+  }
+
+  template <class T>
+  struct PDFState
+  {
+    std::vector<T> occupancy;
+    std::pair<std::vector<unsigned long int>, std::vector<unsigned long int>> edges;
+  };
+
+  // nParticles large enough that the discrete mode uses every tier of
+  // toNextSite
+  template <class T>
+  T pdfParticles()
+  {
+    return T(1e12);
+  }
+
+  template <class T>
+  const PDFState<T> &pdfState(const unsigned long int t, const bool probDist)
+  {
+    static std::map<std::pair<unsigned long int, bool>, PDFState<T>> states;
+    auto key = std::make_pair(t, probDist);
+    auto it = states.find(key);
+    if (it == states.end())
+    {
+      DiffusionPDF<T> d(pdfParticles<T>(), beta, t + stepsPerReset, probDist);
+      d.setBetaSeed(seed);
+      d.evolveToTime(t);
+      it = states.emplace(key, PDFState<T>{d.getOccupancy(), d.getEdges()}).first;
+    }
+    return it->second;
+  }
+
+  template <class T>
+  void resetPDF(DiffusionPDF<T> &d, const unsigned long int t, const bool probDist)
+  {
+    const PDFState<T> &saved = pdfState<T>(t, probDist);
+    d.setOccupancy(saved.occupancy);
+    d.setEdges(saved.edges);
+    d.setTime(t);
+  }
+
+  template <class T>
+  const std::vector<T> &cdfState(const unsigned long int t)
+  {
+    static std::map<unsigned long int, std::vector<T>> states;
+    auto it = states.find(t);
+    if (it == states.end())
+    {
+      DiffusionTimeCDF<T> d(beta, t + stepsPerReset);
+      d.setBetaSeed(seed);
+      d.evolveToTime(t);
+      it = states.emplace(t, d.getCDF()).first;
+    }
+    return it->second;
+  }
+
+  template <class T>
+  void resetCDF(DiffusionTimeCDF<T> &d, const unsigned long int t)
+  {
+    d.setCDF(cdfState<T>(t));
+    d.setTime(t);
+  }
+
+  std::string scratchDirectory()
+  {
+    const char *tmp = std::getenv("TMPDIR");
+    return tmp ? tmp : "/tmp";
+  }
+
+  void reportSites(benchmark::State &state, const double sites)
+  {
+    state.counters["sites"] = benchmark::Counter(sites, benchmark::Counter::kIsRate);
+  }
+} // namespace
+
+template <class T, bool probDist>
+void BM_PDFStep(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionPDF<T> d(pdfParticles<T>(), beta, t + stepsPerReset, probDist);
+  d.setBetaSeed(seed);
+  resetPDF(d, t, probDist);
+
+  double sites = 0;
+  for (auto _ : state)
+  {
+    if (d.getTime() == t + stepsPerReset)
+    {
+      state.PauseTiming();
+      resetPDF(d, t, probDist);
+      state.ResumeTiming();
+    }
+    sites += d.getMaxIdx() - d.getMinIdx() + 2;
+    d.iterateTimestep();
+  }
+  reportSites(state, sites);
+}
+
+// mapped keeps the CDF in a file under $TMPDIR (IO/storage.h), which fits in
+// memory here so it's the overhead of the mapping rather than of the disk
+template <class T, bool mapped = false>
+void BM_TimeCDFStep(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionTimeCDF<T> d(beta, t + stepsPerReset, mapped ? scratchDirectory() : "");
+  d.setBetaSeed(seed);
+  resetCDF(d, t);
+
+  double sites = 0;
+  for (auto _ : state)
+  {
+    if (d.getTime() == t + stepsPerReset)
+    {
+      state.PauseTiming();
+      resetCDF(d, t);
+      state.ResumeTiming();
+    }
+    sites += d.getTime() + 2;
+    d.iterateTimeStep();
+  }
+  reportSites(state, sites);
+}
+
+// k steps per pass with the counter RNG, k = 1 is the plain step for comparison
+template <class T>
+void BM_TimeCDFWavefront(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  const unsigned long int k = state.range(1);
+  DiffusionTimeCDF<T> d(beta, t + stepsPerReset);
+  d.setBetaSeed(seed);
+  d.setCounterRNG(true);
+  resetCDF(d, t);
+
+  double sites = 0;
+  for (auto _ : state)
+  {
+    if (d.getTime() + k > t + stepsPerReset)
+    {
+      state.PauseTiming();
+      resetCDF(d, t);
+      state.ResumeTiming();
+    }
+    sites += k * (d.getTime() + 2);
+    d.iterateTimeSteps(k);
+  }
+  reportSites(state, sites);
+}
+
+// k discrete systems at N = 10^4, 10^6, ... evolved from 0 to t in one
+// environment, as one DiffusionPDFReplicas if shared and otherwise as k
+// DiffusionPDFs (window storage and the counter RNG, so the same results)
+template <class T, bool shared>
+void BM_PDFReplicas(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  const unsigned long int k = state.range(1);
+  std::vector<T> nParticles;
+  for (unsigned long int i = 0; i < k; i++)
+  {
+    nParticles.push_back(T(std::pow(10.0, 4 + 2 * double(i))));
+  }
+
+  for (auto _ : state)
+  {
+    if (shared)
+    {
+      DiffusionPDFReplicas<T> r(nParticles, beta, t);
+      r.setBetaSeed(seed);
+      r.setCounterRNG(true);
+      r.evolveToTime(t);
+      benchmark::DoNotOptimize(r.getMaxIdx(0));
+    }
+    else
+    {
+      for (auto &N : nParticles)
+      {
+        DiffusionPDF<T> d(N, beta, t, false, true);
+        d.setBetaSeed(seed);
+        d.setCounterRNG(true);
+        d.evolveToTime(t);
+        benchmark::DoNotOptimize(d.getMaxIdx());
+      }
+    }
+  }
+}
+
+// The biases a step draws, a block at a time, for each class of beta
+void BM_BetaFill(benchmark::State &state, const double b)
+{
+  BetaSampler sampler(b);
+  boost::random::mt19937_64 gen(seed);
+  std::vector<double> out(biasBlockSize);
+  for (auto _ : state)
+  {
+    sampler.fill(gen, out.data(), out.size());
+    benchmark::DoNotOptimize(out.data());
+  }
+  reportSites(state, double(state.iterations()) * out.size());
+}
+
+void BM_BetaFillSites(benchmark::State &state, const double b)
+{
+  BetaSampler sampler(b);
+  CounterRNG gen(seed);
+  std::vector<double> out(biasBlockSize);
+  unsigned long int time = 0;
+  for (auto _ : state)
+  {
+    sampler.fillSites(gen, time++, 0, out.data(), out.size());
+    benchmark::DoNotOptimize(out.data());
+  }
+  reportSites(state, double(state.iterations()) * out.size());
+}
+
+template <class T, bool tailSums>
+void BM_PDFFindQuantiles(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionPDF<T> d(pdfParticles<T>(), beta, t + stepsPerReset, true);
+  resetPDF(d, t, true);
+  d.setTailSums(tailSums);
+  std::vector<T> q = quantiles<T>();
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(d.findQuantiles(q));
+  }
+}
+
+template <class T, bool tailSums>
+void BM_PDFPGreaterThanX(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionPDF<T> d(pdfParticles<T>(), beta, t + stepsPerReset, true);
+  resetPDF(d, t, true);
+  d.setTailSums(tailSums);
+  unsigned long int idx = (d.getMinIdx() + d.getMaxIdx()) / 2;
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(d.pGreaterThanX(idx));
+  }
+}
+
+template <class T>
+void BM_TimeCDFFindQuantiles(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionTimeCDF<T> d(beta, t + stepsPerReset);
+  resetCDF(d, t);
+  std::vector<T> q = quantiles<T>();
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(d.findQuantiles(q));
+  }
+}
+
+// Stats/stat.h on its own, over the complementary CDF of a DiffusionTimeCDF
+template <class T>
+void BM_GumbelVariance(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  const std::vector<T> &cdf = cdfState<T>(t);
+  auto compCDF = [&](unsigned long int n) { return (n <= t) ? cdf[n] : T(0); };
+  std::vector<T> nParticles = quantiles<T>();
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(gumbelVarianceFused(compCDF, t + 1, -(long int)t, nParticles));
+  }
+}
+
+template <class T>
+void BM_PDFGumbelVariance(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionPDF<T> d(pdfParticles<T>(), beta, t + stepsPerReset, true);
+  resetPDF(d, t, true);
+  std::vector<T> nParticles = {T(1e4), T(1e8), T(1e12)};
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(d.getGumbelVariance(nParticles));
+  }
+}
+
+// Everything a save time records, as separate calls or one measure
+template <class T, bool fused>
+void BM_PDFSaveTime(benchmark::State &state)
+{
+  const unsigned long int t = state.range(0);
+  DiffusionPDF<T> d(pdfParticles<T>(), beta, t + stepsPerReset, true);
+  resetPDF(d, t, true);
+  d.setTailSums(true);
+  MeasurementPlan<T> plan;
+  plan.quantiles = quantiles<T>();
+  plan.velocities = {0.1, 0.2, 0.3, 0.4, 0.5};
+  plan.nParticles = {T(1e4), T(1e8), T(1e12)};
+  for (auto _ : state)
+  {
+    if (fused)
+    {
+      benchmark::DoNotOptimize(d.measure(plan));
+    }
+    else
+    {
+      benchmark::DoNotOptimize(d.findQuantiles(plan.quantiles));
+      for (auto &v : plan.velocities)
+      {
+        benchmark::DoNotOptimize(d.getPbAtV(v));
+      }
+      benchmark::DoNotOptimize(d.getGumbelVariance(plan.nParticles));
+    }
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_PDFStep, double, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, long double, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, RealType, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, ScaledDouble, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, DoubleDouble, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, double, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, long double, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFStep, RealType, false)->Apply(tArgs);
+
+BENCHMARK_TEMPLATE(BM_TimeCDFStep, double)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFStep, long double)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFStep, RealType)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFStep, DoubleDouble)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFStep, double, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFStep, RealType, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFWavefront, double)->ArgsProduct({{10000}, {1, 16, 64}});
+BENCHMARK_TEMPLATE(BM_TimeCDFWavefront, RealType)->ArgsProduct({{10000}, {1, 16, 64}});
+
+BENCHMARK_TEMPLATE(BM_PDFReplicas, double, false)->ArgsProduct({{1000}, {1, 4, 16}});
+BENCHMARK_TEMPLATE(BM_PDFReplicas, double, true)->ArgsProduct({{1000}, {1, 4, 16}});
+
+BENCHMARK_CAPTURE(BM_BetaFill, zero, 0.0);
+BENCHMARK_CAPTURE(BM_BetaFill, uniform, 1.0);
+BENCHMARK_CAPTURE(BM_BetaFill, half, std::numeric_limits<double>::infinity());
+BENCHMARK_CAPTURE(BM_BetaFill, general_small, 0.1);
+BENCHMARK_CAPTURE(BM_BetaFill, general_large, 5.0);
+BENCHMARK_CAPTURE(BM_BetaFillSites, uniform, 1.0);
+BENCHMARK_CAPTURE(BM_BetaFillSites, general_large, 5.0);
+
+BENCHMARK_TEMPLATE(BM_PDFFindQuantiles, double, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFFindQuantiles, RealType, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFFindQuantiles, RealType, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFPGreaterThanX, double, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFPGreaterThanX, RealType, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFPGreaterThanX, RealType, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFFindQuantiles, double)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_TimeCDFFindQuantiles, RealType)->Apply(tArgs);
+
+BENCHMARK_TEMPLATE(BM_GumbelVariance, double)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_GumbelVariance, RealType)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_GumbelVariance, DoubleDouble)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFGumbelVariance, double)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFGumbelVariance, RealType)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFSaveTime, double, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFSaveTime, double, true)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFSaveTime, RealType, false)->Apply(tArgs);
+BENCHMARK_TEMPLATE(BM_PDFSaveTime, RealType, true)->Apply(tArgs);
+
+BENCHMARK_MAIN();
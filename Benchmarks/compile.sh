@@ -0,0 +1,2 @@
+#!/bin/bash
+c++ -O3 -march=native -Wall -std=gnu++11 -pthread benchmarks.cpp -I/c/modular-boost -lbenchmark -lquadmath -o benchmarks
@@ -7,241 +7,149 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <string>
 #include <math.h>
 
-#include "pybind11_numpy_scalar.h"
+#include "../IO/numpyScalars.h"
+#include "../IO/numpyView.h"
+#include "../IO/recorder.h"
+#include "../Scalars/doubleDouble.h"
 #include "diffusionCDF.hpp"
-#include "../Stats/stat.h"
+#include "diffusionCDFBatch.hpp"
 
 namespace py = pybind11;
 
 using RealType = boost::multiprecision::float128;
-static_assert(sizeof(RealType) == 16, "Bad size");
 
-// Boilerplate to get PyBind11 to cast to a npquad precision.
-namespace pybind11
+template <class RealType>
+void declareDiffusionCDF(py::module &m, const std::string &suffix)
 {
-  namespace detail
-  {
-
-    // Similar to enums in `pybind11/numpy.h`. Determined by doing:
-    // python3 -c 'import numpy as np; print(np.dtype(np.float16).num)'
-    constexpr int NPY_FLOAT16 = 256;
-
-    // Kind of follows:
-    // https://github.com/pybind/pybind11/blob/9bb3313162c0b856125e481ceece9d8faa567716/include/pybind11/numpy.h#L1000
-    template <>
-    struct npy_format_descriptor<RealType>
-    {
-      static constexpr auto name = _("RealType");
-      static pybind11::dtype dtype()
-      {
-        handle ptr = npy_api::get().PyArray_DescrFromType_(NPY_FLOAT16);
-        return reinterpret_borrow<pybind11::dtype>(ptr);
-      }
-    };
-
-    template <>
-    struct type_caster<RealType> : npy_scalar_caster<RealType>
-    {
-      static constexpr auto name = _("RealType");
-    };
-
-  } // namespace detail
-} // namespace pybind11
-
-DiffusionCDF::DiffusionCDF(const double _beta, const unsigned long int _tMax)
-{
-  beta = _beta;
-  tMax = _tMax;
-
-  if (_beta != 0)
-  {
-    boost::random::beta_distribution<>::param_type params(_beta, _beta);
-    betaParams = params;
-  }
-
-  std::uniform_real_distribution<>::param_type unifParams(0.0, 1.0);
-  dis.param(unifParams);
-  gen.seed(rd());
-}
-
-double DiffusionCDF::generateBeta()
-{
-  // If beta = 0 return either 0 or 1
-  if (beta == 0.0)
-  {
-    return round(dis(gen));
-  }
-  // If beta = 1 use random uniform distribution
-  else if (beta == 1)
-  {
-    return dis(gen);
-  }
-  // If beta = inf return 0.5
-  else if (isinf(beta))
-  {
-    return 0.5;
-  }
-  else
-  {
-    return beta_dist(gen, betaParams);
-  }
-}
-
-DiffusionTimeCDF::DiffusionTimeCDF(const double _beta, const unsigned long int _tMax) : DiffusionCDF(_beta, _tMax)
-{
-  CDF.resize(tMax + 1);
-  CDF[0] = 1;
-}
-
-void DiffusionTimeCDF::iterateTimeStep()
-{
-  std::vector<RealType> CDF_next(tMax + 1);
-  for (unsigned long int n = 0; n <= t + 1; n++)
-  {
-    if (n == 0)
-    {
-      CDF_next[n] = 1; // Need CDF(n=0, t) = 1
-    }
-    else if (n == t + 1)
-    {
-      RealType beta = RealType(generateBeta());
-      CDF_next[n] = beta * CDF[n - 1];
-    }
-    else
-    {
-      /* Maybe add this in
-      if (CDF[n-1] == CDF[n]){
-        continue // or could even break?
-      }
-      */
-      RealType beta = RealType(generateBeta());
-      CDF_next[n] = beta * CDF[n - 1] + (1 - beta) * CDF[n];
-    }
-  }
-  CDF = CDF_next;
-  t += 1;
-}
-
-unsigned long int DiffusionTimeCDF::findQuantile(RealType quantile)
-{
-  unsigned long int quantilePosition;
-  for (unsigned long int n = t; n >= 0; n--)
-  {
-    if (CDF[n] > 1 / quantile)
-    {
-      quantilePosition = 2 * n + 2 - t;
-      break;
-    }
-  }
-  return quantilePosition;
-}
-
-std::vector<unsigned long int> DiffusionTimeCDF::findQuantiles(
-    std::vector<RealType> quantiles)
-{
-  // Sort incoming quantiles b/c we need them to be in descending order for
-  // algorithm to work
-  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
-
-  // Initialize to have same number of vectors as in Ns
-  std::vector<unsigned long int> quantilePositions(quantiles.size());
-  unsigned long int quantile_idx = 0;
-  for (unsigned long int n = t; n >= 0; n--)
-  {
-    while (CDF[n] > 1 / quantiles[quantile_idx])
-    {
-      quantilePositions[quantile_idx] = 2 * n + 2 - t;
-      quantile_idx += 1;
-
-      // Break while loop if past last position
-      if (quantile_idx == quantiles.size())
-      {
-        break;
-      }
-    }
-    // Also need to break for loop if in last position b/c we are done searching
-    if (quantile_idx == quantiles.size())
-    {
-      break;
-    }
-  }
-  return quantilePositions;
-}
-
-std::vector<long int> DiffusionTimeCDF::getxvals()
-{
-  std::vector<long int> xvals(t + 1);
-  for (unsigned int n = 0; n < xvals.size(); n++)
-  {
-    xvals[n] = 2 * n - t;
-  }
-  return xvals;
-}
-
-RealType DiffusionTimeCDF::getGumbelVariance(RealType nParticles)
-{
-  std::vector<RealType> cdf = slice(CDF, 0, t);
-  cdf.push_back(0); // Need to add 0 to CDF to make it complete.
-
-  std::vector<long int> xvals = getxvals();
-  RealType var = getGumbelVarianceCDF(xvals, cdf, nParticles);
-  return var;
-}
-
-std::vector<RealType> DiffusionTimeCDF::getGumbelVariance(std::vector<RealType> nParticles)
-{
-  std::vector<RealType> cdf = slice(CDF, 0, t);
-  cdf.push_back(0); // Need to add 0 to CDF to make it complete.
-  std::vector<long int> xvals = getxvals();
-  return getGumbelVarianceCDF(xvals, cdf, nParticles);
-}
-
-std::pair<RealType, float> DiffusionTimeCDF::getProbandV(RealType quantile)
-{
-  unsigned long int quantilePosition;
-  RealType prob;
-  for (unsigned long int n = t; n >= 0; n--)
-  {
-    if (CDF[n] > 1 / quantile)
-    {
-      quantilePosition = 2 * n - t;
-      prob = CDF[n];
-      break;
-    }
-  }
-  float v = (float)quantilePosition / (float)t;
-  return std::make_pair(prob, v);
-}
-
-std::vector<RealType> DiffusionTimeCDF::getSaveCDF()
-{
-  return slice(CDF, 0, t);
+  typedef DiffusionCDF<RealType> Base;
+  typedef DiffusionTimeCDF<RealType> Class;
+
+  py::class_<Base>(m, ("DiffusionCDF" + suffix).c_str())
+      .def(py::init<const double, const unsigned long int, const std::string>(), py::arg("beta"), py::arg("tMax"),
+           py::arg("storageDirectory") = "")
+      .def("getBeta", &Base::getBeta)
+      .def("getCDF", [](py::object self) {
+             Base &c = self.cast<Base &>();
+             return guardedView(c.viewCDF(), c.getCDFViews(), self); },
+           "Read only view of the CDF buffer, shares memory with the object. setCDF and loadCheckpoint "
+           "throw while it's alive")
+      .def("getCDFCopy", &Base::getCDF)
+      .def("setCDF", &Base::setCDF, py::arg("CDF"))
+      .def("gettMax", &Base::gettMax)
+      .def("settMax", &Base::settMax)
+      .def("setBetaSeed", &Base::setBetaSeed, py::arg("seed"))
+      .def("setCounterRNG", &Base::setCounterRNG, py::arg("counterRNG"))
+      .def("getCounterRNG", &Base::getCounterRNG)
+      .def("setNumThreads", &Base::setNumThreads, py::arg("numThreads"))
+      .def("getNumThreads", &Base::getNumThreads)
+      .def("getStats", &Base::getStats)
+      .def("resetStats", &Base::resetStats)
+      .def("setStatsLogInterval", &Base::setStatsLogInterval, py::arg("steps"))
+      .def("getStatsLogInterval", &Base::getStatsLogInterval)
+      .def("getStorageDirectory", &Base::getStorageDirectory);
+
+  py::class_<Class, Base>(m, ("DiffusionTimeCDF" + suffix).c_str())
+      .def(py::init<const double, const unsigned long int, const std::string>(), py::arg("beta"), py::arg("tMax"),
+           py::arg("storageDirectory") = "")
+      .def("getGumbelVariance", static_cast<RealType (Class::*)(RealType)>(&Class::getGumbelVariance), py::arg("nParticles"))
+      .def("getGumbelVariance", static_cast<std::vector<RealType> (Class::*)(std::vector<RealType>)>(&Class::getGumbelVariance), py::arg("nParticles"))
+      .def("getTime", &Class::getTime)
+      .def("setTime", &Class::setTime)
+      .def("getBias", &Class::getBias, py::arg("time"), py::arg("n"))
+      .def("setActiveBand", &Class::setActiveBand, py::arg("activeBand"))
+      .def("getActiveBand", &Class::getActiveBand)
+      .def("setBandTolerance", &Class::setBandTolerance, py::arg("bandTolerance"))
+      .def("getBandTolerance", &Class::getBandTolerance)
+      .def("getBand", &Class::getBand)
+      .def("setWavefrontSteps", &Class::setWavefrontSteps, py::arg("steps"))
+      .def("getWavefrontSteps", &Class::getWavefrontSteps)
+      .def("iterateTimeStep", &Class::iterateTimeStep)
+      .def("iterateTimeSteps", &Class::iterateTimeSteps, py::arg("num"), py::call_guard<py::gil_scoped_release>())
+      .def("evolveToTime", &Class::evolveToTime, py::arg("time"), py::call_guard<py::gil_scoped_release>())
+      .def("evolveTimesteps", &Class::evolveTimesteps, py::arg("num"), py::call_guard<py::gil_scoped_release>())
+      .def("findQuantile", &Class::findQuantile, py::arg("quantile"))
+      .def("findQuantiles", &Class::findQuantiles, py::arg("quantiles"))
+      .def("getSaveCDF", [](py::object self) {
+             Class &c = self.cast<Class &>();
+             return guardedView(c.viewCDF(), 0, c.getTime(), c.getCDFViews(), self); },
+           "Read only view of CDF[0, ..., time], shares memory with the object. setCDF and loadCheckpoint "
+           "throw while it's alive")
+      .def("getSaveCDFCopy", &Class::getSaveCDF)
+      .def("getxvals", &Class::getxvals)
+      .def("getProbandV", &Class::getProbandV, py::arg("quantile"))
+      .def("getPbAtV", &Class::getPbAtV, py::arg("v"))
+      .def("measure", [](Class &c, std::vector<RealType> quantiles, std::vector<double> velocities, std::vector<RealType> nParticles) {
+             MeasurementPlan<RealType> plan;
+             plan.quantiles = quantiles;
+             plan.velocities = velocities;
+             plan.nParticles = nParticles;
+             auto result = c.measure(plan);
+             return py::make_tuple(result.quantiles, result.pb, result.gumbelVariance); },
+           py::arg("quantiles"), py::arg("velocities"), py::arg("nParticles"),
+           "(quantiles, Pb, Gumbel variances) in the order given, from one pass over the state")
+      .def("saveCheckpoint", &Class::saveCheckpoint, py::arg("fileName"), py::call_guard<py::gil_scoped_release>())
+      .def("loadCheckpoint", &Class::loadCheckpoint, py::arg("fileName"), py::call_guard<py::gil_scoped_release>())
+      .def("saveCheckpointAsync", &Class::saveCheckpointAsync, py::arg("fileName"))
+      .def("waitForCheckpoint", &Class::waitForCheckpoint, py::call_guard<py::gil_scoped_release>())
+      .def("checkpointPending", &Class::checkpointPending);
+
+  typedef Recorder<Class, RealType> Rec;
+
+  py::class_<Rec>(m, ("RecorderTimeCDF" + suffix).c_str())
+      .def(py::init<const std::string, const bool, const unsigned long int>(),
+           py::arg("fileName"), py::arg("append") = false, py::arg("flushRows") = 1000)
+      .def("addQuantiles", &Rec::addQuantiles, py::arg("quantiles"))
+      .def("addPb", &Rec::addPb, py::arg("velocities"))
+      .def("addGumbelVariance", &Rec::addGumbelVariance, py::arg("nParticles"))
+      .def("addMeasurement", &Rec::addMeasurement, py::arg("quantiles"), py::arg("velocities"), py::arg("nParticles"))
+      .def("addProbAndV", &Rec::addProbAndV, py::arg("quantile"))
+      .def("getColumns", &Rec::getColumns)
+      .def("getFlushRows", &Rec::getFlushRows)
+      .def("setFlushRows", &Rec::setFlushRows, py::arg("flushRows"))
+      .def("record", &Rec::record, py::arg("system"))
+      .def("evolveAndRecord", &Rec::evolveAndRecord, py::arg("system"), py::arg("times"),
+           py::call_guard<py::gil_scoped_release>())
+      .def("flush", &Rec::flush)
+      .def("close", &Rec::close);
+
+  typedef DiffusionTimeCDFBatch<RealType> Batch;
+
+  py::class_<Batch>(m, ("DiffusionTimeCDFBatch" + suffix).c_str())
+      .def(py::init<const double, const unsigned long int, const unsigned long int>(),
+           py::arg("beta"), py::arg("tMax"), py::arg("numLanes"))
+      .def("getBeta", &Batch::getBeta)
+      .def("gettMax", &Batch::gettMax)
+      .def("getNumLanes", &Batch::getNumLanes)
+      .def("getTime", &Batch::getTime)
+      .def("setBetaSeed", &Batch::setBetaSeed, py::arg("seed"))
+      .def("getBetaSeed", &Batch::getBetaSeed)
+      .def("iterateTimeStep", &Batch::iterateTimeStep)
+      .def("evolveToTime", &Batch::evolveToTime, py::arg("time"), py::call_guard<py::gil_scoped_release>())
+      .def("evolveTimesteps", &Batch::evolveTimesteps, py::arg("num"), py::call_guard<py::gil_scoped_release>())
+      .def("getCDF", &Batch::getCDF, py::arg("lane"))
+      .def("getSaveCDF", &Batch::getSaveCDF, py::arg("lane"))
+      .def("findQuantiles", &Batch::findQuantiles, py::arg("quantiles"))
+      .def("getGumbelVariance", &Batch::getGumbelVariance, py::arg("nParticles"))
+      .def("getPbAtV", &Batch::getPbAtV, py::arg("v"));
 }
 
 PYBIND11_MODULE(diffusionCDF, m)
 {
   m.doc() = "Diffusion recurrance relation";
-  py::class_<DiffusionCDF>(m, "DiffusionCDF")
-      .def(py::init<const double, const unsigned long int>(), py::arg("beta"), py::arg("tMax"))
-      .def("getBeta", &DiffusionCDF::getBeta)
-      .def("getCDF", &DiffusionCDF::getCDF)
-      .def("setCDF", &DiffusionCDF::setCDF, py::arg("CDF"))
-      .def("gettMax", &DiffusionCDF::gettMax)
-      .def("settMax", &DiffusionCDF::settMax)
-      .def("setBetaSeed", &DiffusionCDF::setBetaSeed, py::arg("seed"));
 
-  py::class_<DiffusionTimeCDF, DiffusionCDF>(m, "DiffusionTimeCDF")
-      .def(py::init<const double, const unsigned long int>(), py::arg("beta"), py::arg("tMax"))
-      .def("getGumbelVariance", static_cast<RealType (DiffusionTimeCDF::*)(RealType)>(&DiffusionTimeCDF::getGumbelVariance), py::arg("nParticles"))
-      .def("getGumbelVariance", static_cast<std::vector<RealType> (DiffusionTimeCDF::*)(std::vector<RealType>)>(&DiffusionTimeCDF::getGumbelVariance), py::arg("nParticles"))
-      .def("getTime", &DiffusionTimeCDF::getTime)
-      .def("setTime", &DiffusionTimeCDF::setTime)
-      .def("iterateTimeStep", &DiffusionTimeCDF::iterateTimeStep)
-      .def("findQuantile", &DiffusionTimeCDF::findQuantile, py::arg("quantile"))
-      .def("findQuantiles", &DiffusionTimeCDF::findQuantiles, py::arg("quantiles"))
-      .def("getSaveCDF", &DiffusionTimeCDF::getSaveCDF)
-      .def("getxvals", &DiffusionTimeCDF::getxvals)
-      .def("getProbandV", &DiffusionTimeCDF::getProbandV, py::arg("quantile"));
+  // One set of classes per precision. The quad precision classes are also
+  // exported without a suffix since that is what the Python wrappers use.
+  declareDiffusionCDF<double>(m, "_f64");
+  declareDiffusionCDF<long double>(m, "_f80");
+  declareDiffusionCDF<RealType>(m, "_f128");
+  // ~106 bits from pairs of doubles, much faster than float128
+  declareDiffusionCDF<DoubleDouble>(m, "_dd");
+
+  m.attr("DiffusionCDF") = m.attr("DiffusionCDF_f128");
+  m.attr("DiffusionTimeCDF") = m.attr("DiffusionTimeCDF_f128");
+  m.attr("DiffusionTimeCDFBatch") = m.attr("DiffusionTimeCDFBatch_f128");
+  m.attr("RecorderTimeCDF") = m.attr("RecorderTimeCDF_f128");
 }
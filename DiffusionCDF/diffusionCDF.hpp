@@ -1,68 +1,261 @@
+#ifndef DIFFUSIONCDF_HPP_
+#define DIFFUSIONCDF_HPP_
+
 #include <assert.h>
 #include <boost/math/distributions.hpp>
-#include <boost/multiprecision/float128.hpp>
 #include <boost/random.hpp>
 #include <boost/random/beta_distribution.hpp>
 #include <boost/random/binomial_distribution.hpp>
 #include <boost/random/normal_distribution.hpp>
+#include <algorithm>
+#include <cmath>
 #include <math.h>
+#include <memory>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
-typedef boost::multiprecision::float128 RealType;
+#include "../IO/checkpoint.h"
+#include "../IO/storage.h"
+#include "../Parallel/threadPool.h"
+#include "../Random/betaSampler.h"
+#include "../Stats/counters.h"
+#include "../Stats/measurement.h"
+#include "../Stats/stat.h"
 
-#ifndef DIFFUSIONCDF_HPP_
-#define DIFFUSIONCDF_HPP_
-
-// Base Diffusion class
+// Base Diffusion class. RealType is the scalar the CDF is stored and evolved
+// in (e.g. double, long double or boost::multiprecision::float128).
+template <class RealType>
 class DiffusionCDF
 {
 protected:
-  std::vector<RealType> CDF;
+  // On the heap, or mapped from files in a directory (see IO/storage.h)
+  storage::Vector<RealType> CDF;
+  // numpy views of the CDF, nothing moves it while there are any
+  storage::Views CDFViews;
   double beta;
   unsigned long int tMax;
 
-  // Set up random number generators.
-  boost::random::beta_distribution<>::param_type betaParams;
-
+  // Set up random number generators. If counterRNG is set the biases come
+  // from counterGen keyed on (seed, time, site) instead of the sequential gen.
   std::random_device rd;
   boost::random::mt19937_64 gen;
+  CounterRNG counterGen;
+  bool counterRNG = false;
 
-  std::uniform_real_distribution<> dis;
-  boost::random::beta_distribution<> beta_dist;
+  BetaSampler betaSampler;
+
+  // Biases for the current block of sites, refilled as a step sweeps up
+  std::vector<double> biases;
+
+  // Threads a single step is split over. Only used with the counter RNG since
+  // the sequential gen has to hand out the biases in order.
+  unsigned int numThreads = 1;
+  std::unique_ptr<ThreadPool> pool;
+
+  // Set when the CDF is changed from outside so the active band (see
+  // DiffusionTimeCDF) is found again before the next step
+  bool bandValid = false;
+
+  // What the steps and queries did and how long they took, see
+  // Stats/counters.h
+  EngineStats stats;
 
   double generateBeta();
 
 public:
-  DiffusionCDF(const double _beta, const unsigned long int _tMax);
+  DiffusionCDF(const double _beta, const unsigned long int _tMax, const std::string _storageDirectory = "");
   ~DiffusionCDF(){};
 
   double getBeta() { return beta; };
-  void setBeta(double _beta) { beta = _beta; };
+  void setBeta(double _beta)
+  {
+    beta = _beta;
+    betaSampler = BetaSampler(_beta);
+  };
 
-  std::vector<RealType> getCDF() { return CDF; };
-  void setCDF(std::vector<RealType> _CDF) { CDF = _CDF; };
+  std::vector<RealType> getCDF() { return std::vector<RealType>(CDF.begin(), CDF.end()); };
+  // The buffer itself, for sharing with numpy without a copy. The steps never
+  // move it, and the bindings count the numpy views of it in getCDFViews()
+  // (IO/numpyView.h).
+  const storage::Vector<RealType> &viewCDF() { return CDF; };
+  storage::Views &getCDFViews() { return CDFViews; };
+  void setCDF(std::vector<RealType> _CDF)
+  {
+    CDFViews.check("setCDF");
+    CDF.assign(_CDF.begin(), _CDF.end());
+    bandValid = false;
+  };
+  // Empty when the CDF is on the heap
+  std::string getStorageDirectory() { return CDF.get_allocator().getDirectory(); };
 
   unsigned long int gettMax() { return tMax; };
   void settMax(unsigned long int _tMax) { tMax = _tMax; };
 
-  void setBetaSeed(const unsigned int seed) { gen.seed(seed); };
+  void setBetaSeed(const unsigned int seed)
+  {
+    gen.seed(seed);
+    counterGen.setSeed(seed);
+  };
+
+  void setCounterRNG(const bool _counterRNG) { counterRNG = _counterRNG; };
+  bool getCounterRNG() { return counterRNG; };
+
+  void setNumThreads(const unsigned int _numThreads)
+  {
+    if (_numThreads == 0)
+    {
+      throw std::runtime_error("Number of threads must be at least 1");
+    }
+    numThreads = _numThreads;
+    pool.reset(numThreads > 1 ? new ThreadPool(numThreads) : nullptr);
+  };
+  unsigned int getNumThreads() { return numThreads; };
+
+  // Counters and per phase seconds since the start or the last reset. Empty
+  // when built with RWRE_NO_STATS.
+  std::map<std::string, double> getStats() { return stats.get(); };
+  void resetStats() { stats.reset(); };
+  // Print the stats every steps steps, 0 (the default) for never
+  void setStatsLogInterval(const unsigned long int steps) { stats.setLogInterval(steps); };
+  unsigned long int getStatsLogInterval() { return stats.getLogInterval(); };
 };
 
-class DiffusionTimeCDF : public DiffusionCDF
+// Sites per tile of the skewed multi step update, m0 in iterateTimeSteps
+constexpr unsigned long int wavefrontTileSites = 8192;
+
+template <class RealType>
+class DiffusionTimeCDF : public DiffusionCDF<RealType>
 {
 private:
   unsigned long int t = 0;
 
+  using DiffusionCDF<RealType>::CDF;
+  using DiffusionCDF<RealType>::CDFViews;
+  using DiffusionCDF<RealType>::beta;
+  using DiffusionCDF<RealType>::tMax;
+  using DiffusionCDF<RealType>::gen;
+  using DiffusionCDF<RealType>::counterGen;
+  using DiffusionCDF<RealType>::counterRNG;
+  using DiffusionCDF<RealType>::betaSampler;
+  using DiffusionCDF<RealType>::biases;
+  using DiffusionCDF<RealType>::pool;
+  using DiffusionCDF<RealType>::bandValid;
+  using DiffusionCDF<RealType>::stats;
+
+  // With the active band on a step only updates [bandLow + 1, bandHigh + 1].
+  // CDF[0..bandLow] are saturated (1 - CDF <= bandTolerance) and everything
+  // past bandHigh has underflowed (CDF <= bandTolerance), so both are left
+  // as they are.
+  bool activeBand = false;
+  double bandTolerance = 0;
+  unsigned long int bandLow = 0;
+  unsigned long int bandHigh = 0;
+
+  void findBand();
+  // Draw and throw away num biases from gen so skipped sites don't shift the
+  // ones after them
+  void skipBiases(unsigned long int num);
+
+  // Per chunk bias buffers and old CDF values left of each chunk for the
+  // threaded step
+  std::vector<std::vector<double>> chunkBiases;
+  std::vector<RealType> chunkPrev;
+  std::vector<EngineStats> chunkStats;
+
+  // Steps sites [first, last] from time stepTime to stepTime + 1 in place and
+  // returns the old value of last
+  RealType updateRange(const unsigned long int first,
+                       const unsigned long int last,
+                       RealType CDF_prev,
+                       std::vector<double> &blockBiases,
+                       BetaSampler &sampler,
+                       CounterRNG *siteGen,
+                       EngineStats &rangeStats,
+                       const unsigned long int stepTime);
+
+  // Old value of the last site each step of a wavefront updated in the tile
+  // before
+  std::vector<RealType> wavefrontPrev;
+  unsigned long int wavefrontSteps = 1;
+
+  // Lays the checkpoint out in a checkpoint::Writer or a checkpoint::Buffer
+  template <class Sink>
+  void writeCheckpoint(Sink &writer);
+  checkpoint::AsyncWriter asyncCheckpoint;
+
 public:
-  DiffusionTimeCDF(const double _beta, const unsigned long int _tMax);
+  // With a storageDirectory the CDF is mapped from a file there instead of
+  // being allocated, see IO/storage.h
+  DiffusionTimeCDF(const double _beta, const unsigned long int _tMax, const std::string _storageDirectory = "");
 
   unsigned long int getTime() { return t; };
-  void setTime(unsigned long int _t) { t = _t; };
+  void setTime(unsigned long int _t)
+  {
+    t = _t;
+    bandValid = false;
+  };
+
+  /*
+  Only update (and draw biases for) the sites where the CDF still changes.
+  Saturated sites compute b + (1 - b) which rounds to exactly 1, and
+  underflowed sites b * 0 + (1 - b) * 0 = 0, so with a tolerance of 0 the
+  result is bit for bit the same as updating every site. A tolerance above 0
+  also freezes sites within it of 1 or 0, which is no longer exact.
+
+  With the counter RNG skipped sites don't draw their biases at all. With the
+  sequential gen they still have to be drawn (and thrown away) to keep the
+  stream in order, so only the arithmetic is saved.
+  */
+  void setActiveBand(const bool _activeBand)
+  {
+    activeBand = _activeBand;
+    bandValid = false;
+  };
+  bool getActiveBand() { return activeBand; };
+  void setBandTolerance(const double _bandTolerance)
+  {
+    if (_bandTolerance < 0)
+    {
+      throw std::runtime_error("Band tolerance must be at least 0");
+    }
+    bandTolerance = _bandTolerance;
+    bandValid = false;
+  };
+  double getBandTolerance() { return bandTolerance; };
+  // Steps evolveToTime takes per pass with iterateTimeSteps, 1 (the default)
+  // steps one at a time
+  void setWavefrontSteps(const unsigned long int _wavefrontSteps)
+  {
+    if (_wavefrontSteps == 0)
+    {
+      throw std::runtime_error("Wavefront steps must be at least 1");
+    }
+    wavefrontSteps = _wavefrontSteps;
+  };
+  unsigned long int getWavefrontSteps() { return wavefrontSteps; };
+  // Sites [bandLow + 1, bandHigh + 1] the next step will update
+  std::pair<unsigned long int, unsigned long int> getBand()
+  {
+    if (!bandValid)
+    {
+      findBand();
+    }
+    return std::make_pair(bandLow, bandHigh);
+  };
+
+  // Bias used for CDF[n] going from time _t to _t+1 with the counter RNG
+  double getBias(const unsigned long int _t, const unsigned long int n);
 
   // Functions that do things
   void iterateTimeStep();
+  // k steps in one pass over memory with the counter RNG, otherwise k steps
+  void iterateTimeSteps(const unsigned long int k);
+  void evolveToTime(const unsigned long int _t);
+  void evolveTimesteps(const unsigned long int num);
 
   unsigned long int findQuantile(RealType quantile);
   std::vector<unsigned long int> findQuantiles(std::vector<RealType> quantiles);
@@ -74,6 +267,611 @@ public:
   std::vector<long int> getxvals();
   std::vector<RealType> getSaveCDF();
   std::pair<RealType, float> getProbandV(RealType quantile);
+
+  // Probability of being at or past x = v * t
+  RealType getPbAtV(const double v);
+
+  // The quantiles, Pb at the velocities and Gumbel variances in one pass down
+  // from t, see Stats/measurement.h
+  Measurement<RealType, unsigned long int> measure(const MeasurementPlan<RealType> &plan);
+
+  // Binary checkpoint of the whole state, see IO/checkpoint.h
+  void saveCheckpoint(const std::string &fileName);
+  void loadCheckpoint(const std::string &fileName);
+
+  // Copy the state into a staging buffer and write it to fileName on a
+  // background thread, so the pause is only the copy. A second call waits for
+  // the first write. Must be waited for before the process exits.
+  void saveCheckpointAsync(const std::string &fileName);
+  // Block until the background write is done, throwing if it failed
+  void waitForCheckpoint() { asyncCheckpoint.wait(); };
+  bool checkpointPending() { return asyncCheckpoint.pending(); };
 };
 
+template <class RealType>
+DiffusionCDF<RealType>::DiffusionCDF(const double _beta, const unsigned long int _tMax, const std::string _storageDirectory)
+    : CDF(storage::Allocator<RealType>(_storageDirectory)), betaSampler(_beta), biases(biasBlockSize)
+{
+  beta = _beta;
+  tMax = _tMax;
+
+  unsigned int seed = rd();
+  gen.seed(seed);
+  counterGen.setSeed(seed);
+}
+
+template <class RealType>
+double DiffusionCDF<RealType>::generateBeta()
+{
+  return betaSampler(gen);
+}
+
+template <class RealType>
+DiffusionTimeCDF<RealType>::DiffusionTimeCDF(const double _beta, const unsigned long int _tMax, const std::string _storageDirectory)
+    : DiffusionCDF<RealType>(_beta, _tMax, _storageDirectory)
+{
+  CDF.resize(tMax + 1);
+  CDF[0] = 1;
+}
+
+/*
+The update is done in place walking up from n=0. CDF(n, t+1) only depends on
+CDF(n-1, t) and CDF(n, t), so we only need to carry the previous (old) value of
+CDF[n-1] along. This keeps the betas drawn in the same order as before and
+doesn't allocate or touch anything past the live region [0, t+1].
+
+The betas are drawn a block at a time into the biases buffer rather than one
+call per site.
+
+With the counter RNG the bias for CDF[n] is keyed on (t, n-1). Z(n, t+1) =
+b Z(n-1, t) + (1-b) Z(n, t) where b is the probability of stepping right from
+site n-1, so a DiffusionPDF with the same seed evolves in the same environment.
+
+updateRange does [first, last] given the old value of CDF[first-1]. If
+siteGen is null the biases come from gen in order.
+*/
+template <class RealType>
+RealType DiffusionTimeCDF<RealType>::updateRange(const unsigned long int first,
+                                                 const unsigned long int last,
+                                                 RealType CDF_prev,
+                                                 std::vector<double> &blockBiases,
+                                                 BetaSampler &sampler,
+                                                 CounterRNG *siteGen,
+                                                 EngineStats &rangeStats,
+                                                 const unsigned long int stepTime)
+{
+  unsigned long int blockStart = first;
+  unsigned long int blockEnd = first;
+  storage::Prefetch<RealType> prefetch(CDF, first, last);
+  EngineStats::Clock::time_point phaseStart = EngineStats::now();
+  for (unsigned long int n = first; n <= last; n++)
+  {
+    if (n == blockEnd)
+    {
+      prefetch.reach(n);
+      rangeStats.addTime(stats::UpdateTime, phaseStart);
+      phaseStart = EngineStats::now();
+      blockStart = n;
+      blockEnd = std::min<unsigned long int>(n + blockBiases.size(), last + 1);
+      if (siteGen)
+      {
+        // CDF[n] picks up the bias of site n-1 in the PDF picture
+        sampler.fillSites(*siteGen, stepTime, blockStart - 1, blockBiases.data(), blockEnd - blockStart);
+      }
+      else
+      {
+        sampler.fill(gen, blockBiases.data(), blockEnd - blockStart);
+      }
+      rangeStats.add(stats::BiasDraws, blockEnd - blockStart);
+      rangeStats.addTime(stats::RNGTime, phaseStart);
+      phaseStart = EngineStats::now();
+    }
+    RealType beta = RealType(blockBiases[n - blockStart]);
+    if (n == stepTime + 1)
+    {
+      CDF[n] = beta * CDF_prev;
+    }
+    else
+    {
+      RealType CDF_current = CDF[n];
+      CDF[n] = beta * CDF_prev + (1 - beta) * CDF_current;
+      CDF_prev = CDF_current;
+    }
+  }
+  rangeStats.addTime(stats::UpdateTime, phaseStart);
+  return CDF_prev;
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::findBand()
+{
+  bandLow = 0;
+  while (bandLow < t && 1 - CDF[bandLow + 1] <= bandTolerance)
+  {
+    bandLow += 1;
+  }
+  bandHigh = t;
+  while (bandHigh > bandLow && CDF[bandHigh] <= bandTolerance)
+  {
+    bandHigh -= 1;
+  }
+  bandValid = true;
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::skipBiases(unsigned long int num)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::BiasDraws, num);
+  while (num > 0)
+  {
+    unsigned long int block = std::min<unsigned long int>(num, biases.size());
+    betaSampler.fill(gen, biases.data(), block);
+    num -= block;
+  }
+  stats.addTime(stats::RNGTime, start);
+}
+
+/*
+With more than one thread (and the counter RNG) the sites being updated ([1,
+t+1], or the active band) are cut into contiguous chunks. The only thing a
+chunk needs from its left neighbour is the old value of the site just left of
+it, so those are saved before anything is written and then every chunk runs
+the same in-place sweep on its own. Since each bias only depends on (seed, t,
+n) the result is bit for bit the same as the serial step.
+*/
+template <class RealType>
+void DiffusionTimeCDF<RealType>::iterateTimeStep()
+{
+  EngineStats::Clock::time_point stepStart = EngineStats::now();
+  RealType CDF_prev = CDF[0];
+  CDF[0] = 1; // Need CDF(n=0, t) = 1
+
+  unsigned long int first = 1;
+  unsigned long int last = t + 1;
+  if (activeBand)
+  {
+    if (!bandValid)
+    {
+      EngineStats::Clock::time_point bandStart = EngineStats::now();
+      findBand();
+      stats.addTime(stats::EdgeTime, bandStart);
+    }
+    first = bandLow + 1;
+    last = std::min(bandHigh + 1, t + 1);
+    if (bandLow > 0)
+    {
+      CDF_prev = CDF[bandLow];
+    }
+    if (!counterRNG)
+    {
+      skipBiases(first - 1);
+    }
+  }
+
+  unsigned long int numSites = last - first + 1;
+  unsigned long int numChunks = 1;
+  if (pool && counterRNG)
+  {
+    numChunks = std::min<unsigned long int>(pool->size(), numSites / minSitesPerThread);
+  }
+
+  if (numChunks <= 1)
+  {
+    updateRange(first, last, CDF_prev, biases, betaSampler, counterRNG ? &counterGen : nullptr, stats, t);
+  }
+  else
+  {
+    if (chunkBiases.size() < numChunks)
+    {
+      chunkBiases.resize(numChunks, std::vector<double>(biasBlockSize));
+    }
+    chunkPrev.resize(numChunks);
+    chunkStats.assign(numChunks, EngineStats());
+    chunkPrev[0] = CDF_prev;
+    for (unsigned long int c = 1; c < numChunks; c++)
+    {
+      chunkPrev[c] = CDF[first + c * numSites / numChunks - 1];
+    }
+
+    pool->parallelFor(numChunks, [&](std::size_t c) {
+      unsigned long int chunkFirst = first + c * numSites / numChunks;
+      unsigned long int chunkLast = first + (c + 1) * numSites / numChunks - 1;
+      CounterRNG siteGen(counterGen.getSeed());
+      BetaSampler sampler = betaSampler;
+      updateRange(chunkFirst, chunkLast, chunkPrev[c], chunkBiases[c], sampler, &siteGen, chunkStats[c], t);
+    });
+    for (unsigned long int c = 0; c < numChunks; c++)
+    {
+      stats.merge(chunkStats[c]);
+    }
+  }
+
+  if (activeBand)
+  {
+    if (!counterRNG)
+    {
+      skipBiases(t + 1 - last);
+    }
+    // The saturated sites only ever grow up from the bottom. The top moves
+    // up one site a step at most, so look down from the last one updated.
+    EngineStats::Clock::time_point bandStart = EngineStats::now();
+    while (bandLow < last && 1 - CDF[bandLow + 1] <= bandTolerance)
+    {
+      bandLow += 1;
+    }
+    bandHigh = last;
+    while (bandHigh > bandLow && CDF[bandHigh] <= bandTolerance)
+    {
+      bandHigh -= 1;
+    }
+    stats.addTime(stats::EdgeTime, bandStart);
+  }
+  t += 1;
+  stats.addTime(stats::StepTime, stepStart);
+  stats.step(t, numSites);
+}
+
+
+/*
+k steps in one pass over the CDF. Step s (time t + s to t + s + 1) only reads
+sites n - 1 and n of step s - 1, so in skewed coordinates m = n + s the sites
+are cut into tiles of wavefrontTileSites and each tile runs all k steps, step
+s on sites [m0 - s, m0 + wavefrontTileSites - 1 - s], before the next one
+starts. A tile then stays in cache for its k sweeps and the whole CDF only
+goes through memory once per k steps instead of once per step. Each step still
+sweeps its sites in order, and all a tile needs from the tile before is the
+old value of the site just left of it for every step, kept in wavefrontPrev.
+
+The biases come from the counter RNG at (seed, t + s, n) so the order the
+sites are visited in doesn't matter and it's bit for bit the same as k calls
+to iterateTimeStep. The sequential gen has to hand the biases out step by
+step, and the active band and the threaded step work on whole steps, so with
+any of those it falls back to k single steps.
+*/
+template <class RealType>
+void DiffusionTimeCDF<RealType>::iterateTimeSteps(const unsigned long int k)
+{
+  if (t + k > tMax)
+  {
+    throw std::runtime_error("Cannot evolve to time greater than tMax: " +
+                             std::to_string(tMax));
+  }
+  if (k <= 1 || !counterRNG || activeBand || pool)
+  {
+    for (unsigned long int s = 0; s < k; s++)
+    {
+      iterateTimeStep();
+    }
+    return;
+  }
+
+  EngineStats::Clock::time_point stepStart = EngineStats::now();
+  // CDF[0] is 1 after the first step, whatever it was before it
+  wavefrontPrev.assign(k, RealType(1));
+  wavefrontPrev[0] = CDF[0];
+  CDF[0] = 1;
+
+  // Last step ends at n = t + k, m = t + 2k - 1
+  const unsigned long int lastM = t + 2 * k - 1;
+  for (unsigned long int m0 = 1; m0 <= lastM; m0 += wavefrontTileSites)
+  {
+    for (unsigned long int s = 0; s < k; s++)
+    {
+      if (m0 + wavefrontTileSites - 1 < s + 1)
+      {
+        // This step starts in a later tile (so do the ones after it)
+        break;
+      }
+      unsigned long int first = (m0 > s) ? m0 - s : 1;
+      unsigned long int last = std::min(m0 + wavefrontTileSites - 1 - s, t + s + 1);
+      if (first > last)
+      {
+        continue;
+      }
+      wavefrontPrev[s] = updateRange(first, last, wavefrontPrev[s], biases, betaSampler, &counterGen, stats, t + s);
+    }
+  }
+
+  stats.addTime(stats::StepTime, stepStart);
+  for (unsigned long int s = 0; s < k; s++)
+  {
+    stats.step(t + s + 1, t + s + 1);
+  }
+  t += k;
+}
+
+template <class RealType>
+double DiffusionTimeCDF<RealType>::getBias(const unsigned long int _t, const unsigned long int n)
+{
+  double bias;
+  betaSampler.fillSites(counterGen, _t, n - 1, &bias, 1);
+  return bias;
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::evolveToTime(const unsigned long int _t)
+{
+  if (_t > tMax)
+  {
+    throw std::runtime_error("Cannot evolve to time greater than tMax: " +
+                             std::to_string(tMax));
+  }
+  while (t < _t)
+  {
+    iterateTimeSteps(std::min(wavefrontSteps, _t - t));
+  }
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::evolveTimesteps(const unsigned long int num)
+{
+  evolveToTime(t + num);
+}
+
+template <class RealType>
+unsigned long int DiffusionTimeCDF<RealType>::findQuantile(RealType quantile)
+{
+  unsigned long int quantilePosition;
+  for (unsigned long int n = t; n >= 0; n--)
+  {
+    if (CDF[n] > 1 / quantile)
+    {
+      quantilePosition = 2 * n + 2 - t;
+      break;
+    }
+  }
+  return quantilePosition;
+}
+
+template <class RealType>
+std::vector<unsigned long int> DiffusionTimeCDF<RealType>::findQuantiles(
+    std::vector<RealType> quantiles)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::QuantileCalls, 1);
+  // Sort incoming quantiles b/c we need them to be in descending order for
+  // algorithm to work
+  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+
+  // Initialize to have same number of vectors as in Ns
+  std::vector<unsigned long int> quantilePositions(quantiles.size());
+  unsigned long int quantile_idx = 0;
+  for (unsigned long int n = t; n >= 0; n--)
+  {
+    while (CDF[n] > 1 / quantiles[quantile_idx])
+    {
+      quantilePositions[quantile_idx] = 2 * n + 2 - t;
+      quantile_idx += 1;
+
+      // Break while loop if past last position
+      if (quantile_idx == quantiles.size())
+      {
+        break;
+      }
+    }
+    // Also need to break for loop if in last position b/c we are done searching
+    if (quantile_idx == quantiles.size())
+    {
+      break;
+    }
+  }
+  stats.addTime(stats::QuantileTime, start);
+  return quantilePositions;
+}
+
+template <class RealType>
+std::vector<long int> DiffusionTimeCDF<RealType>::getxvals()
+{
+  std::vector<long int> xvals(t + 1);
+  for (unsigned int n = 0; n < xvals.size(); n++)
+  {
+    xvals[n] = 2 * n - t;
+  }
+  return xvals;
+}
+
+template <class RealType>
+RealType DiffusionTimeCDF<RealType>::getGumbelVariance(RealType nParticles)
+{
+  return getGumbelVariance(std::vector<RealType>(1, nParticles))[0];
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDF<RealType>::getGumbelVariance(std::vector<RealType> nParticles)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::GumbelCalls, 1);
+  // CDF[0, ..., t] at x = 2n - t and 0 past it to make it complete
+  auto compCDF = [&](unsigned long int n) { return (n <= t) ? CDF[n] : RealType(0); };
+  std::vector<RealType> vars = gumbelVarianceFused(compCDF, t + 1, -(long int)t, nParticles);
+  stats.addTime(stats::GumbelTime, start);
+  return vars;
+}
+
+template <class RealType>
+Measurement<RealType, unsigned long int> DiffusionTimeCDF<RealType>::measure(const MeasurementPlan<RealType> &plan)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::QuantileCalls, !plan.quantiles.empty());
+  stats.add(stats::GumbelCalls, !plan.nParticles.empty());
+  Measurement<RealType, unsigned long int> result;
+  result.quantiles.resize(plan.quantiles.size());
+  result.pb.assign(plan.velocities.size(), RealType(0));
+
+  // Quantiles from the largest (first reached) down
+  std::vector<unsigned long int> quantileOrder(plan.quantiles.size());
+  for (unsigned long int i = 0; i < quantileOrder.size(); i++)
+  {
+    quantileOrder[i] = i;
+  }
+  std::sort(quantileOrder.begin(), quantileOrder.end(), [&](unsigned long int a, unsigned long int b) {
+    return plan.quantiles[a] > plan.quantiles[b];
+  });
+  std::vector<RealType> quantileTails(quantileOrder.size());
+  for (unsigned long int i = 0; i < quantileOrder.size(); i++)
+  {
+    quantileTails[i] = 1 / plan.quantiles[quantileOrder[i]];
+  }
+
+  // Same x = 2n - t convention as getPbAtV, past t is left at 0
+  std::vector<std::pair<unsigned long int, unsigned long int>> pbSites;
+  for (unsigned long int i = 0; i < plan.velocities.size(); i++)
+  {
+    double n = ceil((1 + plan.velocities[i]) * t / 2.);
+    if (n <= t)
+    {
+      pbSites.push_back(std::make_pair((n < 0) ? 0 : (unsigned long int)n, i));
+    }
+  }
+  std::sort(pbSites.begin(), pbSites.end(), std::greater<std::pair<unsigned long int, unsigned long int>>());
+
+  DescendingGumbelVariance<RealType> gumbel(plan.nParticles, (long int)t);
+  unsigned long int nextQuantile = 0;
+  unsigned long int nextPb = 0;
+  for (unsigned long int n = t + 1; n-- > 0;)
+  {
+    if (nextQuantile == quantileOrder.size() && nextPb == pbSites.size() && gumbel.done())
+    {
+      break;
+    }
+    while (nextQuantile < quantileOrder.size() && CDF[n] > quantileTails[nextQuantile])
+    {
+      result.quantiles[quantileOrder[nextQuantile]] = 2 * n + 2 - t;
+      nextQuantile += 1;
+    }
+    while (nextPb < pbSites.size() && pbSites[nextPb].first == n)
+    {
+      result.pb[pbSites[nextPb].second] = CDF[n];
+      nextPb += 1;
+    }
+    if (!gumbel.done())
+    {
+      gumbel.add(2 * (long int)n - (long int)t, CDF[n]);
+    }
+  }
+  if (nextQuantile < quantileOrder.size())
+  {
+    throw std::runtime_error("Quantile is past the edge of the CDF");
+  }
+  result.gumbelVariance = gumbel.variances();
+  // The whole pass counts as query time
+  stats.addTime(stats::QuantileTime, start);
+  return result;
+}
+
+template <class RealType>
+std::pair<RealType, float> DiffusionTimeCDF<RealType>::getProbandV(RealType quantile)
+{
+  unsigned long int quantilePosition;
+  RealType prob;
+  for (unsigned long int n = t; n >= 0; n--)
+  {
+    if (CDF[n] > 1 / quantile)
+    {
+      quantilePosition = 2 * n - t;
+      prob = CDF[n];
+      break;
+    }
+  }
+  float v = (float)quantilePosition / (float)t;
+  return std::make_pair(prob, v);
+}
+
+template <class RealType>
+RealType DiffusionTimeCDF<RealType>::getPbAtV(const double v)
+{
+  // Same x = 2n - t convention as getProbandV
+  double n = ceil((1 + v) * t / 2.);
+  if (n > t) {
+    return 0;
+  }
+  return CDF[(n < 0) ? 0 : (unsigned long int)n];
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDF<RealType>::getSaveCDF()
+{
+  return slice(CDF, 0, t);
+}
+
+template <class RealType>
+template <class Sink>
+void DiffusionTimeCDF<RealType>::writeCheckpoint(Sink &writer)
+{
+  checkpoint::Header header = checkpoint::makeHeader<RealType>(checkpoint::TimeCDF);
+  header.time = t;
+  header.beta = beta;
+  header.size = tMax;
+  header.bufferLength = CDF.size();
+  header.seed = counterGen.getSeed();
+  header.counterRNG = counterRNG;
+
+  std::ostringstream rngState;
+  rngState << gen;
+  std::string state = rngState.str();
+
+  writer.write(&header, sizeof(header));
+  header.rngStateBytes = state.size();
+  header.rngStateOffset = writer.write(state.data(), state.size());
+
+  // Everything past t is still 0
+  writer.align(checkpoint::dataAlignment);
+  header.dataFirst = 0;
+  header.dataLength = t + 1;
+  header.dataOffset = writer.write(CDF.data(), header.dataLength * sizeof(RealType));
+  writer.finish(header);
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::saveCheckpoint(const std::string &fileName)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  // Don't race a background write to the same file
+  asyncCheckpoint.wait();
+  checkpoint::Writer writer(fileName);
+  writeCheckpoint(writer);
+  stats.addTime(stats::CheckpointTime, start);
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::saveCheckpointAsync(const std::string &fileName)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  checkpoint::Buffer &buffer = asyncCheckpoint.stage();
+  writeCheckpoint(buffer);
+  asyncCheckpoint.start(fileName);
+  stats.addTime(stats::CheckpointTime, start);
+}
+
+template <class RealType>
+void DiffusionTimeCDF<RealType>::loadCheckpoint(const std::string &fileName)
+{
+  asyncCheckpoint.wait();
+  CDFViews.check("loadCheckpoint");
+  checkpoint::MappedFile map(fileName);
+  const checkpoint::Header &header = map.header();
+  checkpoint::checkHeader<RealType>(header, checkpoint::TimeCDF, fileName);
+  if (header.dataFirst + header.dataLength > header.bufferLength)
+  {
+    throw std::runtime_error("Checkpoint data doesn't fit in its buffer: " + fileName);
+  }
+  // Check everything is in the file before changing anything
+  const char *state = map.at<char>(header.rngStateOffset, header.rngStateBytes);
+  const RealType *data = map.at<RealType>(header.dataOffset, header.dataLength);
+
+  this->setBeta(header.beta);
+  tMax = header.size;
+  t = header.time;
+  counterGen.setSeed(header.seed);
+  counterRNG = header.counterRNG;
+
+  std::istringstream rngState(std::string(state, header.rngStateBytes));
+  rngState >> gen;
+
+  CDF.assign(header.bufferLength, RealType(0));
+  checkpoint::copyTo(data, header.dataLength, CDF.data() + header.dataFirst);
+  bandValid = false;
+}
+
 #endif /* DIFFUSIONCDF_HPP_ */
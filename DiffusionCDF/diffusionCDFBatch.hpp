@@ -0,0 +1,292 @@
+#ifndef DIFFUSIONCDFBATCH_HPP_
+#define DIFFUSIONCDFBATCH_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../Random/betaSampler.h"
+#include "../Stats/stat.h"
+
+/*
+numLanes independent DiffusionTimeCDF realizations advanced in lockstep. The
+CDFs are stored interleaved per site, CDF[n * numLanes + lane], so the update
+at a site is the same recurrence over a contiguous run of lanes:
+
+  CDF[n, lane] = b[n, lane] * CDF_prev[lane] + (1 - b[n, lane]) * CDF[n, lane]
+
+That inner loop has no dependencies between lanes and is written so the
+compiler vectorizes it for whatever the target has (compile.sh builds with
+-march=native), one sweep over n advances every lane.
+
+The biases always come from the counter RNG. Lane k uses seed + k so it is
+the same realization as a DiffusionTimeCDF with setBetaSeed(seed + k) and
+setCounterRNG(true), and the same numbering DiffusionEnsemble uses. It is bit
+for bit the same unless the compiler contracts the two loops into FMAs
+differently (-march=native allows it), then they agree to rounding.
+*/
+template <class RealType>
+class DiffusionTimeCDFBatch
+{
+private:
+  std::vector<RealType> CDF;
+  double beta;
+  unsigned long int tMax;
+  unsigned long int numLanes;
+  unsigned long int t = 0;
+  unsigned int seed;
+
+  std::vector<CounterRNG> laneGens;
+  BetaSampler betaSampler;
+
+  // Biases for a block of sites, also interleaved by lane
+  std::vector<RealType> biases;
+  std::vector<RealType> CDF_prev;
+
+  void fillBiases(const unsigned long int blockStart, const unsigned long int num);
+  RealType &at(const unsigned long int n, const unsigned long int lane)
+  {
+    return CDF[n * numLanes + lane];
+  };
+  void checkLane(const unsigned long int lane);
+
+public:
+  DiffusionTimeCDFBatch(const double _beta, const unsigned long int _tMax, const unsigned long int _numLanes);
+
+  double getBeta() { return beta; };
+  unsigned long int gettMax() { return tMax; };
+  unsigned long int getNumLanes() { return numLanes; };
+  unsigned long int getTime() { return t; };
+
+  // Lane k is seeded with seed + k
+  void setBetaSeed(const unsigned int _seed);
+  unsigned int getBetaSeed() { return seed; };
+
+  void iterateTimeStep();
+  void evolveToTime(const unsigned long int _t);
+  void evolveTimesteps(const unsigned long int num);
+
+  std::vector<RealType> getCDF(const unsigned long int lane);
+  std::vector<RealType> getSaveCDF(const unsigned long int lane);
+
+  // One entry per lane
+  std::vector<std::vector<unsigned long int>> findQuantiles(std::vector<RealType> quantiles);
+  std::vector<std::vector<RealType>> getGumbelVariance(std::vector<RealType> nParticles);
+  std::vector<RealType> getPbAtV(const double v);
+};
+
+template <class RealType>
+DiffusionTimeCDFBatch<RealType>::DiffusionTimeCDFBatch(const double _beta,
+                                                       const unsigned long int _tMax,
+                                                       const unsigned long int _numLanes)
+    : beta(_beta), tMax(_tMax), numLanes(_numLanes), betaSampler(_beta)
+{
+  if (numLanes == 0)
+  {
+    throw std::runtime_error("Number of lanes must be at least 1");
+  }
+  CDF.resize((tMax + 1) * numLanes);
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    at(0, lane) = 1;
+  }
+  laneGens.resize(numLanes);
+  biases.resize(biasBlockSize * numLanes);
+  CDF_prev.resize(numLanes);
+
+  std::random_device rd;
+  setBetaSeed(rd());
+}
+
+template <class RealType>
+void DiffusionTimeCDFBatch<RealType>::setBetaSeed(const unsigned int _seed)
+{
+  seed = _seed;
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    laneGens[lane].setSeed((unsigned int)(seed + lane));
+  }
+}
+
+template <class RealType>
+void DiffusionTimeCDFBatch<RealType>::checkLane(const unsigned long int lane)
+{
+  if (lane >= numLanes)
+  {
+    throw std::runtime_error("Lane out of range: " + std::to_string(lane) +
+                             " (number of lanes " + std::to_string(numLanes) + ")");
+  }
+}
+
+// Biases for CDF[n] for n in [blockStart, blockStart + num), keyed on (t, n-1)
+// the same way as DiffusionTimeCDF
+template <class RealType>
+void DiffusionTimeCDFBatch<RealType>::fillBiases(const unsigned long int blockStart,
+                                                 const unsigned long int num)
+{
+  for (unsigned long int i = 0; i < num; i++)
+  {
+    for (unsigned long int lane = 0; lane < numLanes; lane++)
+    {
+      laneGens[lane].setPosition(t, blockStart + i - 1);
+      biases[i * numLanes + lane] = RealType(betaSampler(laneGens[lane]));
+    }
+  }
+}
+
+template <class RealType>
+void DiffusionTimeCDFBatch<RealType>::iterateTimeStep()
+{
+  // The CDF only has sites up to tMax, the step writes site t + 1
+  if (t + 1 > tMax)
+  {
+    throw std::runtime_error("Cannot evolve to time greater than tMax: " + std::to_string(tMax));
+  }
+  const unsigned long int K = numLanes;
+  RealType *cdf = CDF.data();
+  RealType *prev = CDF_prev.data();
+  const RealType *b = biases.data();
+
+  for (unsigned long int k = 0; k < K; k++)
+  {
+    prev[k] = cdf[k];
+    cdf[k] = 1; // Need CDF(n=0, t) = 1
+  }
+
+  for (unsigned long int blockStart = 1; blockStart <= t + 1; blockStart += biasBlockSize)
+  {
+    unsigned long int blockEnd = std::min<unsigned long int>(blockStart + biasBlockSize, t + 2);
+    fillBiases(blockStart, blockEnd - blockStart);
+
+    // Leave the new top site to be done on its own below
+    unsigned long int sweepEnd = std::min<unsigned long int>(blockEnd, t + 1);
+    for (unsigned long int n = blockStart; n < sweepEnd; n++)
+    {
+      RealType *site = cdf + n * K;
+      const RealType *siteBias = b + (n - blockStart) * K;
+      for (unsigned long int k = 0; k < K; k++)
+      {
+        RealType current = site[k];
+        site[k] = siteBias[k] * prev[k] + (1 - siteBias[k]) * current;
+        prev[k] = current;
+      }
+    }
+
+    if (blockEnd == t + 2)
+    {
+      RealType *site = cdf + (t + 1) * K;
+      const RealType *siteBias = b + (t + 1 - blockStart) * K;
+      for (unsigned long int k = 0; k < K; k++)
+      {
+        site[k] = siteBias[k] * prev[k];
+      }
+    }
+  }
+  t += 1;
+}
+
+template <class RealType>
+void DiffusionTimeCDFBatch<RealType>::evolveToTime(const unsigned long int _t)
+{
+  if (_t > tMax)
+  {
+    throw std::runtime_error("Cannot evolve to time greater than tMax: " +
+                             std::to_string(tMax));
+  }
+  while (t < _t)
+  {
+    iterateTimeStep();
+  }
+}
+
+template <class RealType>
+void DiffusionTimeCDFBatch<RealType>::evolveTimesteps(const unsigned long int num)
+{
+  evolveToTime(t + num);
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDFBatch<RealType>::getCDF(const unsigned long int lane)
+{
+  checkLane(lane);
+  std::vector<RealType> laneCDF(tMax + 1);
+  for (unsigned long int n = 0; n <= tMax; n++)
+  {
+    laneCDF[n] = at(n, lane);
+  }
+  return laneCDF;
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDFBatch<RealType>::getSaveCDF(const unsigned long int lane)
+{
+  checkLane(lane);
+  std::vector<RealType> laneCDF(t + 1);
+  for (unsigned long int n = 0; n <= t; n++)
+  {
+    laneCDF[n] = at(n, lane);
+  }
+  return laneCDF;
+}
+
+template <class RealType>
+std::vector<std::vector<unsigned long int>> DiffusionTimeCDFBatch<RealType>::findQuantiles(
+    std::vector<RealType> quantiles)
+{
+  // Same search as DiffusionTimeCDF::findQuantiles, descending quantiles
+  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+
+  std::vector<std::vector<unsigned long int>> quantilePositions(
+      numLanes, std::vector<unsigned long int>(quantiles.size()));
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    unsigned long int quantile_idx = 0;
+    for (unsigned long int n = t + 1; n-- > 0 && quantile_idx < quantiles.size();)
+    {
+      while (quantile_idx < quantiles.size() && at(n, lane) > 1 / quantiles[quantile_idx])
+      {
+        quantilePositions[lane][quantile_idx] = 2 * n + 2 - t;
+        quantile_idx += 1;
+      }
+    }
+  }
+  return quantilePositions;
+}
+
+template <class RealType>
+std::vector<std::vector<RealType>> DiffusionTimeCDFBatch<RealType>::getGumbelVariance(
+    std::vector<RealType> nParticles)
+{
+  std::vector<std::vector<RealType>> vars(numLanes);
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    // Read the lane in place, 0 past t like DiffusionTimeCDF
+    auto compCDF = [&](unsigned long int n) { return (n <= t) ? at(n, lane) : RealType(0); };
+    vars[lane] = gumbelVarianceFused(compCDF, t + 1, -(long int)t, nParticles);
+  }
+  return vars;
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDFBatch<RealType>::getPbAtV(const double v)
+{
+  // Same x = 2n - t convention as DiffusionTimeCDF::getPbAtV
+  double n = ceil((1 + v) * t / 2.);
+  std::vector<RealType> probs(numLanes, RealType(0));
+  if (n > t)
+  {
+    return probs;
+  }
+  unsigned long int idx = (n < 0) ? 0 : (unsigned long int)n;
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    probs[lane] = at(idx, lane);
+  }
+  return probs;
+}
+
+#endif /* DIFFUSIONCDFBATCH_HPP_ */
@@ -0,0 +1,2 @@
+#!/bin/bash
+c++ -O3 -march=native -Wall -shared -std=gnu++11 -fPIC -pthread $(python3-config --includes) diffusionEnsemble.cpp -I/c/modular-boost -lquadmath -o diffusionEnsemble.so -I"../../pybind11/include"
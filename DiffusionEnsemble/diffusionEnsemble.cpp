@@ -0,0 +1,74 @@
+#include <math.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <boost/multiprecision/float128.hpp>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <math.h>
+
+#include "../IO/numpyScalars.h"
+#include "diffusionEnsemble.hpp"
+
+namespace py = pybind11;
+
+using RealType = boost::multiprecision::float128;
+
+template <template <class> class Engine, class RealType, class... Args>
+void declareEnsemble(py::module &m, const std::string &name)
+{
+  typedef DiffusionEnsemble<Engine, RealType> Class;
+
+  py::class_<Class>(m, name.c_str())
+      .def(py::init<const unsigned long int, Args...>())
+      .def("getNumSystems", &Class::getNumSystems)
+      .def("setSystemRange", &Class::setSystemRange, py::arg("first"), py::arg("count"))
+      .def("getRangeFirst", &Class::getRangeFirst)
+      .def("getRangeCount", &Class::getRangeCount)
+      .def("setSeed", &Class::setSeed, py::arg("seed"))
+      .def("getSeed", &Class::getSeed)
+      .def("setCounterRNG", &Class::setCounterRNG, py::arg("counterRNG"))
+      .def("getCounterRNG", &Class::getCounterRNG)
+      .def("setNumThreads", &Class::setNumThreads, py::arg("numThreads"))
+      .def("getNumThreads", &Class::getNumThreads)
+      .def("setSaveTimes", &Class::setSaveTimes, py::arg("saveTimes"))
+      .def("getSaveTimes", &Class::getSaveTimes)
+      .def("setQuantiles", &Class::setQuantiles, py::arg("quantiles"))
+      .def("getQuantiles", &Class::getQuantiles)
+      .def("setGumbelNParticles", &Class::setGumbelNParticles, py::arg("nParticles"))
+      .def("getGumbelNParticles", &Class::getGumbelNParticles)
+      .def("setVelocities", &Class::setVelocities, py::arg("velocities"))
+      .def("getVelocities", &Class::getVelocities)
+      .def("run", &Class::run, py::call_guard<py::gil_scoped_release>())
+      .def("getQuantileMean", &Class::getQuantileMean)
+      .def("getQuantileVariance", &Class::getQuantileVariance)
+      .def("getGumbelVarianceMean", &Class::getGumbelVarianceMean)
+      .def("getGumbelVarianceVariance", &Class::getGumbelVarianceVariance)
+      .def("getPbMean", &Class::getPbMean)
+      .def("getPbVariance", &Class::getPbVariance);
+}
+
+template <class RealType>
+void declareEnsembles(py::module &m, const std::string &suffix)
+{
+  // Constructor arguments after numSystems are the engine's
+  declareEnsemble<DiffusionTimeCDF, RealType, const double, const unsigned long int>(
+      m, "DiffusionTimeCDFEnsemble" + suffix);
+  declareEnsemble<DiffusionPDF, RealType, const RealType, const double, const unsigned long int, const bool>(
+      m, "DiffusionPDFEnsemble" + suffix);
+}
+
+PYBIND11_MODULE(diffusionEnsemble, m)
+{
+  m.doc() = "Ensembles of independent diffusion realizations";
+
+  declareEnsembles<double>(m, "_f64");
+  declareEnsembles<long double>(m, "_f80");
+  declareEnsembles<RealType>(m, "_f128");
+
+  m.attr("DiffusionTimeCDFEnsemble") = m.attr("DiffusionTimeCDFEnsemble_f128");
+  m.attr("DiffusionPDFEnsemble") = m.attr("DiffusionPDFEnsemble_f128");
+}
@@ -0,0 +1,270 @@
+#ifndef DIFFUSIONENSEMBLE_HPP_
+#define DIFFUSIONENSEMBLE_HPP_
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../DiffusionCDF/diffusionCDF.hpp"
+#include "../DiffusionPDF/diffusionPDF.hpp"
+#include "../Parallel/threadPool.h"
+#include "../Stats/runningStats.h"
+
+// Realizations handed to a thread at a time. Each group gets its own
+// accumulators which are merged in order at the end, so the result doesn't
+// depend on the number of threads or how the groups were scheduled.
+constexpr unsigned long int systemsPerTask = 16;
+
+/*
+Runs numSystems independent realizations of Engine<RealType> (DiffusionTimeCDF
+or DiffusionPDF) at the same parameters and reduces the observables at every
+save time into running means and variances, instead of writing every
+realization out.
+
+Realization i is seeded with seed + i so the whole ensemble is reproducible.
+Realizations are built when a thread picks them up and dropped once they reach
+the last save time, so memory only grows with the number of threads and not
+with numSystems.
+
+The results are indexed as [save time][observable]: quantiles are in
+descending order (the order findQuantiles uses), Gumbel variances are in the
+order of gumbelNParticles and Pb in the order of velocities.
+*/
+template <template <class> class Engine, class RealType>
+class DiffusionEnsemble
+{
+private:
+  typedef Engine<RealType> System;
+  typedef RunningStats<RealType> Stats;
+
+  unsigned long int numSystems;
+  // Realizations this run() does, all of them unless split with
+  // setSystemRange
+  unsigned long int rangeFirst = 0;
+  unsigned long int rangeCount;
+  std::function<std::unique_ptr<System>()> makeSystem;
+
+  unsigned int seed;
+  bool counterRNG = false;
+  unsigned int numThreads = 1;
+
+  std::vector<unsigned long int> saveTimes;
+  std::vector<RealType> quantiles;
+  std::vector<RealType> gumbelNParticles;
+  std::vector<double> velocities;
+
+  // Flattened as [save time * number of observables + observable]
+  std::vector<Stats> quantileStats;
+  std::vector<Stats> gumbelStats;
+  std::vector<Stats> pbStats;
+
+  void runSystem(const unsigned long int i,
+                 std::vector<Stats> &_quantileStats,
+                 std::vector<Stats> &_gumbelStats,
+                 std::vector<Stats> &_pbStats);
+
+  std::vector<std::vector<RealType>> reshape(const std::vector<Stats> &stats,
+                                             const unsigned long int numCols,
+                                             const bool variance);
+
+public:
+  // args are passed on to the Engine constructor for each realization
+  template <class... Args>
+  DiffusionEnsemble(const unsigned long int _numSystems, Args... args)
+      : numSystems(_numSystems), rangeCount(_numSystems)
+  {
+    makeSystem = [=]() { return std::unique_ptr<System>(new System(args...)); };
+    std::random_device rd;
+    seed = rd();
+  };
+
+  unsigned long int getNumSystems() { return numSystems; };
+
+  // Only run realizations [first, first + count), still seeded seed + i, so
+  // an ensemble can be split over processes and the pieces merged (see
+  // Parallel/mpiEnsemble.h)
+  void setSystemRange(const unsigned long int first, const unsigned long int count)
+  {
+    if (first + count > numSystems)
+    {
+      throw std::runtime_error("Realizations " + std::to_string(first) + " to " +
+                               std::to_string(first + count) + " are past the " +
+                               std::to_string(numSystems) + " in the ensemble");
+    }
+    rangeFirst = first;
+    rangeCount = count;
+  };
+  unsigned long int getRangeFirst() { return rangeFirst; };
+  unsigned long int getRangeCount() { return rangeCount; };
+
+  void setSeed(const unsigned int _seed) { seed = _seed; };
+  unsigned int getSeed() { return seed; };
+
+  void setCounterRNG(const bool _counterRNG) { counterRNG = _counterRNG; };
+  bool getCounterRNG() { return counterRNG; };
+
+  void setNumThreads(const unsigned int _numThreads)
+  {
+    if (_numThreads == 0)
+    {
+      throw std::runtime_error("Number of threads must be at least 1");
+    }
+    numThreads = _numThreads;
+  };
+  unsigned int getNumThreads() { return numThreads; };
+
+  void setSaveTimes(std::vector<unsigned long int> _saveTimes)
+  {
+    std::sort(_saveTimes.begin(), _saveTimes.end());
+    _saveTimes.erase(std::unique(_saveTimes.begin(), _saveTimes.end()), _saveTimes.end());
+    saveTimes = _saveTimes;
+  };
+  std::vector<unsigned long int> getSaveTimes() { return saveTimes; };
+
+  void setQuantiles(std::vector<RealType> _quantiles)
+  {
+    std::sort(_quantiles.begin(), _quantiles.end(), std::greater<RealType>());
+    quantiles = _quantiles;
+  };
+  std::vector<RealType> getQuantiles() { return quantiles; };
+
+  void setGumbelNParticles(const std::vector<RealType> _gumbelNParticles)
+  {
+    gumbelNParticles = _gumbelNParticles;
+  };
+  std::vector<RealType> getGumbelNParticles() { return gumbelNParticles; };
+
+  void setVelocities(const std::vector<double> _velocities) { velocities = _velocities; };
+  std::vector<double> getVelocities() { return velocities; };
+
+  // Evolve every realization through all of the save times
+  void run();
+
+  std::vector<std::vector<RealType>> getQuantileMean() { return reshape(quantileStats, quantiles.size(), false); };
+  std::vector<std::vector<RealType>> getQuantileVariance() { return reshape(quantileStats, quantiles.size(), true); };
+
+  std::vector<std::vector<RealType>> getGumbelVarianceMean() { return reshape(gumbelStats, gumbelNParticles.size(), false); };
+  std::vector<std::vector<RealType>> getGumbelVarianceVariance() { return reshape(gumbelStats, gumbelNParticles.size(), true); };
+
+  std::vector<std::vector<RealType>> getPbMean() { return reshape(pbStats, velocities.size(), false); };
+  std::vector<std::vector<RealType>> getPbVariance() { return reshape(pbStats, velocities.size(), true); };
+
+  // The accumulators themselves after run(), flattened as [save time *
+  // number of observables + observable], for merging ensembles
+  std::vector<Stats> &viewQuantileStats() { return quantileStats; };
+  std::vector<Stats> &viewGumbelStats() { return gumbelStats; };
+  std::vector<Stats> &viewPbStats() { return pbStats; };
+};
+
+template <template <class> class Engine, class RealType>
+void DiffusionEnsemble<Engine, RealType>::runSystem(const unsigned long int i,
+                                                    std::vector<Stats> &_quantileStats,
+                                                    std::vector<Stats> &_gumbelStats,
+                                                    std::vector<Stats> &_pbStats)
+{
+  std::unique_ptr<System> system = makeSystem();
+  system->setBetaSeed(seed + i);
+  system->setCounterRNG(counterRNG);
+
+  for (unsigned long int k = 0; k < saveTimes.size(); k++)
+  {
+    system->evolveToTime(saveTimes[k]);
+
+    if (!quantiles.empty())
+    {
+      auto positions = system->findQuantiles(quantiles);
+      for (unsigned long int j = 0; j < quantiles.size(); j++)
+      {
+        _quantileStats[k * quantiles.size() + j].push(RealType(positions[j]));
+      }
+    }
+
+    if (!gumbelNParticles.empty())
+    {
+      std::vector<RealType> vars = system->getGumbelVariance(gumbelNParticles);
+      for (unsigned long int j = 0; j < gumbelNParticles.size(); j++)
+      {
+        _gumbelStats[k * gumbelNParticles.size() + j].push(vars[j]);
+      }
+    }
+
+    for (unsigned long int j = 0; j < velocities.size(); j++)
+    {
+      _pbStats[k * velocities.size() + j].push(system->getPbAtV(velocities[j]));
+    }
+  }
+}
+
+template <template <class> class Engine, class RealType>
+void DiffusionEnsemble<Engine, RealType>::run()
+{
+  if (saveTimes.empty())
+  {
+    throw std::runtime_error("No save times to evolve the ensemble to");
+  }
+
+  unsigned long int numTasks = (rangeCount + systemsPerTask - 1) / systemsPerTask;
+  std::vector<std::vector<Stats>> taskQuantileStats(numTasks);
+  std::vector<std::vector<Stats>> taskGumbelStats(numTasks);
+  std::vector<std::vector<Stats>> taskPbStats(numTasks);
+
+  ThreadPool pool(numThreads);
+  pool.parallelFor(numTasks, [&](std::size_t task) {
+    taskQuantileStats[task].resize(saveTimes.size() * quantiles.size());
+    taskGumbelStats[task].resize(saveTimes.size() * gumbelNParticles.size());
+    taskPbStats[task].resize(saveTimes.size() * velocities.size());
+
+    unsigned long int last = rangeFirst + std::min<unsigned long int>((task + 1) * systemsPerTask, rangeCount);
+    for (unsigned long int i = rangeFirst + task * systemsPerTask; i < last; i++)
+    {
+      runSystem(i, taskQuantileStats[task], taskGumbelStats[task], taskPbStats[task]);
+    }
+  });
+
+  quantileStats.assign(saveTimes.size() * quantiles.size(), Stats());
+  gumbelStats.assign(saveTimes.size() * gumbelNParticles.size(), Stats());
+  pbStats.assign(saveTimes.size() * velocities.size(), Stats());
+  for (unsigned long int task = 0; task < numTasks; task++)
+  {
+    for (unsigned long int j = 0; j < quantileStats.size(); j++)
+    {
+      quantileStats[j].merge(taskQuantileStats[task][j]);
+    }
+    for (unsigned long int j = 0; j < gumbelStats.size(); j++)
+    {
+      gumbelStats[j].merge(taskGumbelStats[task][j]);
+    }
+    for (unsigned long int j = 0; j < pbStats.size(); j++)
+    {
+      pbStats[j].merge(taskPbStats[task][j]);
+    }
+  }
+}
+
+template <template <class> class Engine, class RealType>
+std::vector<std::vector<RealType>> DiffusionEnsemble<Engine, RealType>::reshape(
+    const std::vector<Stats> &stats,
+    const unsigned long int numCols,
+    const bool variance)
+{
+  if (stats.size() != saveTimes.size() * numCols)
+  {
+    throw std::runtime_error("Ensemble results are out of date, call run() first");
+  }
+  std::vector<std::vector<RealType>> values(saveTimes.size(), std::vector<RealType>(numCols));
+  for (unsigned long int k = 0; k < saveTimes.size(); k++)
+  {
+    for (unsigned long int j = 0; j < numCols; j++)
+    {
+      const Stats &s = stats[k * numCols + j];
+      values[k][j] = variance ? s.getVariance() : s.getMean();
+    }
+  }
+  return values;
+}
+
+#endif /* DIFFUSIONENSEMBLE_HPP_ */
@@ -0,0 +1,11 @@
+#!/bin/bash
+# The kernels go through nvcc (or hipcc with HIP=1 for AMD cards), the
+# bindings through the host compiler
+if [ -n "$HIP" ]; then
+  hipcc -O3 -std=c++11 -fPIC -x hip -c diffusionCDFGPU.cu -o diffusionCDFGPU.o
+  GPU_LIBS="-lamdhip64"
+else
+  nvcc -O3 -std=c++11 -arch=${CUDA_ARCH:-sm_80} -Xcompiler -fPIC -c diffusionCDFGPU.cu -o diffusionCDFGPU.o
+  GPU_LIBS="-L${CUDA_HOME:-/usr/local/cuda}/lib64 -lcudart"
+fi
+c++ -O3 -march=native -Wall -shared -std=gnu++11 -fPIC $(python3-config --includes) diffusionGPU.cpp diffusionCDFGPU.o $GPU_LIBS -o diffusionGPU.so -I"../../pybind11/include"
@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../Random/philox.h"
+#include "diffusionCDFGPU.h"
+#include "gpuRuntime.h"
+
+namespace
+{
+  constexpr unsigned int threadsPerBlock = 256;
+  // Every kernel is a grid stride loop, so this only caps the launch
+  constexpr unsigned long int maxBlocks = 65535;
+
+  void checkGPU(const cudaError_t err, const char *what)
+  {
+    if (err != cudaSuccess)
+    {
+      throw std::runtime_error(std::string(what) + " failed: " + cudaGetErrorString(err));
+    }
+  }
+
+  unsigned int numBlocks(const unsigned long int numThreads)
+  {
+    unsigned long int blocks = (numThreads + threadsPerBlock - 1) / threadsPerBlock;
+    return std::max<unsigned long int>(1, std::min(blocks, maxBlocks));
+  }
+
+  // Scratch buffer on the device for the inputs and outputs of a query
+  template <class T>
+  class DeviceBuffer
+  {
+  private:
+    T *data = nullptr;
+    unsigned long int size;
+
+  public:
+    DeviceBuffer(const unsigned long int _size) : size(_size)
+    {
+      if (size > 0)
+      {
+        checkGPU(cudaMalloc(&data, size * sizeof(T)), "cudaMalloc");
+      }
+    };
+    ~DeviceBuffer() { cudaFree(data); };
+
+    DeviceBuffer(const DeviceBuffer &) = delete;
+    DeviceBuffer &operator=(const DeviceBuffer &) = delete;
+
+    T *get() { return data; };
+
+    void upload(const std::vector<T> &values)
+    {
+      checkGPU(cudaMemcpy(data, values.data(), size * sizeof(T), cudaMemcpyHostToDevice), "cudaMemcpy");
+    };
+    std::vector<T> download()
+    {
+      std::vector<T> values(size);
+      checkGPU(cudaMemcpy(values.data(), data, size * sizeof(T), cudaMemcpyDeviceToHost), "cudaMemcpy");
+      return values;
+    };
+  };
+
+  // The classes of BetaSampler and its constants for Marsaglia & Tsang
+  struct BetaParams
+  {
+    enum BetaClass
+    {
+      Zero,
+      Uniform,
+      Half,
+      General
+    };
+    BetaClass betaClass;
+    double beta;
+    double d;
+    double c;
+  };
+
+  BetaParams makeBetaParams(const double beta)
+  {
+    BetaParams params;
+    params.beta = beta;
+    if (beta == 0.0)
+    {
+      params.betaClass = BetaParams::Zero;
+    }
+    else if (beta == 1.0)
+    {
+      params.betaClass = BetaParams::Uniform;
+    }
+    else if (std::isinf(beta))
+    {
+      params.betaClass = BetaParams::Half;
+    }
+    else
+    {
+      params.betaClass = BetaParams::General;
+    }
+    double shape = (beta < 1) ? beta + 1 : beta;
+    params.d = shape - 1. / 3.;
+    params.c = 1 / sqrt(9 * params.d);
+    return params;
+  }
+
+  // What std::uniform_real_distribution<>(0, 1) makes of one 64 bit draw,
+  // which is what BetaSampler uses on the host
+  __device__ double uniform(CounterRNG &gen)
+  {
+    double u = double(gen()) * (1.0 / 18446744073709551616.0);
+    return (u >= 1) ? nextafter(1.0, 0.0) : u;
+  }
+
+  // Gamma(beta + 1) for beta < 1, Gamma(beta) otherwise
+  __device__ double generateGamma(CounterRNG &gen, const BetaParams &params)
+  {
+    while (true)
+    {
+      // Box-Muller, 1 - u is in (0, 1] so the log is finite
+      double r = sqrt(-2 * log(1 - uniform(gen)));
+      double x = r * cospi(2 * uniform(gen));
+      double v = 1 + params.c * x;
+      if (v <= 0)
+      {
+        continue;
+      }
+      v = v * v * v;
+      double u = uniform(gen);
+      double x2 = x * x;
+      if (u < 1 - 0.0331 * x2 * x2)
+      {
+        return params.d * v;
+      }
+      if (log(u) < 0.5 * x2 + params.d * (1 - v + log(v)))
+      {
+        return params.d * v;
+      }
+    }
+  }
+
+  // BetaSampler::operator() on the device
+  __device__ double generateBias(CounterRNG &gen, const BetaParams &params)
+  {
+    switch (params.betaClass)
+    {
+    case BetaParams::Zero:
+      return round(uniform(gen));
+    case BetaParams::Uniform:
+      return uniform(gen);
+    case BetaParams::Half:
+      return 0.5;
+    default:
+      break;
+    }
+    if (params.beta >= 1)
+    {
+      double x = generateGamma(gen, params);
+      double y = generateGamma(gen, params);
+      return x / (x + y);
+    }
+    double g1 = generateGamma(gen, params);
+    double g2 = generateGamma(gen, params);
+    double u1 = 1 - uniform(gen);
+    double u2 = 1 - uniform(gen);
+    return 1 / (1 + (g2 / g1) * exp(log(u2 / u1) / params.beta));
+  }
+
+  // Sites [0, t+1] of every lane from time t to t+1, prev holds time t
+  template <class RealType>
+  __global__ void stepKernel(const RealType *prev,
+                             RealType *next,
+                             const unsigned long int numLanes,
+                             const unsigned long int t,
+                             const unsigned int seed,
+                             const BetaParams params)
+  {
+    const unsigned long int num = (t + 2) * numLanes;
+    const unsigned long int stride = (unsigned long int)blockDim.x * gridDim.x;
+    for (unsigned long int idx = (unsigned long int)blockIdx.x * blockDim.x + threadIdx.x; idx < num; idx += stride)
+    {
+      unsigned long int n = idx / numLanes;
+      unsigned long int lane = idx - n * numLanes;
+      if (n == 0)
+      {
+        next[idx] = 1; // Need CDF(n=0, t) = 1
+        continue;
+      }
+      // Same key and position as DiffusionTimeCDFBatch::fillBiases
+      CounterRNG gen((unsigned int)(seed + lane));
+      gen.setPosition(t, n - 1);
+      RealType b = RealType(generateBias(gen, params));
+      RealType left = prev[idx - numLanes];
+      next[idx] = (n == t + 1) ? b * left : b * left + (1 - b) * prev[idx];
+    }
+  }
+
+  /*
+  One thread per (quantile, lane), neighbouring threads on neighbouring
+  lanes. The CDF doesn't increase with n so the last n with CDF[n] > 1 /
+  quantile, which the host finds by scanning down from t, is found with a
+  binary search.
+  */
+  template <class RealType>
+  __global__ void quantileKernel(const RealType *cdf,
+                                 const unsigned long int numLanes,
+                                 const unsigned long int t,
+                                 const RealType *thresholds,
+                                 const unsigned long int numQuantiles,
+                                 unsigned long int *positions)
+  {
+    const unsigned long int num = numQuantiles * numLanes;
+    const unsigned long int stride = (unsigned long int)blockDim.x * gridDim.x;
+    for (unsigned long int idx = (unsigned long int)blockIdx.x * blockDim.x + threadIdx.x; idx < num; idx += stride)
+    {
+      unsigned long int q = idx / numLanes;
+      unsigned long int lane = idx - q * numLanes;
+      RealType threshold = thresholds[q];
+      // First n in [0, t+1) with CDF[n] <= threshold
+      unsigned long int lo = 0;
+      unsigned long int hi = t + 1;
+      while (lo < hi)
+      {
+        unsigned long int mid = lo + (hi - lo) / 2;
+        if (cdf[mid * numLanes + lane] <= threshold)
+        {
+          hi = mid;
+        }
+        else
+        {
+          lo = mid + 1;
+        }
+      }
+      // Left at 0 if no site is above it, like the host
+      positions[lane * numQuantiles + q] = (lo == 0) ? 0 : 2 * (lo - 1) + 2 - t;
+    }
+  }
+
+  /*
+  gumbelVarianceFused from Stats/stat.h with compCDF(i) = CDF[i] for i <= t
+  and 0 past it, one thread per (N, lane). The pivot is found with the same
+  binary search, then every site is summed in order (the host skips the
+  sites where exp(-N compCDF) is exactly 0 or 1, which add 0).
+  */
+  template <class RealType>
+  __global__ void gumbelKernel(const RealType *cdf,
+                               const unsigned long int numLanes,
+                               const unsigned long int t,
+                               const RealType *nParticles,
+                               const unsigned long int numN,
+                               RealType *vars)
+  {
+    const unsigned long int num = numN * numLanes;
+    const unsigned long int numX = t + 1;
+    const long int x0 = -(long int)t;
+    const unsigned long int stride = (unsigned long int)blockDim.x * gridDim.x;
+    for (unsigned long int idx = (unsigned long int)blockIdx.x * blockDim.x + threadIdx.x; idx < num; idx += stride)
+    {
+      unsigned long int j = idx / numLanes;
+      unsigned long int lane = idx - j * numLanes;
+      RealType N = nParticles[j];
+
+      // First i in [0, numX] with compCDF(i) * N <= 1
+      unsigned long int lo = 0;
+      unsigned long int hi = numX + 1;
+      while (lo < hi)
+      {
+        unsigned long int mid = lo + (hi - lo) / 2;
+        RealType c = (mid <= t) ? cdf[mid * numLanes + lane] : RealType(0);
+        if (c * N <= 1)
+        {
+          hi = mid;
+        }
+        else
+        {
+          lo = mid + 1;
+        }
+      }
+      unsigned long int cross = (lo < 1) ? 0 : lo - 1;
+      long int pivot = x0 + 2 * (long int)((cross < numX - 1) ? cross : numX - 1);
+
+      RealType ePrev = exp(-cdf[lane] * N);
+      RealType S0 = 0;
+      RealType S1 = 0;
+      RealType S2 = 0;
+      for (unsigned long int i = 0; i < numX; i++)
+      {
+        RealType next = (i + 1 <= t) ? cdf[(i + 1) * numLanes + lane] : RealType(0);
+        RealType e = exp(-next * N);
+        RealType p = e - ePrev;
+        ePrev = e;
+        RealType dx = RealType(x0 + 2 * (long int)i - pivot);
+        S0 += p;
+        S1 += p * dx;
+        S2 += p * dx * dx;
+      }
+      RealType d = RealType(pivot) * (S0 - 1) + S1;
+      vars[lane * numN + j] = S2 - 2 * d * S1 + d * d * S0;
+    }
+  }
+} // namespace
+
+template <class RealType>
+DiffusionTimeCDFGPU<RealType>::DiffusionTimeCDFGPU(const double _beta,
+                                                   const unsigned long int _tMax,
+                                                   const unsigned long int _numLanes)
+    : beta(_beta), tMax(_tMax), numLanes(_numLanes)
+{
+  if (numLanes == 0)
+  {
+    throw std::runtime_error("Number of lanes must be at least 1");
+  }
+  unsigned long int bytes = (tMax + 1) * numLanes * sizeof(RealType);
+  checkGPU(cudaMalloc(&CDF, bytes), "cudaMalloc");
+  cudaError_t err = cudaMalloc(&CDF_next, bytes);
+  if (err != cudaSuccess)
+  {
+    cudaFree(CDF);
+    checkGPU(err, "cudaMalloc");
+  }
+  // Sites past t are left at 0 in both buffers, a step only writes [0, t+1]
+  checkGPU(cudaMemset(CDF, 0, bytes), "cudaMemset");
+  checkGPU(cudaMemset(CDF_next, 0, bytes), "cudaMemset");
+  std::vector<RealType> ones(numLanes, RealType(1));
+  checkGPU(cudaMemcpy(CDF, ones.data(), numLanes * sizeof(RealType), cudaMemcpyHostToDevice), "cudaMemcpy");
+
+  std::random_device rd;
+  seed = rd();
+}
+
+template <class RealType>
+DiffusionTimeCDFGPU<RealType>::~DiffusionTimeCDFGPU()
+{
+  cudaFree(CDF);
+  cudaFree(CDF_next);
+}
+
+template <class RealType>
+void DiffusionTimeCDFGPU<RealType>::checkLane(const unsigned long int lane)
+{
+  if (lane >= numLanes)
+  {
+    throw std::runtime_error("Lane out of range: " + std::to_string(lane) +
+                             " (number of lanes " + std::to_string(numLanes) + ")");
+  }
+}
+
+template <class RealType>
+void DiffusionTimeCDFGPU<RealType>::iterateTimeStep()
+{
+  if (t + 1 > tMax)
+  {
+    throw std::runtime_error("Cannot evolve to time greater than tMax: " + std::to_string(tMax));
+  }
+  // Kernels on the default stream run in order, so there's no sync per step.
+  // An error in one shows up on the next call that copies back.
+  stepKernel<RealType><<<numBlocks((t + 2) * numLanes), threadsPerBlock>>>(CDF, CDF_next, numLanes, t, seed,
+                                                                           makeBetaParams(beta));
+  checkGPU(cudaGetLastError(), "stepKernel");
+  std::swap(CDF, CDF_next);
+  t += 1;
+}
+
+template <class RealType>
+void DiffusionTimeCDFGPU<RealType>::evolveToTime(const unsigned long int _t)
+{
+  if (_t > tMax)
+  {
+    throw std::runtime_error("Cannot evolve to time greater than tMax: " +
+                             std::to_string(tMax));
+  }
+  while (t < _t)
+  {
+    iterateTimeStep();
+  }
+}
+
+template <class RealType>
+void DiffusionTimeCDFGPU<RealType>::evolveTimesteps(const unsigned long int num)
+{
+  evolveToTime(t + num);
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDFGPU<RealType>::getCDF(const unsigned long int lane)
+{
+  checkLane(lane);
+  std::vector<RealType> laneCDF(tMax + 1);
+  // One value per row of numLanes
+  checkGPU(cudaMemcpy2D(laneCDF.data(), sizeof(RealType), CDF + lane, numLanes * sizeof(RealType),
+                        sizeof(RealType), tMax + 1, cudaMemcpyDeviceToHost),
+           "cudaMemcpy2D");
+  return laneCDF;
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDFGPU<RealType>::getSaveCDF(const unsigned long int lane)
+{
+  std::vector<RealType> laneCDF = getCDF(lane);
+  laneCDF.resize(t + 1);
+  return laneCDF;
+}
+
+template <class RealType>
+std::vector<std::vector<unsigned long int>> DiffusionTimeCDFGPU<RealType>::findQuantiles(
+    std::vector<RealType> quantiles)
+{
+  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+  std::vector<RealType> thresholds(quantiles.size());
+  for (unsigned long int q = 0; q < quantiles.size(); q++)
+  {
+    thresholds[q] = 1 / quantiles[q];
+  }
+  std::vector<std::vector<unsigned long int>> quantilePositions(
+      numLanes, std::vector<unsigned long int>(quantiles.size()));
+  if (quantiles.empty())
+  {
+    return quantilePositions;
+  }
+
+  DeviceBuffer<RealType> deviceThresholds(thresholds.size());
+  deviceThresholds.upload(thresholds);
+  DeviceBuffer<unsigned long int> devicePositions(numLanes * quantiles.size());
+  quantileKernel<RealType><<<numBlocks(numLanes * quantiles.size()), threadsPerBlock>>>(
+      CDF, numLanes, t, deviceThresholds.get(), quantiles.size(), devicePositions.get());
+  checkGPU(cudaGetLastError(), "quantileKernel");
+
+  std::vector<unsigned long int> positions = devicePositions.download();
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    std::copy(positions.begin() + lane * quantiles.size(), positions.begin() + (lane + 1) * quantiles.size(),
+              quantilePositions[lane].begin());
+  }
+  return quantilePositions;
+}
+
+template <class RealType>
+std::vector<std::vector<RealType>> DiffusionTimeCDFGPU<RealType>::getGumbelVariance(
+    std::vector<RealType> nParticles)
+{
+  std::vector<std::vector<RealType>> vars(numLanes, std::vector<RealType>(nParticles.size()));
+  if (nParticles.empty())
+  {
+    return vars;
+  }
+
+  DeviceBuffer<RealType> deviceN(nParticles.size());
+  deviceN.upload(nParticles);
+  DeviceBuffer<RealType> deviceVars(numLanes * nParticles.size());
+  gumbelKernel<RealType><<<numBlocks(numLanes * nParticles.size()), threadsPerBlock>>>(
+      CDF, numLanes, t, deviceN.get(), nParticles.size(), deviceVars.get());
+  checkGPU(cudaGetLastError(), "gumbelKernel");
+
+  std::vector<RealType> flat = deviceVars.download();
+  for (unsigned long int lane = 0; lane < numLanes; lane++)
+  {
+    std::copy(flat.begin() + lane * nParticles.size(), flat.begin() + (lane + 1) * nParticles.size(),
+              vars[lane].begin());
+  }
+  return vars;
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionTimeCDFGPU<RealType>::getPbAtV(const double v)
+{
+  // Same x = 2n - t convention as DiffusionTimeCDF::getPbAtV
+  double n = ceil((1 + v) * t / 2.);
+  std::vector<RealType> probs(numLanes, RealType(0));
+  if (n > t)
+  {
+    return probs;
+  }
+  unsigned long int idx = (n < 0) ? 0 : (unsigned long int)n;
+  checkGPU(cudaMemcpy(probs.data(), CDF + idx * numLanes, numLanes * sizeof(RealType), cudaMemcpyDeviceToHost),
+           "cudaMemcpy");
+  return probs;
+}
+
+template class DiffusionTimeCDFGPU<double>;
+template class DiffusionTimeCDFGPU<float>;
@@ -0,0 +1,79 @@
+#ifndef DIFFUSIONCDFGPU_H_
+#define DIFFUSIONCDFGPU_H_
+
+#include <vector>
+
+/*
+numLanes independent DiffusionTimeCDF realizations kept on the GPU, the
+device counterpart of DiffusionTimeCDFBatch. Only this declaration is plain
+C++, the kernels and the definitions are in diffusionCDFGPU.cu (built with
+nvcc, or hipcc for AMD) so the pybind11 module is compiled by the host
+compiler as usual.
+
+The CDFs are interleaved per site, CDF[n * numLanes + lane], so neighbouring
+threads read neighbouring lanes. A step is one kernel over every (n, lane)
+with n in [0, t+1] reading the previous step's buffer and writing the other
+one, so it's parallel over sites as well as lanes:
+
+  CDF[n, lane] = b[n, lane] * CDF_prev[n-1, lane] + (1 - b[n, lane]) * CDF_prev[n, lane]
+
+Each thread draws its own bias from the counter RNG keyed on (seed + lane, t,
+n-1), the numbering DiffusionTimeCDFBatch and DiffusionEnsemble use. For beta
+= 0, 1 and inf that's bit for bit the bias the host draws, so lane k is the
+realization of a DiffusionTimeCDF with setBetaSeed(seed + k) and
+setCounterRNG(true) (up to FMA contraction, so to rounding). A general beta
+has the same distribution but takes its normals from Box-Muller instead of
+boost's ziggurat, so it's a different realization.
+
+findQuantiles, getGumbelVariance and getPbAtV run on the device as well and
+only their results come back. Both buffers hold (tMax + 1) * numLanes
+values, e.g. 16 GB for tMax = 1e5 and 1e4 lanes in double. RealType has to be
+a type the device has (double, or float).
+*/
+template <class RealType>
+class DiffusionTimeCDFGPU
+{
+private:
+  double beta;
+  unsigned long int tMax;
+  unsigned long int numLanes;
+  unsigned long int t = 0;
+  unsigned int seed;
+
+  // Device buffers, CDF is the current step and CDF_next the one being written
+  RealType *CDF = nullptr;
+  RealType *CDF_next = nullptr;
+
+  void checkLane(const unsigned long int lane);
+
+public:
+  DiffusionTimeCDFGPU(const double _beta, const unsigned long int _tMax, const unsigned long int _numLanes);
+  ~DiffusionTimeCDFGPU();
+
+  DiffusionTimeCDFGPU(const DiffusionTimeCDFGPU &) = delete;
+  DiffusionTimeCDFGPU &operator=(const DiffusionTimeCDFGPU &) = delete;
+
+  double getBeta() { return beta; };
+  unsigned long int gettMax() { return tMax; };
+  unsigned long int getNumLanes() { return numLanes; };
+  unsigned long int getTime() { return t; };
+
+  // Lane k is seeded with seed + k
+  void setBetaSeed(const unsigned int _seed) { seed = _seed; };
+  unsigned int getBetaSeed() { return seed; };
+
+  void iterateTimeStep();
+  void evolveToTime(const unsigned long int _t);
+  void evolveTimesteps(const unsigned long int num);
+
+  // Copies one lane back to the host
+  std::vector<RealType> getCDF(const unsigned long int lane);
+  std::vector<RealType> getSaveCDF(const unsigned long int lane);
+
+  // One entry per lane, the same conventions as DiffusionTimeCDFBatch
+  std::vector<std::vector<unsigned long int>> findQuantiles(std::vector<RealType> quantiles);
+  std::vector<std::vector<RealType>> getGumbelVariance(std::vector<RealType> nParticles);
+  std::vector<RealType> getPbAtV(const double v);
+};
+
+#endif /* DIFFUSIONCDFGPU_H_ */
@@ -0,0 +1,44 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <string>
+
+#include "diffusionCDFGPU.h"
+
+namespace py = pybind11;
+
+template <class RealType>
+void declareDiffusionGPU(py::module &m, const std::string &suffix)
+{
+  typedef DiffusionTimeCDFGPU<RealType> GPU;
+
+  py::class_<GPU>(m, ("DiffusionTimeCDFGPU" + suffix).c_str())
+      .def(py::init<const double, const unsigned long int, const unsigned long int>(),
+           py::arg("beta"), py::arg("tMax"), py::arg("numLanes"))
+      .def("getBeta", &GPU::getBeta)
+      .def("gettMax", &GPU::gettMax)
+      .def("getNumLanes", &GPU::getNumLanes)
+      .def("getTime", &GPU::getTime)
+      .def("setBetaSeed", &GPU::setBetaSeed, py::arg("seed"))
+      .def("getBetaSeed", &GPU::getBetaSeed)
+      .def("iterateTimeStep", &GPU::iterateTimeStep)
+      .def("evolveToTime", &GPU::evolveToTime, py::arg("time"), py::call_guard<py::gil_scoped_release>())
+      .def("evolveTimesteps", &GPU::evolveTimesteps, py::arg("num"), py::call_guard<py::gil_scoped_release>())
+      .def("getCDF", &GPU::getCDF, py::arg("lane"))
+      .def("getSaveCDF", &GPU::getSaveCDF, py::arg("lane"))
+      .def("findQuantiles", &GPU::findQuantiles, py::arg("quantiles"))
+      .def("getGumbelVariance", &GPU::getGumbelVariance, py::arg("nParticles"))
+      .def("getPbAtV", &GPU::getPbAtV, py::arg("v"));
+}
+
+PYBIND11_MODULE(diffusionGPU, m)
+{
+  m.doc() = "Diffusion recurrance relation on the GPU";
+
+  // The device has no float128 or long double. Double is also exported
+  // without a suffix.
+  declareDiffusionGPU<double>(m, "_f64");
+  declareDiffusionGPU<float>(m, "_f32");
+
+  m.attr("DiffusionTimeCDFGPU") = m.attr("DiffusionTimeCDFGPU_f64");
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// The CUDA runtime calls the GPU engine uses, mapped onto HIP when it's built
+// with hipcc so the same source runs on AMD cards
+#ifdef __HIPCC__
+#include <hip/hip_runtime.h>
+#define cudaError_t hipError_t
+#define cudaSuccess hipSuccess
+#define cudaMalloc hipMalloc
+#define cudaFree hipFree
+#define cudaMemset hipMemset
+#define cudaMemcpy hipMemcpy
+#define cudaMemcpy2D hipMemcpy2D
+#define cudaMemcpyHostToDevice hipMemcpyHostToDevice
+#define cudaMemcpyDeviceToHost hipMemcpyDeviceToHost
+#define cudaMemcpyDeviceToDevice hipMemcpyDeviceToDevice
+#define cudaGetLastError hipGetLastError
+#define cudaGetErrorString hipGetErrorString
+#define cudaDeviceSynchronize hipDeviceSynchronize
+#else
+#include <cuda_runtime.h>
+#endif
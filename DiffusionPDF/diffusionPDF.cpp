@@ -1,4 +1,5 @@
 #include "diffusionPDF.hpp"
+#include "diffusionPDFReplicas.hpp"
 
 #include <math.h>
 #include <pybind11/numpy.h>
@@ -9,376 +10,216 @@
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <string>
 #include <math.h>
 
-#include "pybind11_numpy_scalar.h"
-#include "../Stats/stat.h"
+#include "../IO/numpyScalars.h"
+#include "../IO/numpyView.h"
+#include "../IO/recorder.h"
+#include "../Scalars/doubleDouble.h"
+#include "../Scalars/scaledDouble.h"
 
 namespace py = pybind11;
 
 using RealType = boost::multiprecision::float128;
-static_assert(sizeof(RealType) == 16, "Bad size");
 
-// Boilerplate to get PyBind11 to cast to a npquad precision.
-namespace pybind11 {
-namespace detail {
-
-// Similar to enums in `pybind11/numpy.h`. Determined by doing:
-// python3 -c 'import numpy as np; print(np.dtype(np.float16).num)'
-constexpr int NPY_FLOAT16 = 256;
-
-// Kinda following:
-// https://github.com/pybind/pybind11/blob/9bb3313162c0b856125e481ceece9d8faa567716/include/pybind11/numpy.h#L1000
-template <> struct npy_format_descriptor<RealType> {
-  static constexpr auto name = _("RealType");
-  static pybind11::dtype dtype()
-  {
-    handle ptr = npy_api::get().PyArray_DescrFromType_(NPY_FLOAT16);
-    return reinterpret_borrow<pybind11::dtype>(ptr);
-  }
-};
-
-template <> struct type_caster<RealType> : npy_scalar_caster<RealType> {
-  static constexpr auto name = _("RealType");
-};
-
-} // namespace detail
-} // namespace pybind11
-
-// Constuctor
-DiffusionPDF::DiffusionPDF(const RealType _nParticles,
-                     const double _beta,
-                     const unsigned long int _occupancySize,
-                     const bool _ProbDistFlag)
-    : nParticles(_nParticles), beta(_beta),
-    occupancySize(_occupancySize), ProbDistFlag(_ProbDistFlag)
-{
-  if (isnan(nParticles) || isinf(nParticles)){
-    throw std::runtime_error("Number of particles initialized to NaN");
-  }
-  edges.first.resize(_occupancySize + 1), edges.second.resize(_occupancySize + 1);
-  edges.first[0] = 0, edges.second[0] = 0;
-
-  occupancy.resize(_occupancySize + 1);
-  occupancy[0] = nParticles;
-
-  if (_beta != 0) {
-    boost::random::beta_distribution<>::param_type params(_beta, _beta);
-    betaParams = params;
-  }
-
-  std::uniform_real_distribution<>::param_type unifParams(0.0, 1.0);
-  dis.param(unifParams);
-  gen.seed(rd());
-
-  time = 0;
-}
-
-std::vector<RealType> DiffusionPDF::getSaveOccupancy(){
-  return slice(occupancy, edges.first[time], edges.second[time]);
-}
-
-std::pair<std::vector<unsigned long int>, std::vector<unsigned long int> > DiffusionPDF::getSaveEdges(){
-  std::vector<unsigned long int> minEdge = slice(edges.first, 0, time);
-  std::vector<unsigned long int> maxEdge = slice(edges.second, 0, time);
-  return std::make_pair(minEdge, maxEdge);
-}
-
-RealType DiffusionPDF::toNextSite(RealType currentSite, RealType bias)
-{
-  // If generating the probability distribution just default to the
-  // number of particles * bias
-  if (ProbDistFlag){
-    return (currentSite * bias);
-  }
-
-  // The boost binomial can sometimes return negative numbers (or inf) for
-  // large or small biases. So we default to number of particles * bias
-  if (bias >= 0.99999 || bias <= 0.000001) {
-    return (currentSite * bias);
-  }
-
-  // For smallCutoff need to downcast currentSite to double. And then cast
-  // answer to RealType.
-  if (currentSite < smallCutoff) {
-
-    return RealType(binomial(gen, boost::random::binomial_distribution<>::param_type(double(currentSite), double(bias))));
-  }
-
-  else if (currentSite > largeCutoff) {
-    return (currentSite * bias);
-  }
-  // If less than largeCutoff use sqrt(N * p * (1-p)) * randn(-1, 1)
-  else {
-
-    RealType mediumVariance = sqrt(currentSite * bias * (1 - bias));
-    return currentSite * bias + mediumVariance * (2*RealType(dis(gen))-1);
-  }
-}
-
-double DiffusionPDF::generateBeta()
-{
-  // If beta = 0 return either 0 or 1
-  if (beta == 0.0) {
-    return round(dis(gen));
-  }
-  // If beta = 1 use random uniform distribution
-  else if (beta == 1.0) {
-    return dis(gen);
-  }
-  // If beta = inf return 0.5
-  else if (isinf(beta)) {
-    return 0.5;
-  }
-  else {
-    return beta_dist(gen, betaParams);
-  }
-}
-
-void DiffusionPDF::iterateTimestep()
-{
-  unsigned long int prevMinIndex = edges.first[time];
-  unsigned long int prevMaxIndex = edges.second[time];
-  if (prevMinIndex > prevMaxIndex) {
-    throw std::runtime_error(
-        "Minimum edge must be greater than maximum edge: (" +
-        std::to_string(prevMinIndex) + ", " + std::to_string(prevMaxIndex) +
-        ")");
-  }
-
-  // If iterating over the whole array extend the occupancy.
-  if ((prevMaxIndex + 1) == occupancy.size()) {
-    occupancy.push_back(0);
-    std::cout << "Warning: pushing back occupancy size. If this happens a lot "
-                 "it may effect performance."
-              << std::endl;
-  }
-
-  RealType fromLastSite = 0;
-  RealType toNextSite = 0;
-  unsigned long int minEdge = 0;
-  unsigned long int maxEdge = 0;
-  bool firstNonzero = true;
-
-  for (auto i = prevMinIndex; i < prevMaxIndex + 2; i++) {
-    RealType *occ = &occupancy.at(i);
-
-    RealType bias = 0;
-    if (*occ != 0) {
-      bias = RealType(DiffusionPDF::generateBeta());
-      toNextSite = DiffusionPDF::toNextSite(*occ, bias);
-      if (!ProbDistFlag) {
-        toNextSite = round(toNextSite);
-      }
-    }
-    else {
-      toNextSite = 0;
-    }
-
-    RealType prevOcc = *occ; // For error checking below
-    *occ += fromLastSite - toNextSite;
-    fromLastSite = toNextSite;
-
-    if (*occ != 0) {
-      maxEdge = i;
-      if (firstNonzero) {
-        minEdge = i;
-        firstNonzero = false;
-      }
-    }
-
-    if (toNextSite < 0 || toNextSite > prevOcc || bias < 0.0 || bias > 1.0 ||
-        *occ < 0 || *occ > nParticles || isnan(*occ)) {
-      std::cout << "Time:" << time << "\n";
-      std::cout << "Occupancy: " << *occ << "\n";
-      std::cout << "Next site: "  << toNextSite << "\n";
-      std::cout << "Bias: "  << bias << std::endl;
-      throw std::runtime_error("One or more variables out of bounds: ");
-    }
-  }
-
-  edges.first[time + 1] = minEdge;
-  edges.second[time + 1] = maxEdge;
-  time += 1;
-}
-
-/*
-The algorithm just looks at the sum of the occupancy up to some position maxIdx.
-The position of the Nth quartile then happens when the condition
-sum > nParticles / quantile.
-*/
-double DiffusionPDF::findQuantile(const RealType quantile)
+template <class RealType>
+void declareDiffusionPDF(py::module &m, const std::string &suffix)
 {
-  unsigned long int maxIdx = edges.second[time];
-  double centerIdx = time * 0.5;
-
-  double dist = maxIdx - centerIdx;
-  RealType sum = occupancy.at(maxIdx);
-  while (sum < nParticles / quantile) {
-    maxIdx -= 1;
-    dist -= 1;
-    sum += occupancy.at(maxIdx);
-  }
-  return dist;
-}
+  typedef DiffusionPDF<RealType> Class;
 
-/*
-The algorithm just looks at the sum of the occupancy up to some position maxIdx.
-The position of the Nth quartile then happens when the condition
-sum > nParticles / quantile.
-*/
-std::vector<double> DiffusionPDF::findQuantiles(std::vector<RealType> quantiles)
-{
-
-  // Need Quantiles in descending order for algorithm to work correctly
-  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
-
-  std::vector<double> dists(quantiles.size());
-
-  unsigned long int maxIdx = edges.second[time];
-  double centerIdx = time * 0.5;
-  double dist = maxIdx - centerIdx;
-  RealType sum = occupancy.at(maxIdx);
-
-  unsigned long int quantiles_idx = 0;
-  while (quantiles_idx < quantiles.size()){
-    while (sum < nParticles / quantiles[quantiles_idx]){
-      maxIdx -= 1;
-      dist -= 1;
-      sum += occupancy.at(maxIdx);
-    }
-    dists[quantiles_idx] = dist;
-    quantiles_idx += 1;
-  }
-  return dists;
-}
-
-RealType DiffusionPDF::pGreaterThanX(const unsigned long int idx)
-{
-  RealType Nabove = 0.0;
-  for (unsigned long int j = idx; j <= time; j++) {
-    Nabove += occupancy.at(j);
-  }
-  return Nabove / nParticles;
-}
-
-std::pair<std::vector<double>, std::vector<RealType>>
-DiffusionPDF::calcVsAndPb(const unsigned long int num)
-{
-  std::vector<double> vs;
-  std::vector<RealType> Pbs;
-  unsigned long int maxIdx = edges.second[time];
-  RealType Nabove = 0.0;
-  for (unsigned long int i = maxIdx; i > (maxIdx - num); i--) {
-    Nabove += occupancy.at(i);
-    RealType probAbove = Nabove / nParticles;
-    double v = (2. * i - time) / time;
-    vs.push_back(v);
-    Pbs.push_back(probAbove);
-  }
-  std::pair<std::vector<double>, std::vector<RealType>> returnTuple(vs, Pbs);
-  return returnTuple;
-}
-
-std::pair<std::vector<double>, std::vector<RealType>>
-DiffusionPDF::VsAndPb(const double v)
-{
-  std::vector<double> vs;
-  std::vector<RealType> Pbs;
-  unsigned long int idx = edges.second[time];
-  RealType Nabove = 0.0;
-  double currentV = (2. * idx - time) / time;
-  while (currentV >= v) {
-    Nabove += occupancy.at(idx);
-    RealType probAbove = Nabove / nParticles;
-    vs.push_back(currentV);
-    Pbs.push_back(probAbove);
-
-    idx -= 1;
-    currentV = (2. * idx - time) / time;
-  }
-  std::pair<std::vector<double>, std::vector<RealType>> returnTuple(vs, Pbs);
-  return returnTuple;
-}
-
-std::pair<std::vector<long int>, std::vector<RealType> > DiffusionPDF::getxvals_and_pdf(){
-  unsigned long int minIdx = edges.first[time];
-  unsigned long int maxIdx = edges.second[time];
-
-  if (minIdx == 0){
-    minIdx += 1;
-  }
-
-  if (maxIdx == occupancy.size()-1){
-    maxIdx -= 1;
-  }
-
-  std::vector<long int> xvals(maxIdx - minIdx + 2);
-  std::vector<RealType> pdf(maxIdx - minIdx + 2);
-
-  for (unsigned long int i=minIdx-1; i <= maxIdx; i++){
-    xvals.at(i-minIdx+1) = 2 * i - time;
-    pdf.at(i-minIdx+1) = occupancy.at(i);
-  }
-  return std::make_pair(xvals, pdf);
-}
-
-std::vector<RealType> DiffusionPDF::getCDF(){
-  std::pair<std::vector<long int>, std::vector<RealType> > pair = getxvals_and_pdf();
-  std::vector<RealType> pdf = pair.second;
-  return pdf_to_comp_cdf(pdf, nParticles);
-}
-
-RealType DiffusionPDF::getGumbelVariance(RealType maxParticle)
-{
-  std::pair<std::vector<long int>, std::vector<RealType> > pair = getxvals_and_pdf();
-  std::vector<long int> xvals = pair.first;
-  std::vector<RealType> pdf = pair.second;
-  return getGumbelVariancePDF(xvals, pdf, maxParticle, nParticles);
-}
-
-PYBIND11_MODULE(diffusionPDF, m)
-{
-  m.doc() = "C++ diffusionPDF";
-
-  py::class_<DiffusionPDF>(m, "DiffusionPDF")
+  py::class_<Class>(m, ("DiffusionPDF" + suffix).c_str())
       .def(py::init<const RealType,
                     const double,
                     const unsigned long int,
-                    const bool>(),
+                    const bool,
+                    const bool,
+                    const std::string>(),
            py::arg("numberOfParticles"),
            py::arg("beta"),
            py::arg("occupancySize"),
-           py::arg("ProbDistFlag") = true)
-
-      .def("getOccupancy", &DiffusionPDF::getOccupancy)
-      .def("setOccupancy", &DiffusionPDF::setOccupancy, py::arg("occupancy"))
-      .def("getOccupancySize", &DiffusionPDF::getOccupancySize)
-      .def("getSaveOccupancy", &DiffusionPDF::getSaveOccupancy)
-      .def("getSaveEdges", &DiffusionPDF::getSaveEdges)
-      .def("resizeOccupancyAndEdges", &DiffusionPDF::resizeOccupancyAndEdges, py::arg("size"))
-      .def("getNParticles", &DiffusionPDF::getNParticles)
-      .def("getBeta", &DiffusionPDF::getBeta)
+           py::arg("ProbDistFlag") = true,
+           py::arg("windowStorage") = false,
+           py::arg("storageDirectory") = "")
+
+      .def("getOccupancy", [](py::object self) {
+             Class &c = self.cast<Class &>();
+             if (c.getWindowStorage()) {
+               return readOnlyCopy(c.viewOccupancy());
+             }
+             return guardedView(c.viewOccupancy(), c.getOccupancyViews(), self); },
+           "Read only view of the occupancy that shares memory with the object (a read only copy with window "
+           "storage, which moves it as it goes). Calls that would move it throw while the view is alive.")
+      .def("getOccupancyCopy", &Class::getOccupancy)
+      .def("setOccupancy", &Class::setOccupancy, py::arg("occupancy"))
+      .def("getOccupancySize", &Class::getOccupancySize)
+      .def("getOccupancyOffset", &Class::getOccupancyOffset)
+      .def("getWindowStorage", &Class::getWindowStorage)
+      .def("getStorageDirectory", &Class::getStorageDirectory)
+      .def("setWindowStorage", &Class::setWindowStorage, py::arg("windowStorage"))
+      .def("getEdgeHistoryLength", &Class::getEdgeHistoryLength)
+      .def("setEdgeHistoryLength", &Class::setEdgeHistoryLength, py::arg("edgeHistoryLength"))
+      .def("getEdgesOffset", &Class::getEdgesOffset)
+      .def("getSaveOccupancy", [](py::object self) {
+             Class &c = self.cast<Class &>();
+             unsigned long int first = c.getMinIdx() - c.getOccupancyOffset();
+             unsigned long int last = c.getMaxIdx() - c.getOccupancyOffset();
+             if (c.getWindowStorage()) {
+               return readOnlyCopy(c.viewOccupancy(), first, last);
+             }
+             return guardedView(c.viewOccupancy(), first, last, c.getOccupancyViews(), self); },
+           "Read only view of the occupied part of the occupancy, like getOccupancy")
+      .def("getSaveOccupancyCopy", &Class::getSaveOccupancy)
+      .def("getSaveEdges", [](py::object self) {
+             Class &c = self.cast<Class &>();
+             unsigned long int last = c.getTime() - c.getEdgesOffset();
+             return py::make_tuple(readOnlyCopy(c.viewEdges().first, 0, last),
+                                   readOnlyCopy(c.viewEdges().second, 0, last)); },
+           "Read only copies of the edges up to the current time")
+      .def("getSaveEdgesCopy", &Class::getSaveEdges)
+      .def("resizeOccupancyAndEdges", &Class::resizeOccupancyAndEdges, py::arg("size"))
+      .def("getNParticles", &Class::getNParticles)
+      .def("getBeta", &Class::getBeta)
       .def("setProbDistFlag",
-           &DiffusionPDF::setProbDistFlag,
+           &Class::setProbDistFlag,
            py::arg("ProbDistFlag"))
-      .def("getProbDistFlag", &DiffusionPDF::getProbDistFlag)
-      .def("getSmallCutoff", &DiffusionPDF::getSmallCutoff)
-      .def("setSmallCutoff", &DiffusionPDF::setSmallCutoff, py::arg("smallCutoff"))
-      .def("getLargeCutoff", &DiffusionPDF::getLargeCutoff)
-      .def("setLargeCutoff", &DiffusionPDF::setLargeCutoff, py::arg("largeCutoff"))
-      .def("getEdges", &DiffusionPDF::getEdges)
-      .def("setEdges", &DiffusionPDF::setEdges)
-      .def("getMaxIdx", &DiffusionPDF::getMaxIdx)
-      .def("getMinIdx", &DiffusionPDF::getMinIdx)
-      .def("getTime", &DiffusionPDF::getTime)
-      .def("setTime", &DiffusionPDF::setTime)
-      .def("iterateTimestep", &DiffusionPDF::iterateTimestep)
-      .def("findQuantile", &DiffusionPDF::findQuantile, py::arg("quantile"))
-      .def("findQuantiles", &DiffusionPDF::findQuantiles, py::arg("quantiles"))
-      .def("pGreaterThanX", &DiffusionPDF::pGreaterThanX, py::arg("idx"))
-      .def("calcVsAndPb", &DiffusionPDF::calcVsAndPb, py::arg("num"))
-      .def("VsAndPb", &DiffusionPDF::VsAndPb, py::arg("v"))
-      .def("getGumbelVariance", &DiffusionPDF::getGumbelVariance, py::arg("nParticles"))
-      .def("getCDF", &DiffusionPDF::getCDF);
+      .def("getProbDistFlag", &Class::getProbDistFlag)
+      .def("setDebugChecks", &Class::setDebugChecks, py::arg("debugChecks"))
+      .def("getDebugChecks", &Class::getDebugChecks)
+      .def("getStats", &Class::getStats)
+      .def("resetStats", &Class::resetStats)
+      .def("setStatsLogInterval", &Class::setStatsLogInterval, py::arg("steps"))
+      .def("getStatsLogInterval", &Class::getStatsLogInterval)
+      .def("getSmallCutoff", &Class::getSmallCutoff)
+      .def("setSmallCutoff", &Class::setSmallCutoff, py::arg("smallCutoff"))
+      .def("getLargeCutoff", &Class::getLargeCutoff)
+      .def("setLargeCutoff", &Class::setLargeCutoff, py::arg("largeCutoff"))
+      .def("getEdges", [](py::object self) {
+             Class &c = self.cast<Class &>();
+             return py::make_tuple(readOnlyCopy(c.viewEdges().first), readOnlyCopy(c.viewEdges().second)); },
+           "Read only copies of the edges")
+      .def("getEdgesCopy", &Class::getEdges)
+      .def("setEdges", &Class::setEdges)
+      .def("getMaxIdx", &Class::getMaxIdx)
+      .def("getMinIdx", &Class::getMinIdx)
+      .def("setBetaSeed", &Class::setBetaSeed, py::arg("seed"))
+      .def("setCounterRNG", &Class::setCounterRNG, py::arg("counterRNG"))
+      .def("getCounterRNG", &Class::getCounterRNG)
+      .def("setNumThreads", &Class::setNumThreads, py::arg("numThreads"))
+      .def("getNumThreads", &Class::getNumThreads)
+      .def("setTailSums", &Class::setTailSums, py::arg("tailSums"))
+      .def("getTailSums", &Class::getTailSums)
+      .def("getBias", &Class::getBias, py::arg("time"), py::arg("idx"))
+      .def("getTime", &Class::getTime)
+      .def("setTime", &Class::setTime)
+      .def("iterateTimestep", &Class::iterateTimestep)
+      .def("evolveToTime", &Class::evolveToTime, py::arg("time"), py::call_guard<py::gil_scoped_release>())
+      .def("evolveTimesteps", &Class::evolveTimesteps, py::arg("num"), py::call_guard<py::gil_scoped_release>())
+      .def("findQuantile", &Class::findQuantile, py::arg("quantile"))
+      .def("findQuantiles", &Class::findQuantiles, py::arg("quantiles"))
+      .def("pGreaterThanX", &Class::pGreaterThanX, py::arg("idx"))
+      .def("getPbAtV", &Class::getPbAtV, py::arg("v"))
+      .def("measure", [](Class &c, std::vector<RealType> quantiles, std::vector<double> velocities, std::vector<RealType> nParticles) {
+             MeasurementPlan<RealType> plan;
+             plan.quantiles = quantiles;
+             plan.velocities = velocities;
+             plan.nParticles = nParticles;
+             auto result = c.measure(plan);
+             return py::make_tuple(result.quantiles, result.pb, result.gumbelVariance); },
+           py::arg("quantiles"), py::arg("velocities"), py::arg("nParticles"),
+           "(quantiles, Pb, Gumbel variances) in the order given, from one pass over the state")
+      .def("calcVsAndPb", &Class::calcVsAndPb, py::arg("num"))
+      .def("VsAndPb", &Class::VsAndPb, py::arg("v"))
+      .def("getGumbelVariance", static_cast<RealType (Class::*)(RealType)>(&Class::getGumbelVariance), py::arg("nParticles"))
+      .def("getGumbelVariance", static_cast<std::vector<RealType> (Class::*)(std::vector<RealType>)>(&Class::getGumbelVariance), py::arg("nParticles"))
+      .def("getCDF", &Class::getCDF)
+      .def("evolveAndSaveFirstPassage", &Class::evolveAndSaveFirstPassage, py::arg("positions"),
+           py::call_guard<py::gil_scoped_release>())
+      .def("evolveAndSaveFirstPassageQuantile", &Class::evolveAndSaveFirstPassageQuantile,
+           py::arg("positions"), py::arg("quantiles"), py::call_guard<py::gil_scoped_release>())
+      .def("saveCheckpoint", &Class::saveCheckpoint, py::arg("fileName"), py::call_guard<py::gil_scoped_release>())
+      .def("loadCheckpoint", &Class::loadCheckpoint, py::arg("fileName"), py::call_guard<py::gil_scoped_release>())
+      .def("saveCheckpointAsync", &Class::saveCheckpointAsync, py::arg("fileName"))
+      .def("waitForCheckpoint", &Class::waitForCheckpoint, py::call_guard<py::gil_scoped_release>())
+      .def("checkpointPending", &Class::checkpointPending);
+
+  typedef Recorder<Class, RealType> Rec;
+
+  py::class_<Rec>(m, ("RecorderPDF" + suffix).c_str())
+      .def(py::init<const std::string, const bool, const unsigned long int>(),
+           py::arg("fileName"), py::arg("append") = false, py::arg("flushRows") = 1000)
+      .def("addQuantiles", &Rec::addQuantiles, py::arg("quantiles"))
+      .def("addPb", &Rec::addPb, py::arg("velocities"))
+      .def("addGumbelVariance", &Rec::addGumbelVariance, py::arg("nParticles"))
+      .def("addMeasurement", &Rec::addMeasurement, py::arg("quantiles"), py::arg("velocities"), py::arg("nParticles"))
+      .def("addMaxEdge", &Rec::addMaxEdge)
+      .def("getColumns", &Rec::getColumns)
+      .def("getFlushRows", &Rec::getFlushRows)
+      .def("setFlushRows", &Rec::setFlushRows, py::arg("flushRows"))
+      .def("record", &Rec::record, py::arg("system"))
+      .def("evolveAndRecord", &Rec::evolveAndRecord, py::arg("system"), py::arg("times"),
+           py::call_guard<py::gil_scoped_release>())
+      .def("flush", &Rec::flush)
+      .def("close", &Rec::close);
+
+  typedef DiffusionPDFReplicas<RealType> Replicas;
+
+  py::class_<Replicas>(m, ("DiffusionPDFReplicas" + suffix).c_str())
+      .def(py::init<const std::vector<RealType>, const double, const unsigned long int>(),
+           py::arg("numberOfParticles"), py::arg("beta"), py::arg("occupancySize"))
+      .def("getNumReplicas", &Replicas::getNumReplicas)
+      .def("getNParticles", &Replicas::getNParticles)
+      .def("getBeta", &Replicas::getBeta)
+      .def("getOccupancySize", &Replicas::getOccupancySize)
+      .def("getTime", &Replicas::getTime)
+      .def("setBetaSeed", &Replicas::setBetaSeed, py::arg("seed"))
+      .def("setCounterRNG", &Replicas::setCounterRNG, py::arg("counterRNG"))
+      .def("getCounterRNG", &Replicas::getCounterRNG)
+      .def("getSmallCutoff", &Replicas::getSmallCutoff)
+      .def("setSmallCutoff", &Replicas::setSmallCutoff, py::arg("smallCutoff"))
+      .def("getLargeCutoff", &Replicas::getLargeCutoff)
+      .def("setLargeCutoff", &Replicas::setLargeCutoff, py::arg("largeCutoff"))
+      .def("getStats", &Replicas::getStats)
+      .def("resetStats", &Replicas::resetStats)
+      .def("iterateTimestep", &Replicas::iterateTimestep)
+      .def("evolveToTime", &Replicas::evolveToTime, py::arg("time"), py::call_guard<py::gil_scoped_release>())
+      .def("evolveTimesteps", &Replicas::evolveTimesteps, py::arg("num"), py::call_guard<py::gil_scoped_release>())
+      .def("getMinIdx", &Replicas::getMinIdx, py::arg("replica"))
+      .def("getMaxIdx", &Replicas::getMaxIdx, py::arg("replica"))
+      .def("getSaveOccupancy", &Replicas::getSaveOccupancy, py::arg("replica"))
+      .def("getSaveEdges", &Replicas::getSaveEdges, py::arg("replica"))
+      .def("findQuantiles", &Replicas::findQuantiles, py::arg("quantiles"))
+      .def("getPbAtV", &Replicas::getPbAtV, py::arg("v"))
+      .def("getGumbelVariance", &Replicas::getGumbelVariance, py::arg("nParticles"))
+      .def("measure", [](Replicas &r, std::vector<RealType> quantiles, std::vector<double> velocities, std::vector<RealType> nParticles) {
+             MeasurementPlan<RealType> plan;
+             plan.quantiles = quantiles;
+             plan.velocities = velocities;
+             plan.nParticles = nParticles;
+             py::list results;
+             for (auto &result : r.measure(plan)) {
+               results.append(py::make_tuple(result.quantiles, result.pb, result.gumbelVariance));
+             }
+             return results; },
+           py::arg("quantiles"), py::arg("velocities"), py::arg("nParticles"),
+           "(quantiles, Pb, Gumbel variances) of every replica, like DiffusionPDF.measure");
+}
+
+PYBIND11_MODULE(diffusionPDF, m)
+{
+  m.doc() = "C++ diffusionPDF";
+
+  // One class per precision. The quad precision class is also exported
+  // without a suffix since that is what the Python wrapper uses.
+  declareDiffusionPDF<double>(m, "_f64");
+  declareDiffusionPDF<long double>(m, "_f80");
+  declareDiffusionPDF<RealType>(m, "_f128");
+  // Double precision with an unbounded exponent for huge nParticles
+  declareDiffusionPDF<ScaledDouble>(m, "_scaled");
+  // ~106 bits from pairs of doubles, much faster than float128
+  declareDiffusionPDF<DoubleDouble>(m, "_dd");
+
+  m.attr("DiffusionPDF") = m.attr("DiffusionPDF_f128");
+  m.attr("RecorderPDF") = m.attr("RecorderPDF_f128");
+  m.attr("DiffusionPDFReplicas") = m.attr("DiffusionPDFReplicas_f128");
 }
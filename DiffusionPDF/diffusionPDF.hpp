@@ -1,23 +1,55 @@
+#ifndef DIFFUSIONPDF_HPP_
+#define DIFFUSIONPDF_HPP_
+
 #include <assert.h>
 #include <boost/math/distributions.hpp>
-#include <boost/multiprecision/float128.hpp>
 #include <boost/random.hpp>
 #include <boost/random/beta_distribution.hpp>
-#include <boost/random/binomial_distribution.hpp>
 #include <boost/random/normal_distribution.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
 #include <math.h>
+#include <memory>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
-typedef boost::multiprecision::float128 RealType;
+#include "../IO/checkpoint.h"
+#include "../IO/storage.h"
+#include "../Parallel/threadPool.h"
+#include "../Random/betaSampler.h"
+#include "../Random/binomialSampler.h"
+#include "../Stats/counters.h"
+#include "../Stats/measurement.h"
+#include "../Stats/stat.h"
 
-#ifndef DIFFUSIONPDF_HPP_
-#define DIFFUSIONPDF_HPP_
+// Sites the window storage allocates at least
+constexpr unsigned long int minWindowSize = 64;
 
+// RealType is the scalar the occupancy is stored and evolved in (e.g. double,
+// long double or boost::multiprecision::float128).
+//
+// By default the occupancy and both edge lists are allocated for every site
+// and time up to occupancySize. With window storage the occupancy only holds
+// the sites [occupancyOffset, occupancyOffset + occupancy.size()) around the
+// occupied band, reallocated at twice the band's width when a step runs off
+// the end, and the edges only hold the times from edgesOffset on (all of
+// them unless setEdgeHistoryLength bounds it). That's O(width) memory instead
+// of O(tMax), which is what matters for the narrow discrete runs.
+//
+// Either way the occupancy and edges can be mapped from files in a directory
+// instead of allocated (IO/storage.h), for full storage bigger than RAM.
+template <class RealType>
 class DiffusionPDF {
 private:
-  std::vector<RealType> occupancy;
+  storage::Vector<RealType> occupancy;
+  // numpy views of the full storage occupancy, nothing moves it while there
+  // are any
+  storage::Views occupancyViews;
   RealType nParticles;
   double beta;
   unsigned long int occupancySize;
@@ -25,99 +57,1396 @@ private:
   double smallCutoff = pow(2, 31) - 2;
   double largeCutoff = 1e64;
 
-  // Set up random number generators
-  boost::random::beta_distribution<>::param_type betaParams;
-
+  // Set up random number generators. If counterRNG is set everything drawn
+  // for a site comes from counterGen keyed on (seed, time, site) instead of
+  // the sequential gen.
   std::random_device rd;
   boost::random::mt19937_64 gen;
+  CounterRNG counterGen;
+  bool counterRNG = false;
+
+  BinomialSampler binomial;
 
-  std::uniform_real_distribution<> dis;
-  boost::random::beta_distribution<> beta_dist;
-  boost::random::binomial_distribution<> binomial;
+  BetaSampler betaSampler;
 
-  std::pair<std::vector<unsigned long int>, std::vector<unsigned long int>>
+  // Biases for the current block of sites, refilled as a step sweeps up, and
+  // the particles each site of the block sends to the next one
+  std::vector<double> biases;
+  std::vector<RealType> moved;
+
+  std::pair<storage::Vector<unsigned long int>, storage::Vector<unsigned long int>>
       edges;
   unsigned long int time;
 
-  RealType toNextSite(RealType currentSite, RealType bias);
+  bool windowFlag;
+  unsigned long int occupancyOffset = 0;
+  unsigned long int edgesOffset = 0;
+  // Number of edge entries window storage keeps at least, 0 for all of them
+  unsigned long int edgeHistoryLength = 0;
+
+  // Occupancy at site idx, which has to be stored
+  RealType &site(const unsigned long int idx) { return occupancy.at(idx - occupancyOffset); };
+  // Occupancy at site idx or 0 if it isn't stored (so is empty)
+  RealType siteOrZero(const unsigned long int idx)
+  {
+    if (idx < occupancyOffset || idx - occupancyOffset >= occupancy.size()) {
+      return 0;
+    }
+    return occupancy[idx - occupancyOffset];
+  };
+  // Make sure window storage holds sites [first, last]
+  void reserveWindow(const unsigned long int first, const unsigned long int last);
+  // Record the edges at time + 1
+  void pushEdges(const unsigned long int minEdge, const unsigned long int maxEdge);
+
+  // Threads a single step is split over. Only used with the counter RNG since
+  // the sequential gen has to hand out the random numbers in order.
+  unsigned int numThreads = 1;
+  std::unique_ptr<ThreadPool> pool;
+
+  // Per chunk bias buffers and the particles leaving the first and last site
+  // of each chunk for the threaded step
+  std::vector<std::vector<double>> chunkBiases;
+  std::vector<std::vector<RealType>> chunkMoved;
+  std::vector<RealType> chunkFirstOut;
+  std::vector<RealType> chunkLastOut;
+
+  // What the steps and queries did and how long they took, each chunk of a
+  // threaded step counts into its own and they're merged after
+  EngineStats stats;
+  std::vector<EngineStats> chunkStats;
+
+  // Lays the checkpoint out in a checkpoint::Writer or a checkpoint::Buffer
+  template <class Sink>
+  void writeCheckpoint(Sink &writer);
+  checkpoint::AsyncWriter asyncCheckpoint;
+
+  // Suffix sums of the occupancy, tailSums[i - minEdge] is the sum of
+  // occupancy[i..maxEdge] added from maxEdge down (the same order
+  // findQuantile adds them in). Built on the first query after the occupancy
+  // changes, so a save time with many queries pays for one pass over the
+  // window and then every query is a lookup or a binary search.
+  bool tailSumsFlag = false;
+  bool tailSumsValid = false;
+  std::vector<RealType> tailSums;
+
+  // Complementary CDF getGumbelVariance works from
+  std::vector<RealType> gumbelCompCDF;
+
+  // Sites (sorted) whose outflow the next step records, fluxes[i] gets the
+  // particles that leave fluxSites[i] for the site after it. Only
+  // evolveAndSaveFirstPassageQuantile sets them, to move the quantile fronts
+  // without summing the occupancy again.
+  std::vector<unsigned long int> fluxSites;
+  std::vector<RealType> fluxes;
+
+  void buildTailSums();
+  // Sum of occupancy[idx..maxEdge], idx anywhere
+  RealType tailSum(const unsigned long int idx);
+  // Largest index with tailSum(idx) >= threshold
+  unsigned long int tailSumIndex(const RealType threshold);
+
+  template <class URNG>
+  RealType toNextSite(RealType currentSite, RealType bias, URNG &rng, EngineStats &rangeStats);
   double generateBeta();
 
+  // Check every site a step touches, off by default since it's a branch (and
+  // a few compares) per site in the hot loop
+  bool debugChecks = false;
+  void checkSite(const RealType &occ, const RealType &toNextSite, const RealType &prevOcc, const double bias);
+
+  RealType updateRange(const unsigned long int first,
+                       const unsigned long int last,
+                       RealType *firstOut,
+                       std::vector<double> &blockBiases,
+                       std::vector<RealType> &blockMoved,
+                       BetaSampler &sampler,
+                       CounterRNG *siteGen,
+                       EngineStats &rangeStats);
+  template <bool probDist, bool debug>
+  RealType updateRangeKernel(const unsigned long int first,
+                             const unsigned long int last,
+                             RealType *firstOut,
+                             std::vector<double> &blockBiases,
+                             std::vector<RealType> &blockMoved,
+                             BetaSampler &sampler,
+                             CounterRNG *siteGen,
+                             EngineStats &rangeStats);
+
 public:
   DiffusionPDF(const RealType _nParticles,
             const double _beta,
             const unsigned long int _occupancySize,
-            const bool _probDistFlag = true);
+            const bool _probDistFlag = true,
+            const bool _windowFlag = false,
+            const std::string _storageDirectory = "");
   ~DiffusionPDF(){};
 
   RealType getNParticles() { return nParticles; };
 
-  double getBeta() { return betaParams.beta(); };
+  double getBeta() { return beta; };
 
   void setProbDistFlag(bool _probDistFlag) { ProbDistFlag = _probDistFlag; };
   bool getProbDistFlag() { return ProbDistFlag; };
 
+  // Bounds check every site on every step and throw if one is off
+  void setDebugChecks(const bool _debugChecks) { debugChecks = _debugChecks; };
+  bool getDebugChecks() { return debugChecks; };
+
+  // Counters and per phase seconds since the start or the last reset, see
+  // Stats/counters.h. Empty when built with RWRE_NO_STATS.
+  std::map<std::string, double> getStats() { return stats.get(); };
+  void resetStats() { stats.reset(); };
+  // Print the stats every steps steps, 0 (the default) for never
+  void setStatsLogInterval(const unsigned long int steps) { stats.setLogInterval(steps); };
+  unsigned long int getStatsLogInterval() { return stats.getLogInterval(); };
+
+  // With window storage the occupancy starts at site getOccupancyOffset()
   void setOccupancy(const std::vector<RealType> _occupancy)
   {
-    occupancy = _occupancy;
+    occupancyViews.check("setOccupancy");
+    occupancy.assign(_occupancy.begin(), _occupancy.end());
+    tailSumsValid = false;
+  };
+  std::vector<RealType> getOccupancy() { return std::vector<RealType>(occupancy.begin(), occupancy.end()); };
+  unsigned long int getOccupancyOffset() { return occupancyOffset; };
+  // The buffers themselves, for sharing with numpy without a copy. Only the
+  // full storage occupancy stays put during the steps, and the bindings count
+  // the numpy views of it in getOccupancyViews() (IO/numpyView.h).
+  const storage::Vector<RealType> &viewOccupancy() { return occupancy; };
+  storage::Views &getOccupancyViews() { return occupancyViews; };
+  const std::pair<storage::Vector<unsigned long int>, storage::Vector<unsigned long int>> &viewEdges()
+  {
+    return edges;
   };
-  std::vector<RealType> getOccupancy() { return occupancy; };
+  // Empty when the occupancy and edges are on the heap
+  std::string getStorageDirectory() { return occupancy.get_allocator().getDirectory(); };
   unsigned long int getOccupancySize() { return occupancySize; };
 
   std::vector<RealType> getSaveOccupancy();
   std::pair<std::vector<unsigned long int>, std::vector<unsigned long int> > getSaveEdges();
 
   void resizeOccupancyAndEdges(unsigned long int size) {
-    occupancy.insert(occupancy.end(), size, RealType(0));
-    edges.first.insert(edges.first.end(), size, 0);
-    edges.second.insert(edges.second.end(), size, 0);
+    // Window storage grows as it goes
+    if (!windowFlag) {
+      occupancyViews.check("resizeOccupancyAndEdges");
+      occupancy.insert(occupancy.end(), size, RealType(0));
+      edges.first.insert(edges.first.end(), size, 0);
+      edges.second.insert(edges.second.end(), size, 0);
+    }
     occupancySize += size;
+    tailSumsValid = false;
   };
 
-  void setBetaSeed(const unsigned int seed) { gen.seed(seed); };
+  bool getWindowStorage() { return windowFlag; };
+  // Switch storage in place. Going back to full storage needs the whole edge
+  // history.
+  void setWindowStorage(const bool _windowFlag);
+
+  // Keep at least the last edgeHistoryLength edges with window storage (0
+  // keeps all of them). Older entries are dropped in batches.
+  void setEdgeHistoryLength(const unsigned long int _edgeHistoryLength)
+  {
+    edgeHistoryLength = _edgeHistoryLength;
+  };
+  unsigned long int getEdgeHistoryLength() { return edgeHistoryLength; };
+  // Time of the first stored edge
+  unsigned long int getEdgesOffset() { return edgesOffset; };
+
+  void setBetaSeed(const unsigned int seed)
+  {
+    gen.seed(seed);
+    counterGen.setSeed(seed);
+  };
+
+  void setCounterRNG(const bool _counterRNG) { counterRNG = _counterRNG; };
+  bool getCounterRNG() { return counterRNG; };
+
+  void setNumThreads(const unsigned int _numThreads)
+  {
+    if (_numThreads == 0) {
+      throw std::runtime_error("Number of threads must be at least 1");
+    }
+    numThreads = _numThreads;
+    pool.reset(numThreads > 1 ? new ThreadPool(numThreads) : nullptr);
+  };
+  unsigned int getNumThreads() { return numThreads; };
+
+  // Bias at site idx going from time _time to _time+1 with the counter RNG
+  double getBias(const unsigned long int _time, const unsigned long int idx);
 
   unsigned long int getTime() { return time; };
 
-  void setTime(const unsigned long int _time) { time = _time; };
+  void setTime(const unsigned long int _time)
+  {
+    time = _time;
+    tailSumsValid = false;
+  };
 
   std::pair<std::vector<unsigned long int>, std::vector<unsigned long int> >
   getEdges()
   {
-    return edges;
+    return std::make_pair(std::vector<unsigned long int>(edges.first.begin(), edges.first.end()),
+                          std::vector<unsigned long int>(edges.second.begin(), edges.second.end()));
   };
 
+  // With window storage the edges start at time getEdgesOffset()
   void setEdges(std::pair<std::vector<unsigned long int>, std::vector<unsigned long int> > _edges){
-    edges = _edges;
+    edges.first.assign(_edges.first.begin(), _edges.first.end());
+    edges.second.assign(_edges.second.begin(), _edges.second.end());
+    tailSumsValid = false;
   }
 
-  unsigned long int getMaxIdx(){ return edges.second[time]; };
-  unsigned long int getMinIdx(){ return edges.first[time]; };
+  unsigned long int getMaxIdx(){ return edges.second[time - edgesOffset]; };
+  unsigned long int getMinIdx(){ return edges.first[time - edgesOffset]; };
 
   double getSmallCutoff() { return smallCutoff; };
-  void setSmallCutoff(const double _smallCutoff) { smallCutoff = _smallCutoff; };
+  void setSmallCutoff(const double _smallCutoff){
+    // Past 2^53 the counts aren't whole numbers in a double
+    if (_smallCutoff > 9007199254740992.0) {
+      throw std::runtime_error("smallCutoff can be at most 2^53");
+    }
+    smallCutoff = _smallCutoff;
+  }
 
   double getLargeCutoff() { return largeCutoff; };
   void setLargeCutoff(const double _largeCutoff) { largeCutoff = _largeCutoff; };
 
   void iterateTimestep();
+  void evolveToTime(const unsigned long int _time);
+  void evolveTimesteps(const unsigned long int num);
+
+  // Answer pGreaterThanX, getPbAtV and the quantile searches from the tail
+  // sums instead of summing the occupancy on every call. pGreaterThanX then
+  // adds in a different order so can differ from the plain sum by rounding.
+  void setTailSums(const bool _tailSumsFlag)
+  {
+    tailSumsFlag = _tailSumsFlag;
+    tailSumsValid = false;
+  };
+  bool getTailSums() { return tailSumsFlag; };
 
   double findQuantile(const RealType quantile);
   std::vector<double> findQuantiles(std::vector<RealType> quantiles);
 
   RealType pGreaterThanX(const unsigned long int idx);
 
+  // Probability of being at or past x = v * time
+  RealType getPbAtV(const double v);
+
   std::pair<std::vector<double>, std::vector<RealType>>
   calcVsAndPb(const unsigned long int num);
 
   std::pair<std::vector<double>, std::vector<RealType>> VsAndPb(const double v);
 
+  // First time the max or min edge is at least positions[i] from the origin
+  // (x = 2 * idx - time). Evolves until every position is reached or the
+  // edges run out, positions never reached get 0.
+  std::vector<unsigned long int> evolveAndSaveFirstPassage(std::vector<unsigned long int> positions);
+
+  // times[i][j] is the first time the quantiles[j] position (x = 2 *
+  // findQuantile) is at least positions[i], with 0 if it never got there.
   std::vector<std::vector<unsigned long int> > evolveAndSaveFirstPassageQuantile(
     std::vector<unsigned long int> positions,
     std::vector<RealType> quantiles);
 
   RealType getGumbelVariance(RealType maxParticle);
+  std::vector<RealType> getGumbelVariance(std::vector<RealType> maxParticles);
+
+  // The quantiles, Pb at the velocities and Gumbel variances in one pass down
+  // from the max edge, see Stats/measurement.h
+  Measurement<RealType, double> measure(const MeasurementPlan<RealType> &plan);
+
   std::vector<RealType> getCDF();
+  // Sites getxvals_and_pdf covers are [first - 1, second]
+  std::pair<unsigned long int, unsigned long int> pdfRange();
   std::pair<std::vector<long int>, std::vector<RealType> > getxvals_and_pdf();
 
+  // Binary checkpoint of the whole state, see IO/checkpoint.h. Loading also
+  // puts back the storage mode and edge history length it was saved with.
+  void saveCheckpoint(const std::string &fileName);
+  void loadCheckpoint(const std::string &fileName);
+
+  // Copy the state into a staging buffer and write it to fileName on a
+  // background thread, so the pause is only the copy. A second call waits for
+  // the first write. Must be waited for before the process exits.
+  void saveCheckpointAsync(const std::string &fileName);
+  // Block until the background write is done, throwing if it failed
+  void waitForCheckpoint() { asyncCheckpoint.wait(); };
+  bool checkpointPending() { return asyncCheckpoint.pending(); };
+
 };
 
+// Constuctor
+template <class RealType>
+DiffusionPDF<RealType>::DiffusionPDF(const RealType _nParticles,
+                     const double _beta,
+                     const unsigned long int _occupancySize,
+                     const bool _ProbDistFlag,
+                     const bool _windowFlag,
+                     const std::string _storageDirectory)
+    : occupancy(storage::Allocator<RealType>(_storageDirectory)), nParticles(_nParticles), beta(_beta),
+    occupancySize(_occupancySize), ProbDistFlag(_ProbDistFlag),
+    betaSampler(_beta), biases(biasBlockSize), moved(biasBlockSize),
+    edges(storage::Vector<unsigned long int>(storage::Allocator<unsigned long int>(_storageDirectory)),
+          storage::Vector<unsigned long int>(storage::Allocator<unsigned long int>(_storageDirectory))),
+    windowFlag(_windowFlag)
+{
+  if (isnan(nParticles) || isinf(nParticles)){
+    throw std::runtime_error("Number of particles initialized to NaN");
+  }
+  if (windowFlag) {
+    edges.first.assign(1, 0), edges.second.assign(1, 0);
+    occupancy.resize(minWindowSize);
+  }
+  else {
+    edges.first.resize(_occupancySize + 1), edges.second.resize(_occupancySize + 1);
+    edges.first[0] = 0, edges.second[0] = 0;
+    occupancy.resize(_occupancySize + 1);
+  }
+  occupancy[0] = nParticles;
+
+  unsigned int seed = rd();
+  gen.seed(seed);
+  counterGen.setSeed(seed);
+
+  time = 0;
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionPDF<RealType>::getSaveOccupancy(){
+  return slice(occupancy, getMinIdx() - occupancyOffset, getMaxIdx() - occupancyOffset);
+}
+
+template <class RealType>
+std::pair<std::vector<unsigned long int>, std::vector<unsigned long int> > DiffusionPDF<RealType>::getSaveEdges(){
+  std::vector<unsigned long int> minEdge = slice(edges.first, 0, time - edgesOffset);
+  std::vector<unsigned long int> maxEdge = slice(edges.second, 0, time - edgesOffset);
+  return std::make_pair(minEdge, maxEdge);
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::reserveWindow(const unsigned long int first, const unsigned long int last)
+{
+  if (first >= occupancyOffset && last - occupancyOffset < occupancy.size()) {
+    return;
+  }
+  storage::Vector<RealType> window(std::max<unsigned long int>(2 * (last - first + 1), minWindowSize), RealType(0),
+                                   occupancy.get_allocator());
+  unsigned long int copyFirst = std::max(first, occupancyOffset);
+  unsigned long int copyLast = std::min(last, occupancyOffset + occupancy.size() - 1);
+  for (unsigned long int i = copyFirst; i <= copyLast; i++) {
+    window[i - first] = occupancy[i - occupancyOffset];
+  }
+  occupancy.swap(window);
+  occupancyOffset = first;
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::pushEdges(const unsigned long int minEdge, const unsigned long int maxEdge)
+{
+  if (!windowFlag) {
+    edges.first[time + 1] = minEdge;
+    edges.second[time + 1] = maxEdge;
+    return;
+  }
+  edges.first.push_back(minEdge);
+  edges.second.push_back(maxEdge);
+  // Trim once there are twice as many as asked for so it's amortized O(1)
+  if (edgeHistoryLength && edges.first.size() >= 2 * edgeHistoryLength) {
+    unsigned long int drop = edges.first.size() - edgeHistoryLength;
+    edges.first.erase(edges.first.begin(), edges.first.begin() + drop);
+    edges.second.erase(edges.second.begin(), edges.second.begin() + drop);
+    edgesOffset += drop;
+  }
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::setWindowStorage(const bool _windowFlag)
+{
+  if (_windowFlag == windowFlag) {
+    return;
+  }
+  occupancyViews.check("setWindowStorage");
+  unsigned long int minIdx = getMinIdx();
+  unsigned long int maxIdx = getMaxIdx();
+
+  if (_windowFlag) {
+    storage::Vector<RealType> window(std::max<unsigned long int>(2 * (maxIdx - minIdx + 1), minWindowSize), RealType(0),
+                                     occupancy.get_allocator());
+    for (unsigned long int i = minIdx; i <= maxIdx; i++) {
+      window[i - minIdx] = site(i);
+    }
+    occupancy.swap(window);
+    occupancyOffset = minIdx;
+    edges.first.resize(time + 1);
+    edges.second.resize(time + 1);
+  }
+  else {
+    if (edgesOffset != 0) {
+      throw std::runtime_error("Can't go back to full storage, edges before time " +
+                               std::to_string(edgesOffset) + " were dropped");
+    }
+    storage::Vector<RealType> full(std::max(occupancySize, maxIdx) + 1, RealType(0), occupancy.get_allocator());
+    for (unsigned long int i = minIdx; i <= maxIdx; i++) {
+      full[i] = site(i);
+    }
+    occupancy.swap(full);
+    occupancyOffset = 0;
+    edges.first.resize(std::max(occupancySize, time) + 1, 0);
+    edges.second.resize(std::max(occupancySize, time) + 1, 0);
+  }
+  windowFlag = _windowFlag;
+  tailSumsValid = false;
+}
+
+template <class RealType>
+template <class URNG>
+RealType DiffusionPDF<RealType>::toNextSite(RealType currentSite, RealType bias, URNG &rng, EngineStats &rangeStats)
+{
+  // Only the discrete particle kernel gets here, with the probability
+  // distribution it's just number of particles * bias
+
+  // Exact binomial below smallCutoff (the sampler itself is exact up to 2^53).
+  // Need to downcast currentSite to double. And then cast answer to RealType.
+  if (currentSite < smallCutoff) {
+    rangeStats.add(stats::BinomialDraws, 1);
+    return RealType(binomial(rng, double(currentSite), double(bias)));
+  }
+
+  else if (currentSite > largeCutoff) {
+    rangeStats.add(stats::MeanMoves, 1);
+    return (currentSite * bias);
+  }
+  // If less than largeCutoff use the Gaussian approximation
+  // N * p + sqrt(N * p * (1-p)) * randn, kept inside [0, N]
+  else {
+    rangeStats.add(stats::GaussianDraws, 1);
+    RealType mean = currentSite * bias;
+    RealType mediumVariance = sqrt(mean * (1 - bias));
+    RealType moved = mean + mediumVariance * RealType(binomial.normal(rng));
+    if (moved < 0) {
+      return 0;
+    }
+    if (moved > currentSite) {
+      return currentSite;
+    }
+    return moved;
+  }
+}
+
+template <class RealType>
+double DiffusionPDF<RealType>::generateBeta()
+{
+  return betaSampler(gen);
+}
+
+template <class RealType>
+double DiffusionPDF<RealType>::getBias(const unsigned long int _time, const unsigned long int idx)
+{
+  double bias;
+  betaSampler.fillSites(counterGen, _time, idx, &bias, 1);
+  return bias;
+}
+
+/*
+Moves the particles on sites [first, last] one step. Each site only needs what
+flowed out of the site to its left, which is carried along as fromLastSite.
+Returns the particles that flowed out of last into last + 1.
+
+If firstOut is given the first site is left alone and what leaves it is
+stored there instead, so the caller can stitch it onto the particles coming
+in from the chunk to its left. If siteGen is null everything is drawn from gen
+in order.
+*/
+template <class RealType>
+RealType DiffusionPDF<RealType>::updateRange(const unsigned long int first,
+                                             const unsigned long int last,
+                                             RealType *firstOut,
+                                             std::vector<double> &blockBiases,
+                                             std::vector<RealType> &blockMoved,
+                                             BetaSampler &sampler,
+                                             CounterRNG *siteGen,
+                                             EngineStats &rangeStats)
+{
+  // Pick the kernel once for the whole range so the loop over sites doesn't
+  // test the mode or the debug flag
+  if (ProbDistFlag) {
+    if (debugChecks) {
+      return updateRangeKernel<true, true>(first, last, firstOut, blockBiases, blockMoved, sampler, siteGen,
+                                           rangeStats);
+    }
+    return updateRangeKernel<true, false>(first, last, firstOut, blockBiases, blockMoved, sampler, siteGen,
+                                          rangeStats);
+  }
+  if (debugChecks) {
+    return updateRangeKernel<false, true>(first, last, firstOut, blockBiases, blockMoved, sampler, siteGen,
+                                          rangeStats);
+  }
+  return updateRangeKernel<false, false>(first, last, firstOut, blockBiases, blockMoved, sampler, siteGen,
+                                         rangeStats);
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::checkSite(const RealType &occ,
+                                       const RealType &toNextSite,
+                                       const RealType &prevOcc,
+                                       const double bias)
+{
+  if (toNextSite < 0 || toNextSite > prevOcc || bias < 0.0 || bias > 1.0 ||
+      occ < 0 || occ > nParticles || isnan(occ)) {
+    std::cout << "Time:" << time << "\n";
+    std::cout << "Occupancy: " << occ << "\n";
+    std::cout << "Next site: "  << toNextSite << "\n";
+    std::cout << "Bias: "  << bias << std::endl;
+    throw std::runtime_error("One or more variables out of bounds: ");
+  }
+}
+
+/*
+The beta class is already resolved by BetaSampler once per block of biases,
+so within a block the probability distribution kernel is two straight loops
+over raw pointers: what every site sends on, then the update from it and from
+the site to the left. Both vectorize for a hardware RealType. An empty site
+sends 0 * bias = 0, the same as skipping it. The discrete kernel draws per
+occupied site so stays a scalar loop, but without the mode test.
+
+Either way the sites and the random numbers are gone through in the same
+order as a single loop would, so the result doesn't depend on the kernel.
+*/
+template <class RealType>
+template <bool probDist, bool debug>
+RealType DiffusionPDF<RealType>::updateRangeKernel(const unsigned long int first,
+                                                   const unsigned long int last,
+                                                   RealType *firstOut,
+                                                   std::vector<double> &blockBiases,
+                                                   std::vector<RealType> &blockMoved,
+                                                   BetaSampler &sampler,
+                                                   CounterRNG *siteGen,
+                                                   EngineStats &rangeStats)
+{
+  unsigned long int prevMaxIndex = getMaxIdx();
+  if (debug && (first < occupancyOffset || last - occupancyOffset >= occupancy.size())) {
+    throw std::runtime_error("Sites " + std::to_string(first) + " to " + std::to_string(last) +
+                             " aren't all stored");
+  }
+  // iterateTimestep has made sure [first, last] is stored
+  RealType *occ = occupancy.data() + (first - occupancyOffset);
+  storage::Prefetch<RealType> prefetch(occupancy, first - occupancyOffset, last - occupancyOffset);
+  std::size_t nextFlux = std::lower_bound(fluxSites.begin(), fluxSites.end(), first) - fluxSites.begin();
+
+  RealType fromLastSite = 0;
+
+  // Biases are drawn a block at a time for every site in [first,
+  // prevMaxIndex]. Empty sites inside the window just don't use theirs.
+  unsigned long int blockStart = first;
+  unsigned long int sitesEnd = std::min<unsigned long int>(prevMaxIndex, last) + 1;
+  while (blockStart < sitesEnd) {
+    unsigned long int num = std::min<unsigned long int>(blockBiases.size(), sitesEnd - blockStart);
+    const double *b = blockBiases.data();
+    prefetch.reach(blockStart - occupancyOffset);
+    EngineStats::Clock::time_point phaseStart = EngineStats::now();
+    if (siteGen) {
+      sampler.fillSites(*siteGen, time, blockStart, blockBiases.data(), num);
+    }
+    else {
+      sampler.fill(gen, blockBiases.data(), num);
+    }
+    rangeStats.add(stats::BiasDraws, num);
+    rangeStats.addTime(stats::RNGTime, phaseStart);
+    phaseStart = EngineStats::now();
+
+    RealType *blockOcc = occ + (blockStart - first);
+    RealType *out = blockMoved.data();
+    if (probDist) {
+      for (unsigned long int j = 0; j < num; j++) {
+        out[j] = blockOcc[j] * RealType(b[j]);
+      }
+    }
+    else {
+      for (unsigned long int j = 0; j < num; j++) {
+        if (blockOcc[j] == 0) {
+          out[j] = 0;
+          continue;
+        }
+        RealType bias = RealType(b[j]);
+        if (siteGen) {
+          // Particles moving use their own stream so they don't shift the bias
+          siteGen->setPosition(time, blockStart + j, 1);
+          out[j] = round(DiffusionPDF::toNextSite(blockOcc[j], bias, *siteGen, rangeStats));
+        }
+        else {
+          out[j] = round(DiffusionPDF::toNextSite(blockOcc[j], bias, gen, rangeStats));
+        }
+      }
+    }
+
+    // Every chunk records the sites in its own range, so no two write the same
+    // entry. Sites past the old max edge send nothing and stay at 0.
+    while (nextFlux < fluxSites.size() && fluxSites[nextFlux] < blockStart + num) {
+      fluxes[nextFlux] = out[fluxSites[nextFlux] - blockStart];
+      nextFlux += 1;
+    }
+
+    if (debug) {
+      for (unsigned long int j = 0; j < num; j++) {
+        RealType prevOcc = blockOcc[j];
+        RealType in = (j == 0) ? fromLastSite : out[j - 1];
+        RealType next = (blockStart + j == first && firstOut) ? prevOcc : prevOcc + (in - out[j]);
+        checkSite(next, out[j], prevOcc, (prevOcc == 0) ? 0 : b[j]);
+      }
+    }
+
+    // The first site of a chunk is left to the caller
+    if (blockStart == first && firstOut) {
+      *firstOut = out[0];
+    }
+    else {
+      blockOcc[0] += fromLastSite - out[0];
+    }
+    for (unsigned long int j = 1; j < num; j++) {
+      blockOcc[j] += out[j - 1] - out[j];
+    }
+    fromLastSite = out[num - 1];
+    blockStart += num;
+    rangeStats.addTime(stats::UpdateTime, phaseStart);
+  }
+
+  // Sites past the old max edge are empty and only take in
+  for (unsigned long int i = sitesEnd; i <= last; i++) {
+    RealType *emptySite = occ + (i - first);
+    if (i == first && firstOut) {
+      *firstOut = 0;
+    }
+    else {
+      *emptySite += fromLastSite;
+    }
+    if (debug) {
+      checkSite(*emptySite, 0, 0, 0);
+    }
+    fromLastSite = 0;
+  }
+  return fromLastSite;
+}
+
+/*
+With more than one thread (and the counter RNG) the window [prevMinIndex,
+prevMaxIndex + 1] is cut into contiguous chunks which are swept at the same
+time. Every chunk but the first holds back the update of its first site, and
+afterwards those get occ += (in from the left chunk) - (out of the site) which
+is exactly the operation the serial sweep does. Since every random number
+only depends on (seed, time, site) the result is bit for bit the same as the
+serial step.
+*/
+template <class RealType>
+void DiffusionPDF<RealType>::iterateTimestep()
+{
+  EngineStats::Clock::time_point stepStart = EngineStats::now();
+  unsigned long int prevMinIndex = getMinIdx();
+  unsigned long int prevMaxIndex = getMaxIdx();
+  if (prevMinIndex > prevMaxIndex) {
+    throw std::runtime_error(
+        "Minimum edge must be greater than maximum edge: (" +
+        std::to_string(prevMinIndex) + ", " + std::to_string(prevMaxIndex) +
+        ")");
+  }
+
+  if (windowFlag) {
+    reserveWindow(prevMinIndex, prevMaxIndex + 1);
+  }
+  // If iterating over the whole array extend the occupancy. Doubling it like
+  // reserveWindow does keeps this amortized O(1) when it was set too short.
+  else if ((prevMaxIndex + 1) == occupancy.size()) {
+    occupancyViews.check("Growing the occupancy");
+    occupancy.resize(std::max<unsigned long int>(2 * occupancy.size(), minWindowSize), RealType(0));
+    stats.add(stats::OccupancyGrowths, 1);
+  }
+
+  unsigned long int numSites = prevMaxIndex + 2 - prevMinIndex;
+  unsigned long int numChunks = 1;
+  if (pool && counterRNG) {
+    numChunks = std::min<unsigned long int>(pool->size(), numSites / minSitesPerThread);
+  }
+
+  if (numChunks <= 1) {
+    updateRange(prevMinIndex, prevMaxIndex + 1, nullptr, biases, moved, betaSampler,
+                counterRNG ? &counterGen : nullptr, stats);
+  }
+  else {
+    if (chunkBiases.size() < numChunks) {
+      chunkBiases.resize(numChunks, std::vector<double>(biasBlockSize));
+      chunkMoved.resize(numChunks, std::vector<RealType>(biasBlockSize));
+    }
+    chunkFirstOut.resize(numChunks);
+    chunkLastOut.resize(numChunks);
+    chunkStats.assign(numChunks, EngineStats());
+
+    pool->parallelFor(numChunks, [&](std::size_t c) {
+      unsigned long int first = prevMinIndex + c * numSites / numChunks;
+      unsigned long int last = prevMinIndex + (c + 1) * numSites / numChunks - 1;
+      CounterRNG siteGen(counterGen.getSeed());
+      BetaSampler sampler = betaSampler;
+      chunkLastOut[c] = updateRange(first, last, (c == 0) ? nullptr : &chunkFirstOut[c],
+                                    chunkBiases[c], chunkMoved[c], sampler, &siteGen, chunkStats[c]);
+    });
+    for (unsigned long int c = 0; c < numChunks; c++) {
+      stats.merge(chunkStats[c]);
+    }
+
+    for (unsigned long int c = 1; c < numChunks; c++) {
+      RealType *occ = &site(prevMinIndex + c * numSites / numChunks);
+      *occ += chunkLastOut[c - 1] - chunkFirstOut[c];
+      if (debugChecks && (*occ < 0 || *occ > nParticles || isnan(*occ))) {
+        std::cout << "Time:" << time << "\n";
+        std::cout << "Occupancy: " << *occ << std::endl;
+        throw std::runtime_error("One or more variables out of bounds: ");
+      }
+    }
+  }
+
+  // New edges are the outermost nonzero sites of the window
+  EngineStats::Clock::time_point edgeStart = EngineStats::now();
+  unsigned long int minEdge = prevMinIndex;
+  unsigned long int maxEdge = prevMaxIndex + 1;
+  while (minEdge <= maxEdge && site(minEdge) == 0) {
+    minEdge++;
+  }
+  if (minEdge > maxEdge) {
+    minEdge = 0;
+    maxEdge = 0;
+  }
+  else {
+    while (site(maxEdge) == 0) {
+      maxEdge--;
+    }
+  }
+
+  pushEdges(minEdge, maxEdge);
+  stats.addTime(stats::EdgeTime, edgeStart);
+  time += 1;
+  tailSumsValid = false;
+  stats.addTime(stats::StepTime, stepStart);
+  stats.step(time, numSites);
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::evolveToTime(const unsigned long int _time)
+{
+  // Edges are only allocated up to occupancySize so can't go past that
+  if (_time > occupancySize) {
+    throw std::runtime_error("Cannot iterate past the size of the edges: " +
+                             std::to_string(occupancySize));
+  }
+  while (time < _time) {
+    iterateTimestep();
+  }
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::evolveTimesteps(const unsigned long int num)
+{
+  evolveToTime(time + num);
+}
+
+/*
+The algorithm just looks at the sum of the occupancy up to some position maxIdx.
+The position of the Nth quartile then happens when the condition
+sum > nParticles / quantile.
+*/
+template <class RealType>
+double DiffusionPDF<RealType>::findQuantile(const RealType quantile)
+{
+  if (tailSumsFlag) {
+    return tailSumIndex(nParticles / quantile) - time * 0.5;
+  }
+
+  unsigned long int maxIdx = getMaxIdx();
+  double centerIdx = time * 0.5;
+
+  double dist = maxIdx - centerIdx;
+  RealType sum = site(maxIdx);
+  while (sum < nParticles / quantile) {
+    maxIdx -= 1;
+    dist -= 1;
+    sum += site(maxIdx);
+  }
+  return dist;
+}
+
+/*
+The algorithm just looks at the sum of the occupancy up to some position maxIdx.
+The position of the Nth quartile then happens when the condition
+sum > nParticles / quantile.
+*/
+template <class RealType>
+std::vector<double> DiffusionPDF<RealType>::findQuantiles(std::vector<RealType> quantiles)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::QuantileCalls, 1);
+
+  // Need Quantiles in descending order for algorithm to work correctly
+  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+
+  std::vector<double> dists(quantiles.size());
+
+  if (tailSumsFlag) {
+    for (unsigned long int i = 0; i < quantiles.size(); i++) {
+      dists[i] = tailSumIndex(nParticles / quantiles[i]) - time * 0.5;
+    }
+    stats.addTime(stats::QuantileTime, start);
+    return dists;
+  }
+
+  unsigned long int maxIdx = getMaxIdx();
+  double centerIdx = time * 0.5;
+  double dist = maxIdx - centerIdx;
+  RealType sum = site(maxIdx);
+
+  unsigned long int quantiles_idx = 0;
+  while (quantiles_idx < quantiles.size()){
+    while (sum < nParticles / quantiles[quantiles_idx]){
+      maxIdx -= 1;
+      dist -= 1;
+      sum += site(maxIdx);
+    }
+    dists[quantiles_idx] = dist;
+    quantiles_idx += 1;
+  }
+  stats.addTime(stats::QuantileTime, start);
+  return dists;
+}
+
+template <class RealType>
+RealType DiffusionPDF<RealType>::pGreaterThanX(const unsigned long int idx)
+{
+  if (tailSumsFlag) {
+    return tailSum(idx) / nParticles;
+  }
+
+  RealType Nabove = 0.0;
+  for (unsigned long int j = idx; j <= time; j++) {
+    Nabove += siteOrZero(j);
+  }
+  return Nabove / nParticles;
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::buildTailSums()
+{
+  unsigned long int minIdx = getMinIdx();
+  unsigned long int maxIdx = getMaxIdx();
+  tailSums.resize(maxIdx - minIdx + 1);
+
+  RealType sum = 0;
+  for (unsigned long int i = maxIdx + 1; i-- > minIdx;) {
+    sum += site(i);
+    tailSums[i - minIdx] = sum;
+  }
+  tailSumsValid = true;
+}
+
+template <class RealType>
+RealType DiffusionPDF<RealType>::tailSum(const unsigned long int idx)
+{
+  if (!tailSumsValid) {
+    buildTailSums();
+  }
+  // Everything outside the edges is empty
+  unsigned long int minIdx = getMinIdx();
+  if (idx > getMaxIdx()) {
+    return 0;
+  }
+  return tailSums[(idx < minIdx) ? 0 : idx - minIdx];
+}
+
+template <class RealType>
+unsigned long int DiffusionPDF<RealType>::tailSumIndex(const RealType threshold)
+{
+  if (!tailSumsValid) {
+    buildTailSums();
+  }
+  // tailSums doesn't increase going right (sums of non negative numbers only
+  // grow, even rounded), so the sites with sum >= threshold are a prefix
+  auto end = std::partition_point(tailSums.begin(), tailSums.end(),
+                                  [&](const RealType &sum) { return sum >= threshold; });
+  if (end == tailSums.begin()) {
+    throw std::runtime_error("Quantile is past the edge of the occupancy");
+  }
+  return getMinIdx() + (end - tailSums.begin()) - 1;
+}
+
+template <class RealType>
+RealType DiffusionPDF<RealType>::getPbAtV(const double v)
+{
+  // x = 2 * idx - time so the first site at or past v * time is
+  double idx = ceil((1 + v) * time / 2.);
+  if (idx > time) {
+    return 0;
+  }
+  return pGreaterThanX((idx < 0) ? 0 : (unsigned long int)idx);
+}
+
+template <class RealType>
+std::pair<std::vector<double>, std::vector<RealType>>
+DiffusionPDF<RealType>::calcVsAndPb(const unsigned long int num)
+{
+  std::vector<double> vs;
+  std::vector<RealType> Pbs;
+  unsigned long int maxIdx = getMaxIdx();
+  RealType Nabove = 0.0;
+  for (unsigned long int i = maxIdx; i > (maxIdx - num); i--) {
+    Nabove += siteOrZero(i);
+    RealType probAbove = Nabove / nParticles;
+    double v = (2. * i - time) / time;
+    vs.push_back(v);
+    Pbs.push_back(probAbove);
+  }
+  std::pair<std::vector<double>, std::vector<RealType>> returnTuple(vs, Pbs);
+  return returnTuple;
+}
+
+template <class RealType>
+std::pair<std::vector<double>, std::vector<RealType>>
+DiffusionPDF<RealType>::VsAndPb(const double v)
+{
+  std::vector<double> vs;
+  std::vector<RealType> Pbs;
+  unsigned long int idx = getMaxIdx();
+  RealType Nabove = 0.0;
+  double currentV = (2. * idx - time) / time;
+  while (currentV >= v) {
+    Nabove += siteOrZero(idx);
+    RealType probAbove = Nabove / nParticles;
+    vs.push_back(currentV);
+    Pbs.push_back(probAbove);
+
+    idx -= 1;
+    currentV = (2. * idx - time) / time;
+  }
+  std::pair<std::vector<double>, std::vector<RealType>> returnTuple(vs, Pbs);
+  return returnTuple;
+}
+
+template <class RealType>
+std::vector<unsigned long int>
+DiffusionPDF<RealType>::evolveAndSaveFirstPassage(std::vector<unsigned long int> positions)
+{
+  // Visit the positions from closest to furthest, the edges only reach one
+  // more site per step so a step can pass several at once
+  std::vector<unsigned long int> order(positions.size());
+  for (unsigned long int i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](unsigned long int a, unsigned long int b) {
+    return positions[a] < positions[b];
+  });
+
+  std::vector<unsigned long int> times(positions.size(), 0);
+  unsigned long int next = 0;
+  while (next < order.size() && time < occupancySize) {
+    iterateTimestep();
+    long int maxPosition = 2 * (long int)getMaxIdx() - (long int)time;
+    long int minPosition = 2 * (long int)getMinIdx() - (long int)time;
+    long int furthest = std::max(maxPosition, -minPosition);
+    while (next < order.size() && furthest >= (long int)positions[order[next]]) {
+      times[order[next]] = time;
+      next += 1;
+    }
+  }
+  return times;
+}
+
+/*
+Particles only ever hop one index to the right, so the number at or past a
+site never goes down and a quantile's index never moves left, moving at most
+one site a step. A quantile's front is found once with a pass down from the
+max edge like findQuantiles. After that it keeps its front and the sum at and
+above it: a step adds exactly what flowed out of the site below the front,
+which the step kernel records for those sites (fluxSites), and the front
+then moves up while the sum above the next site is still enough. So a step
+costs O(1) per quantile that still has a position to reach on top of the
+step itself, rather than a pass over the distance to the lowest front.
+
+The sums are updated rather than taken again from the top, so with the
+probability distribution they can differ from findQuantiles' by rounding
+(the discrete counts are whole numbers and come out exact below 2^53).
+*/
+template <class RealType>
+std::vector<std::vector<unsigned long int> > DiffusionPDF<RealType>::evolveAndSaveFirstPassageQuantile(
+    std::vector<unsigned long int> positions,
+    std::vector<RealType> quantiles)
+{
+  std::vector<std::vector<unsigned long int> > times(
+      positions.size(), std::vector<unsigned long int>(quantiles.size(), 0));
+
+  std::vector<unsigned long int> positionOrder(positions.size());
+  for (unsigned long int i = 0; i < positionOrder.size(); i++) {
+    positionOrder[i] = i;
+  }
+  std::sort(positionOrder.begin(), positionOrder.end(), [&](unsigned long int a, unsigned long int b) {
+    return positions[a] < positions[b];
+  });
+
+  // Largest quantile (rightmost front) first so one pass down finds them all
+  std::vector<unsigned long int> quantileOrder(quantiles.size());
+  for (unsigned long int j = 0; j < quantileOrder.size(); j++) {
+    quantileOrder[j] = j;
+  }
+  std::sort(quantileOrder.begin(), quantileOrder.end(), [&](unsigned long int a, unsigned long int b) {
+    return quantiles[a] > quantiles[b];
+  });
+
+  std::vector<RealType> thresholds(quantiles.size());
+  for (unsigned long int j = 0; j < quantiles.size(); j++) {
+    thresholds[j] = nParticles / quantiles[j];
+  }
+
+  // Next position (in positionOrder) each quantile is waiting to reach.
+  // active is quantileOrder without the positions that are all reached.
+  std::vector<unsigned long int> next(quantiles.size(), 0);
+  std::vector<unsigned long int> active = positions.empty() ? std::vector<unsigned long int>() : quantileOrder;
+
+  // Front of each quantile and the sum of the occupancy at and above it, once
+  // it's been found
+  std::vector<unsigned long int> front(quantiles.size(), 0);
+  std::vector<RealType> frontSum(quantiles.size(), RealType(0));
+  std::vector<bool> found(quantiles.size(), false);
+
+  while (!active.empty() && time < occupancySize) {
+    fluxSites.clear();
+    for (auto &j : active) {
+      if (found[j] && front[j] > 0) {
+        fluxSites.push_back(front[j] - 1);
+      }
+    }
+    std::sort(fluxSites.begin(), fluxSites.end());
+    fluxes.assign(fluxSites.size(), RealType(0));
+
+    iterateTimestep();
+
+    unsigned long int maxIdx = getMaxIdx();
+    // The pass down for the fronts that aren't found yet
+    unsigned long int idx = maxIdx;
+    RealType sum = siteOrZero(idx);
+    std::vector<unsigned long int> stillActive;
+    for (auto &j : active) {
+      if (found[j]) {
+        if (front[j] > 0) {
+          auto watched = std::lower_bound(fluxSites.begin(), fluxSites.end(), front[j] - 1);
+          frontSum[j] += fluxes[watched - fluxSites.begin()];
+        }
+        while (front[j] < maxIdx) {
+          RealType above = frontSum[j] - siteOrZero(front[j]);
+          if (above < thresholds[j]) {
+            break;
+          }
+          frontSum[j] = above;
+          front[j] += 1;
+        }
+      }
+      else {
+        while (sum < thresholds[j] && idx > getMinIdx()) {
+          idx -= 1;
+          sum += site(idx);
+        }
+        if (sum < thresholds[j]) {
+          // Rounding left less than nParticles / quantile in the whole array,
+          // the smaller quantiles after this one don't have a position either
+          stillActive.push_back(j);
+          continue;
+        }
+        front[j] = idx;
+        frontSum[j] = sum;
+        found[j] = true;
+      }
+      long int x = 2 * (long int)front[j] - (long int)time;
+      while (next[j] < positions.size() && x >= (long int)positions[positionOrder[next[j]]]) {
+        times[positionOrder[next[j]]][j] = time;
+        next[j] += 1;
+      }
+      if (next[j] < positions.size()) {
+        stillActive.push_back(j);
+      }
+    }
+    active.swap(stillActive);
+  }
+  fluxSites.clear();
+  fluxes.clear();
+  return times;
+}
+
+template <class RealType>
+Measurement<RealType, double> DiffusionPDF<RealType>::measure(const MeasurementPlan<RealType> &plan)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::QuantileCalls, !plan.quantiles.empty());
+  stats.add(stats::GumbelCalls, !plan.nParticles.empty());
+  Measurement<RealType, double> result;
+  result.quantiles.resize(plan.quantiles.size());
+  result.pb.assign(plan.velocities.size(), RealType(0));
+
+  // Quantiles from the largest (first reached) down
+  std::vector<unsigned long int> quantileOrder(plan.quantiles.size());
+  for (unsigned long int i = 0; i < quantileOrder.size(); i++) {
+    quantileOrder[i] = i;
+  }
+  std::sort(quantileOrder.begin(), quantileOrder.end(), [&](unsigned long int a, unsigned long int b) {
+    return plan.quantiles[a] > plan.quantiles[b];
+  });
+  std::vector<RealType> quantileSums(quantileOrder.size());
+  for (unsigned long int i = 0; i < quantileOrder.size(); i++) {
+    quantileSums[i] = nParticles / plan.quantiles[quantileOrder[i]];
+  }
+
+  // Pb is the sum from its site up, sites past the max edge are left at 0
+  unsigned long int maxIdx = getMaxIdx();
+  unsigned long int minIdx = getMinIdx();
+  std::vector<std::pair<unsigned long int, unsigned long int>> pbSites;
+  for (unsigned long int i = 0; i < plan.velocities.size(); i++) {
+    double idx = ceil((1 + plan.velocities[i]) * time / 2.);
+    if (idx <= time && idx <= maxIdx) {
+      pbSites.push_back(std::make_pair((idx < 0) ? 0 : (unsigned long int)idx, i));
+    }
+  }
+  std::sort(pbSites.begin(), pbSites.end(), std::greater<std::pair<unsigned long int, unsigned long int>>());
+
+  DescendingGumbelVariance<RealType> gumbel(plan.nParticles, 2 * (long int)maxIdx - (long int)time, nParticles);
+  unsigned long int nextQuantile = 0;
+  unsigned long int nextPb = 0;
+  RealType sum = 0;
+  for (unsigned long int i = maxIdx + 1; i-- > minIdx;) {
+    if (nextQuantile == quantileOrder.size() && nextPb == pbSites.size() && gumbel.done()) {
+      break;
+    }
+    sum += site(i);
+    while (nextQuantile < quantileOrder.size() && sum >= quantileSums[nextQuantile]) {
+      result.quantiles[quantileOrder[nextQuantile]] = i - time * 0.5;
+      nextQuantile += 1;
+    }
+    while (nextPb < pbSites.size() && pbSites[nextPb].first >= i) {
+      result.pb[pbSites[nextPb].second] = sum / nParticles;
+      nextPb += 1;
+    }
+    if (!gumbel.done()) {
+      gumbel.add(2 * (long int)i - (long int)time, sum);
+    }
+  }
+  if (nextQuantile < quantileOrder.size()) {
+    throw std::runtime_error("Quantile is past the edge of the occupancy");
+  }
+  // Below the min edge there's nothing more to add
+  for (; nextPb < pbSites.size(); nextPb++) {
+    result.pb[pbSites[nextPb].second] = sum / nParticles;
+  }
+  result.gumbelVariance = gumbel.variances();
+  // The whole pass counts as query time
+  stats.addTime(stats::QuantileTime, start);
+  return result;
+}
+
+template <class RealType>
+std::pair<unsigned long int, unsigned long int> DiffusionPDF<RealType>::pdfRange(){
+  unsigned long int minIdx = getMinIdx();
+  unsigned long int maxIdx = getMaxIdx();
+
+  if (minIdx == 0){
+    minIdx += 1;
+  }
+
+  if (!windowFlag && maxIdx == occupancy.size()-1){
+    maxIdx -= 1;
+  }
+  return std::make_pair(minIdx, maxIdx);
+}
+
+template <class RealType>
+std::pair<std::vector<long int>, std::vector<RealType> > DiffusionPDF<RealType>::getxvals_and_pdf(){
+  std::pair<unsigned long int, unsigned long int> range = pdfRange();
+  unsigned long int minIdx = range.first;
+  unsigned long int maxIdx = range.second;
+
+  std::vector<long int> xvals(maxIdx - minIdx + 2);
+  std::vector<RealType> pdf(maxIdx - minIdx + 2);
+
+  for (unsigned long int i=minIdx-1; i <= maxIdx; i++){
+    xvals.at(i-minIdx+1) = 2 * i - time;
+    pdf.at(i-minIdx+1) = siteOrZero(i);
+  }
+  return std::make_pair(xvals, pdf);
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionPDF<RealType>::getCDF(){
+  std::pair<std::vector<long int>, std::vector<RealType> > pair = getxvals_and_pdf();
+  std::vector<RealType> pdf = pair.second;
+  return pdf_to_comp_cdf(pdf, nParticles);
+}
+
+template <class RealType>
+RealType DiffusionPDF<RealType>::getGumbelVariance(RealType maxParticle)
+{
+  return getGumbelVariance(std::vector<RealType>(1, maxParticle))[0];
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionPDF<RealType>::getGumbelVariance(std::vector<RealType> maxParticles)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::GumbelCalls, 1);
+  // Same complementary CDF as pdf_to_comp_cdf(getxvals_and_pdf()), built in
+  // a buffer that's kept between calls
+  std::pair<unsigned long int, unsigned long int> range = pdfRange();
+  gumbelCompCDF.resize(range.second - range.first + 3);
+  gumbelCompCDF[0] = 1;
+  RealType sum = 0;
+  for (unsigned long int i = range.first - 1; i <= range.second; i++) {
+    sum += siteOrZero(i);
+    gumbelCompCDF[i - range.first + 2] = 1.0 - sum / nParticles;
+  }
+  long int x0 = 2 * (long int)(range.first - 1) - (long int)time;
+  auto compCDF = [&](unsigned long int i) { return gumbelCompCDF[i]; };
+  std::vector<RealType> vars = gumbelVarianceFused(compCDF, gumbelCompCDF.size() - 1, x0, maxParticles);
+  stats.addTime(stats::GumbelTime, start);
+  return vars;
+}
+
+template <class RealType>
+template <class Sink>
+void DiffusionPDF<RealType>::writeCheckpoint(Sink &writer)
+{
+  checkpoint::Header header = checkpoint::makeHeader<RealType>(checkpoint::PDF);
+  header.time = time;
+  header.beta = beta;
+  header.size = occupancySize;
+  // What full storage would allocate, window storage only saves the band anyway
+  header.bufferLength = windowFlag ? std::max<uint64_t>(occupancySize + 1, occupancyOffset + occupancy.size())
+                                   : occupancy.size();
+  header.seed = counterGen.getSeed();
+  header.counterRNG = counterRNG;
+  header.probDistFlag = ProbDistFlag;
+  header.smallCutoff = smallCutoff;
+  header.largeCutoff = largeCutoff;
+
+  std::ostringstream rngState;
+  rngState << gen;
+  std::string state = rngState.str();
+
+  writer.write(&header, sizeof(header));
+  header.rngStateBytes = state.size();
+  header.rngStateOffset = writer.write(state.data(), state.size());
+
+  // Edges past time haven't been filled in yet
+  header.edgesFirstTime = edgesOffset;
+  header.edgesLength = time + 1 - edgesOffset;
+  header.windowStorage = windowFlag;
+  header.edgeHistoryLength = edgeHistoryLength;
+  writer.align(sizeof(uint64_t));
+  header.edgesOffset = writer.write(edges.first.data(), header.edgesLength * sizeof(unsigned long int));
+  writer.write(edges.second.data(), header.edgesLength * sizeof(unsigned long int));
+
+  header.nParticlesOffset = writer.write(&nParticles, sizeof(RealType));
+
+  // Only the occupied window, everything else is 0
+  writer.align(checkpoint::dataAlignment);
+  header.dataFirst = getMinIdx();
+  header.dataLength = getMaxIdx() - getMinIdx() + 1;
+  header.dataOffset = writer.write(&site(header.dataFirst), header.dataLength * sizeof(RealType));
+  writer.finish(header);
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::saveCheckpoint(const std::string &fileName)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  // Don't race a background write to the same file
+  asyncCheckpoint.wait();
+  checkpoint::Writer writer(fileName);
+  writeCheckpoint(writer);
+  stats.addTime(stats::CheckpointTime, start);
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::saveCheckpointAsync(const std::string &fileName)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  checkpoint::Buffer &buffer = asyncCheckpoint.stage();
+  writeCheckpoint(buffer);
+  asyncCheckpoint.start(fileName);
+  stats.addTime(stats::CheckpointTime, start);
+}
+
+template <class RealType>
+void DiffusionPDF<RealType>::loadCheckpoint(const std::string &fileName)
+{
+  static_assert(sizeof(unsigned long int) == sizeof(uint64_t), "Edges are saved as 64 bit");
+  asyncCheckpoint.wait();
+
+  occupancyViews.check("loadCheckpoint");
+
+  checkpoint::MappedFile map(fileName);
+  const checkpoint::Header &header = map.header();
+  checkpoint::checkHeader<RealType>(header, checkpoint::PDF, fileName);
+  uint64_t edgesFirstTime = checkpoint::edgesFirstTime(header);
+  if (header.dataFirst + header.dataLength > header.bufferLength ||
+      edgesFirstTime + header.edgesLength != header.time + 1 ||
+      header.time > header.size) {
+    throw std::runtime_error("Checkpoint data doesn't fit in its buffer: " + fileName);
+  }
+  // The checkpoint's storage mode wins over this object's. Files from before
+  // it was saved keep this object's, unless edges were dropped which only
+  // window storage does.
+  bool loadWindowFlag = windowFlag;
+  unsigned long int loadEdgeHistoryLength = edgeHistoryLength;
+  if (checkpoint::hasStorageMode(header)) {
+    loadWindowFlag = header.windowStorage;
+    loadEdgeHistoryLength = header.edgeHistoryLength;
+  }
+  else if (edgesFirstTime != 0) {
+    loadWindowFlag = true;
+  }
+  if (!loadWindowFlag && edgesFirstTime != 0) {
+    throw std::runtime_error("Checkpoint is full storage but only has the edges from time " +
+                             std::to_string(edgesFirstTime) + ": " + fileName);
+  }
+  // Check everything is in the file before changing anything
+  const char *state = map.at<char>(header.rngStateOffset, header.rngStateBytes);
+  const unsigned long int *savedEdges = map.at<unsigned long int>(header.edgesOffset, 2 * header.edgesLength);
+  const RealType *savedNParticles = map.at<RealType>(header.nParticlesOffset, 1);
+  const RealType *data = map.at<RealType>(header.dataOffset, header.dataLength);
+
+  beta = header.beta;
+  betaSampler = BetaSampler(beta);
+  time = header.time;
+  occupancySize = header.size;
+  counterGen.setSeed(header.seed);
+  counterRNG = header.counterRNG;
+  ProbDistFlag = header.probDistFlag;
+  smallCutoff = header.smallCutoff;
+  largeCutoff = header.largeCutoff;
+  windowFlag = loadWindowFlag;
+  edgeHistoryLength = loadEdgeHistoryLength;
+  checkpoint::copyTo(savedNParticles, 1, &nParticles);
+
+  std::istringstream rngState(std::string(state, header.rngStateBytes));
+  rngState >> gen;
+
+  unsigned long int edgesSize = windowFlag ? header.edgesLength : occupancySize + 1;
+  edges.first.assign(edgesSize, 0);
+  edges.second.assign(edgesSize, 0);
+  checkpoint::copyTo(savedEdges, header.edgesLength, edges.first.data());
+  checkpoint::copyTo(savedEdges + header.edgesLength, header.edgesLength, edges.second.data());
+  edgesOffset = edgesFirstTime;
+
+  if (windowFlag) {
+    occupancy.assign(std::max<unsigned long int>(2 * header.dataLength, minWindowSize), RealType(0));
+    occupancyOffset = header.dataFirst;
+  }
+  else {
+    occupancy.assign(header.bufferLength, RealType(0));
+    occupancyOffset = 0;
+  }
+  checkpoint::copyTo(data, header.dataLength, occupancy.data() + header.dataFirst - occupancyOffset);
+  tailSumsValid = false;
+}
+
 #endif /* DIFFUSIONPDF_HPP_ */
@@ -0,0 +1,502 @@
+#ifndef DIFFUSIONPDFREPLICAS_HPP_
+#define DIFFUSIONPDFREPLICAS_HPP_
+
+#include <boost/random.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <math.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Random/betaSampler.h"
+#include "../Random/binomialSampler.h"
+#include "../Random/philox.h"
+#include "../Stats/counters.h"
+#include "../Stats/measurement.h"
+#include "diffusionPDF.hpp"
+
+/*
+numReplicas discrete (ProbDistFlag = false) DiffusionPDF systems with their
+own nParticles in one random environment. Each step draws the bias of a site
+once and moves the particles of every replica with it, so the RNG cost of the
+environment is paid once instead of once per replica and runs at different N
+are paired by always seeing the same biases.
+
+The occupancies are stored interleaved per site, occupancy[(idx - offset) *
+numReplicas + k], in a window around the union of the occupied bands that
+grows like the window storage of DiffusionPDF. Every replica keeps its own
+edges, and a replica's sites outside its own edges are empty so cost a
+compare.
+
+What else is shared depends on the RNG:
+
+- Counter RNG: the biases and the particle draws. Both are keyed on (seed,
+  time, site) as in DiffusionPDF, and every replica draws its particle moves
+  at a site from the same key (stream 1), so the replicas share the particle
+  noise too. Replica k is bit for bit the DiffusionPDF with the same seed,
+  nParticles[k], ProbDistFlag = false and setCounterRNG(true).
+- Sequential gen: only the biases. The biases of a block come first and then
+  the particle draws in site order, replica by replica, each replica taking
+  its own draws from the one stream, so their particle noise is independent.
+  Only a single replica matches a DiffusionPDF.
+*/
+template <class RealType>
+class DiffusionPDFReplicas {
+private:
+  std::vector<RealType> occupancy;
+  unsigned long int occupancyOffset = 0;
+  std::vector<RealType> nParticles;
+  unsigned long int numReplicas;
+  double beta;
+  unsigned long int occupancySize;
+  double smallCutoff = pow(2, 31) - 2;
+  double largeCutoff = 1e64;
+  unsigned long int time = 0;
+
+  std::random_device rd;
+  boost::random::mt19937_64 gen;
+  CounterRNG counterGen;
+  bool counterRNG = false;
+
+  BinomialSampler binomial;
+  BetaSampler betaSampler;
+
+  // Biases for the current block of sites and what each replica sends from
+  // the site to its left
+  std::vector<double> biases;
+  std::vector<RealType> fromLastSite;
+
+  // Edges of replica k at every time so far
+  std::vector<std::pair<std::vector<unsigned long int>, std::vector<unsigned long int>>> edges;
+
+  EngineStats stats;
+
+  RealType &at(const unsigned long int idx, const unsigned long int k)
+  {
+    return occupancy[(idx - occupancyOffset) * numReplicas + k];
+  };
+  // Make sure the window holds sites [first, last]
+  void reserveWindow(const unsigned long int first, const unsigned long int last);
+  void checkReplica(const unsigned long int k);
+
+  // Same draw as DiffusionPDF::toNextSite
+  template <class URNG>
+  RealType toNextSite(RealType currentSite, RealType bias, URNG &rng);
+
+  Measurement<RealType, double> measureReplica(const unsigned long int k, const MeasurementPlan<RealType> &plan);
+
+public:
+  DiffusionPDFReplicas(const std::vector<RealType> _nParticles,
+                       const double _beta,
+                       const unsigned long int _occupancySize);
+
+  unsigned long int getNumReplicas() { return numReplicas; };
+  std::vector<RealType> getNParticles() { return nParticles; };
+  double getBeta() { return beta; };
+  unsigned long int getOccupancySize() { return occupancySize; };
+  unsigned long int getTime() { return time; };
+
+  void setBetaSeed(const unsigned int seed)
+  {
+    gen.seed(seed);
+    counterGen.setSeed(seed);
+  };
+
+  void setCounterRNG(const bool _counterRNG) { counterRNG = _counterRNG; };
+  bool getCounterRNG() { return counterRNG; };
+
+  double getSmallCutoff() { return smallCutoff; };
+  void setSmallCutoff(const double _smallCutoff)
+  {
+    // Past 2^53 the counts aren't whole numbers in a double
+    if (_smallCutoff > 9007199254740992.0) {
+      throw std::runtime_error("smallCutoff can be at most 2^53");
+    }
+    smallCutoff = _smallCutoff;
+  };
+
+  double getLargeCutoff() { return largeCutoff; };
+  void setLargeCutoff(const double _largeCutoff) { largeCutoff = _largeCutoff; };
+
+  // Counters and per phase seconds like DiffusionPDF::getStats
+  std::map<std::string, double> getStats() { return stats.get(); };
+  void resetStats() { stats.reset(); };
+
+  void iterateTimestep();
+  void evolveToTime(const unsigned long int _time);
+  void evolveTimesteps(const unsigned long int num);
+
+  unsigned long int getMinIdx(const unsigned long int k)
+  {
+    checkReplica(k);
+    return edges[k].first[time];
+  };
+  unsigned long int getMaxIdx(const unsigned long int k)
+  {
+    checkReplica(k);
+    return edges[k].second[time];
+  };
+
+  // Occupancy of replica k on sites [getMinIdx(k), getMaxIdx(k)]
+  std::vector<RealType> getSaveOccupancy(const unsigned long int k);
+  // Edges of replica k up to the current time
+  std::pair<std::vector<unsigned long int>, std::vector<unsigned long int>> getSaveEdges(const unsigned long int k);
+
+  // One entry per replica, each what DiffusionPDF::findQuantiles and getPbAtV
+  // (as with setTailSums) give for it. The Gumbel variances are measure's, so
+  // agree with DiffusionPDF::getGumbelVariance to rounding.
+  std::vector<std::vector<double>> findQuantiles(std::vector<RealType> quantiles);
+  std::vector<RealType> getPbAtV(const double v);
+  std::vector<std::vector<RealType>> getGumbelVariance(std::vector<RealType> maxParticles);
+
+  // DiffusionPDF::measure of every replica
+  std::vector<Measurement<RealType, double>> measure(const MeasurementPlan<RealType> &plan);
+};
+
+template <class RealType>
+DiffusionPDFReplicas<RealType>::DiffusionPDFReplicas(const std::vector<RealType> _nParticles,
+                                                     const double _beta,
+                                                     const unsigned long int _occupancySize)
+    : nParticles(_nParticles), numReplicas(_nParticles.size()), beta(_beta), occupancySize(_occupancySize),
+      betaSampler(_beta), biases(biasBlockSize)
+{
+  if (numReplicas == 0) {
+    throw std::runtime_error("Number of replicas must be at least 1");
+  }
+  for (auto &N : nParticles) {
+    if (isnan(N) || isinf(N)) {
+      throw std::runtime_error("Number of particles initialized to NaN");
+    }
+    // An empty replica would hold the window down at site 0
+    if (N <= 0) {
+      throw std::runtime_error("Number of particles must be positive");
+    }
+  }
+  occupancy.assign(minWindowSize * numReplicas, RealType(0));
+  for (unsigned long int k = 0; k < numReplicas; k++) {
+    at(0, k) = nParticles[k];
+  }
+  fromLastSite.resize(numReplicas);
+  edges.resize(numReplicas);
+  for (auto &e : edges) {
+    e.first.reserve(occupancySize + 1);
+    e.second.reserve(occupancySize + 1);
+    e.first.push_back(0);
+    e.second.push_back(0);
+  }
+
+  unsigned int seed = rd();
+  gen.seed(seed);
+  counterGen.setSeed(seed);
+}
+
+template <class RealType>
+void DiffusionPDFReplicas<RealType>::checkReplica(const unsigned long int k)
+{
+  if (k >= numReplicas) {
+    throw std::runtime_error("Replica out of range: " + std::to_string(k) +
+                             " (number of replicas " + std::to_string(numReplicas) + ")");
+  }
+}
+
+template <class RealType>
+void DiffusionPDFReplicas<RealType>::reserveWindow(const unsigned long int first, const unsigned long int last)
+{
+  unsigned long int numSites = occupancy.size() / numReplicas;
+  if (first >= occupancyOffset && last - occupancyOffset < numSites) {
+    return;
+  }
+  std::vector<RealType> window(std::max<unsigned long int>(2 * (last - first + 1), minWindowSize) * numReplicas,
+                               RealType(0));
+  unsigned long int copyFirst = std::max(first, occupancyOffset);
+  unsigned long int copyLast = std::min(last, occupancyOffset + numSites - 1);
+  if (copyFirst <= copyLast) {
+    std::copy(occupancy.begin() + (copyFirst - occupancyOffset) * numReplicas,
+              occupancy.begin() + (copyLast + 1 - occupancyOffset) * numReplicas,
+              window.begin() + (copyFirst - first) * numReplicas);
+  }
+  occupancy.swap(window);
+  occupancyOffset = first;
+}
+
+template <class RealType>
+template <class URNG>
+RealType DiffusionPDFReplicas<RealType>::toNextSite(RealType currentSite, RealType bias, URNG &rng)
+{
+  if (currentSite < smallCutoff) {
+    stats.add(stats::BinomialDraws, 1);
+    return RealType(binomial(rng, double(currentSite), double(bias)));
+  }
+  else if (currentSite > largeCutoff) {
+    stats.add(stats::MeanMoves, 1);
+    return (currentSite * bias);
+  }
+  else {
+    stats.add(stats::GaussianDraws, 1);
+    RealType mean = currentSite * bias;
+    RealType mediumVariance = sqrt(mean * (1 - bias));
+    RealType moved = mean + mediumVariance * RealType(binomial.normal(rng));
+    if (moved < 0) {
+      return 0;
+    }
+    if (moved > currentSite) {
+      return currentSite;
+    }
+    return moved;
+  }
+}
+
+/*
+One sweep up the union of the windows [min_k minEdge, max_k maxEdge + 1]. A
+block of biases is drawn for the sites below the highest max edge and every
+site then updates its replicas in a row, each carrying what flowed out of its
+site to the left like DiffusionPDF's kernel does.
+*/
+template <class RealType>
+void DiffusionPDFReplicas<RealType>::iterateTimestep()
+{
+  EngineStats::Clock::time_point stepStart = EngineStats::now();
+  const unsigned long int K = numReplicas;
+  unsigned long int prevMinIndex = edges[0].first[time];
+  unsigned long int prevMaxIndex = edges[0].second[time];
+  for (unsigned long int k = 1; k < K; k++) {
+    prevMinIndex = std::min(prevMinIndex, edges[k].first[time]);
+    prevMaxIndex = std::max(prevMaxIndex, edges[k].second[time]);
+  }
+  reserveWindow(prevMinIndex, prevMaxIndex + 1);
+  std::fill(fromLastSite.begin(), fromLastSite.end(), RealType(0));
+  RealType *in = fromLastSite.data();
+
+  for (unsigned long int blockStart = prevMinIndex; blockStart <= prevMaxIndex; blockStart += biases.size()) {
+    unsigned long int num = std::min<unsigned long int>(biases.size(), prevMaxIndex + 1 - blockStart);
+    EngineStats::Clock::time_point phaseStart = EngineStats::now();
+    if (counterRNG) {
+      betaSampler.fillSites(counterGen, time, blockStart, biases.data(), num);
+    }
+    else {
+      betaSampler.fill(gen, biases.data(), num);
+    }
+    stats.add(stats::BiasDraws, num);
+    stats.addTime(stats::RNGTime, phaseStart);
+    phaseStart = EngineStats::now();
+
+    for (unsigned long int j = 0; j < num; j++) {
+      RealType *site = &at(blockStart + j, 0);
+      RealType bias = RealType(biases[j]);
+      for (unsigned long int k = 0; k < K; k++) {
+        RealType out = 0;
+        if (site[k] != 0) {
+          if (counterRNG) {
+            // The stream DiffusionPDF moves particles on
+            counterGen.setPosition(time, blockStart + j, 1);
+            out = round(toNextSite(site[k], bias, counterGen));
+          }
+          else {
+            out = round(toNextSite(site[k], bias, gen));
+          }
+        }
+        // Same order of operations as DiffusionPDF so replica 0 matches it
+        site[k] += in[k] - out;
+        in[k] = out;
+      }
+    }
+    stats.addTime(stats::UpdateTime, phaseStart);
+  }
+
+  // The site past the highest max edge only takes in
+  RealType *top = &at(prevMaxIndex + 1, 0);
+  for (unsigned long int k = 0; k < K; k++) {
+    top[k] += in[k];
+  }
+
+  // New edges are the outermost nonzero sites each replica could have reached
+  EngineStats::Clock::time_point edgeStart = EngineStats::now();
+  for (unsigned long int k = 0; k < K; k++) {
+    unsigned long int minEdge = edges[k].first[time];
+    unsigned long int maxEdge = edges[k].second[time] + 1;
+    while (minEdge <= maxEdge && at(minEdge, k) == 0) {
+      minEdge++;
+    }
+    if (minEdge > maxEdge) {
+      minEdge = 0;
+      maxEdge = 0;
+    }
+    else {
+      while (at(maxEdge, k) == 0) {
+        maxEdge--;
+      }
+    }
+    edges[k].first.push_back(minEdge);
+    edges[k].second.push_back(maxEdge);
+  }
+  stats.addTime(stats::EdgeTime, edgeStart);
+  time += 1;
+  stats.addTime(stats::StepTime, stepStart);
+  stats.step(time, (prevMaxIndex + 2 - prevMinIndex) * K);
+}
+
+template <class RealType>
+void DiffusionPDFReplicas<RealType>::evolveToTime(const unsigned long int _time)
+{
+  if (_time > occupancySize) {
+    throw std::runtime_error("Cannot iterate past the size of the edges: " +
+                             std::to_string(occupancySize));
+  }
+  while (time < _time) {
+    iterateTimestep();
+  }
+}
+
+template <class RealType>
+void DiffusionPDFReplicas<RealType>::evolveTimesteps(const unsigned long int num)
+{
+  evolveToTime(time + num);
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionPDFReplicas<RealType>::getSaveOccupancy(const unsigned long int k)
+{
+  unsigned long int minIdx = getMinIdx(k);
+  unsigned long int maxIdx = getMaxIdx(k);
+  std::vector<RealType> replicaOccupancy(maxIdx - minIdx + 1);
+  for (unsigned long int i = minIdx; i <= maxIdx; i++) {
+    replicaOccupancy[i - minIdx] = at(i, k);
+  }
+  return replicaOccupancy;
+}
+
+template <class RealType>
+std::pair<std::vector<unsigned long int>, std::vector<unsigned long int>>
+DiffusionPDFReplicas<RealType>::getSaveEdges(const unsigned long int k)
+{
+  checkReplica(k);
+  return edges[k];
+}
+
+// The pass of DiffusionPDF::measure over replica k
+template <class RealType>
+Measurement<RealType, double> DiffusionPDFReplicas<RealType>::measureReplica(const unsigned long int k,
+                                                                             const MeasurementPlan<RealType> &plan)
+{
+  const RealType N = nParticles[k];
+  Measurement<RealType, double> result;
+  result.quantiles.resize(plan.quantiles.size());
+  result.pb.assign(plan.velocities.size(), RealType(0));
+
+  std::vector<unsigned long int> quantileOrder(plan.quantiles.size());
+  for (unsigned long int i = 0; i < quantileOrder.size(); i++) {
+    quantileOrder[i] = i;
+  }
+  std::sort(quantileOrder.begin(), quantileOrder.end(), [&](unsigned long int a, unsigned long int b) {
+    return plan.quantiles[a] > plan.quantiles[b];
+  });
+  std::vector<RealType> quantileSums(quantileOrder.size());
+  for (unsigned long int i = 0; i < quantileOrder.size(); i++) {
+    quantileSums[i] = N / plan.quantiles[quantileOrder[i]];
+  }
+
+  unsigned long int maxIdx = getMaxIdx(k);
+  unsigned long int minIdx = getMinIdx(k);
+  std::vector<std::pair<unsigned long int, unsigned long int>> pbSites;
+  for (unsigned long int i = 0; i < plan.velocities.size(); i++) {
+    double idx = ceil((1 + plan.velocities[i]) * time / 2.);
+    if (idx <= time && idx <= maxIdx) {
+      pbSites.push_back(std::make_pair((idx < 0) ? 0 : (unsigned long int)idx, i));
+    }
+  }
+  std::sort(pbSites.begin(), pbSites.end(), std::greater<std::pair<unsigned long int, unsigned long int>>());
+
+  DescendingGumbelVariance<RealType> gumbel(plan.nParticles, 2 * (long int)maxIdx - (long int)time, N);
+  unsigned long int nextQuantile = 0;
+  unsigned long int nextPb = 0;
+  RealType sum = 0;
+  for (unsigned long int i = maxIdx + 1; i-- > minIdx;) {
+    if (nextQuantile == quantileOrder.size() && nextPb == pbSites.size() && gumbel.done()) {
+      break;
+    }
+    sum += at(i, k);
+    while (nextQuantile < quantileOrder.size() && sum >= quantileSums[nextQuantile]) {
+      result.quantiles[quantileOrder[nextQuantile]] = i - time * 0.5;
+      nextQuantile += 1;
+    }
+    while (nextPb < pbSites.size() && pbSites[nextPb].first >= i) {
+      result.pb[pbSites[nextPb].second] = sum / N;
+      nextPb += 1;
+    }
+    if (!gumbel.done()) {
+      gumbel.add(2 * (long int)i - (long int)time, sum);
+    }
+  }
+  if (nextQuantile < quantileOrder.size()) {
+    throw std::runtime_error("Quantile is past the edge of the occupancy");
+  }
+  for (; nextPb < pbSites.size(); nextPb++) {
+    result.pb[pbSites[nextPb].second] = sum / N;
+  }
+  result.gumbelVariance = gumbel.variances();
+  return result;
+}
+
+template <class RealType>
+std::vector<Measurement<RealType, double>> DiffusionPDFReplicas<RealType>::measure(
+    const MeasurementPlan<RealType> &plan)
+{
+  EngineStats::Clock::time_point start = EngineStats::now();
+  stats.add(stats::QuantileCalls, !plan.quantiles.empty());
+  stats.add(stats::GumbelCalls, !plan.nParticles.empty());
+  std::vector<Measurement<RealType, double>> results(numReplicas);
+  for (unsigned long int k = 0; k < numReplicas; k++) {
+    results[k] = measureReplica(k, plan);
+  }
+  stats.addTime(stats::QuantileTime, start);
+  return results;
+}
+
+template <class RealType>
+std::vector<std::vector<double>> DiffusionPDFReplicas<RealType>::findQuantiles(std::vector<RealType> quantiles)
+{
+  // Descending like DiffusionPDF::findQuantiles
+  std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+  MeasurementPlan<RealType> plan;
+  plan.quantiles = quantiles;
+  std::vector<Measurement<RealType, double>> results = measure(plan);
+  std::vector<std::vector<double>> dists(numReplicas);
+  for (unsigned long int k = 0; k < numReplicas; k++) {
+    dists[k].swap(results[k].quantiles);
+  }
+  return dists;
+}
+
+template <class RealType>
+std::vector<RealType> DiffusionPDFReplicas<RealType>::getPbAtV(const double v)
+{
+  MeasurementPlan<RealType> plan;
+  plan.velocities.push_back(v);
+  std::vector<Measurement<RealType, double>> results = measure(plan);
+  std::vector<RealType> probs(numReplicas);
+  for (unsigned long int k = 0; k < numReplicas; k++) {
+    probs[k] = results[k].pb[0];
+  }
+  return probs;
+}
+
+template <class RealType>
+std::vector<std::vector<RealType>> DiffusionPDFReplicas<RealType>::getGumbelVariance(
+    std::vector<RealType> maxParticles)
+{
+  MeasurementPlan<RealType> plan;
+  plan.nParticles = maxParticles;
+  std::vector<Measurement<RealType, double>> results = measure(plan);
+  std::vector<std::vector<RealType>> vars(numReplicas);
+  for (unsigned long int k = 0; k < numReplicas; k++) {
+    vars[k].swap(results[k].gumbelVariance);
+  }
+  return vars;
+}
+
+#endif /* DIFFUSIONPDFREPLICAS_HPP_ */
@@ -1,46 +0,0 @@
-#pragma once
-
-// I think this is taken from:
-// pybind11.readthedocs.io/en/stable/advanced/cast/stl.html
-
-#include <pybind11/numpy.h>
-
-namespace pybind11
-{
-  namespace detail
-  {
-
-    template <typename T>
-    struct npy_scalar_caster
-    {
-      PYBIND11_TYPE_CASTER(T, _("PleaseOverride"));
-      using Array = array_t<T>;
-
-      bool load(handle src, bool convert)
-      {
-        // Taken from Eigen casters. Permits either scalar dtype or scalar array.
-        handle type = dtype::of<T>().attr("type"); // Could make more efficient.
-        if (!convert && !isinstance<Array>(src) && !isinstance(src, type))
-          return false;
-        Array tmp = Array::ensure(src);
-        if (tmp && tmp.size() == 1 && tmp.ndim() == 0)
-        {
-          this->value = *tmp.data();
-          return true;
-        }
-        return false;
-      }
-
-      static handle cast(T src, return_value_policy, handle)
-      {
-        Array tmp({1});
-        tmp.mutable_at(0) = src;
-        tmp.resize({});
-        // You could also just return the array if you want a scalar array.
-        object scalar = tmp[tuple()];
-        return scalar.release();
-      }
-    };
-
-  } // namespace detail
-} // namespace pybind11
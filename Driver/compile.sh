@@ -0,0 +1,3 @@
+#!/bin/bash
+c++ -O3 -march=native -Wall -std=gnu++11 -pthread rwre.cpp -I/c/modular-boost -lquadmath -o rwre
+mpicxx -O3 -march=native -Wall -std=gnu++11 -pthread rwreEnsemble.cpp -I/c/modular-boost -lquadmath -o rwreEnsemble
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <boost/multiprecision/float128.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../IO/config.h"
+#include "../IO/recorder.h"
+#include "../Scalars/doubleDouble.h"
+
+/*
+Config values the command line drivers share. Numbers for a RealType are
+parsed as quads so they're exact to the precision of any of the types, the
+save time schedule is the same saveTimes key for every driver.
+*/
+
+namespace driver
+{
+  using Quad = boost::multiprecision::float128;
+
+  template <class RealType>
+  RealType fromQuad(const Quad &x)
+  {
+    return static_cast<RealType>(x);
+  }
+
+  template <>
+  inline DoubleDouble fromQuad<DoubleDouble>(const Quad &x)
+  {
+    return DoubleDouble::fromReal(x);
+  }
+
+  template <class RealType>
+  RealType parseReal(const std::string &key, const std::string &value)
+  {
+    char *end;
+    Quad x = strtoflt128(value.c_str(), &end);
+    if (value.empty() || *end != '\0')
+    {
+      throw std::runtime_error("Config key " + key + " has " + value + ", which is not a number");
+    }
+    return fromQuad<RealType>(x);
+  }
+
+  template <class RealType>
+  std::vector<RealType> getReals(Config &config, const std::string &key)
+  {
+    std::vector<RealType> values;
+    for (auto &item : config.getList(key))
+    {
+      values.push_back(parseReal<RealType>(key, item));
+    }
+    return values;
+  }
+
+  inline std::vector<double> getDoubles(Config &config, const std::string &key)
+  {
+    std::vector<double> values;
+    for (auto &item : config.getList(key))
+    {
+      values.push_back(static_cast<double>(parseReal<Quad>(key, item)));
+    }
+    return values;
+  }
+
+  /*
+  "log first last num": num times spaced evenly in log between first and
+  last, rounded down (so fewer once they'd repeat). "linear first last
+  step": first, first + step, ... up to last. Anything else is a list.
+  */
+  inline std::vector<unsigned long int> getSaveTimes(Config &config)
+  {
+    std::vector<std::string> items = config.getList("saveTimes");
+    std::vector<unsigned long int> times;
+    if (items.empty())
+    {
+      throw std::runtime_error("saveTimes is empty");
+    }
+    auto number = [&](const std::string &item) {
+      double x = static_cast<double>(parseReal<Quad>("saveTimes", item));
+      if (x < 0 || x != floor(x))
+      {
+        throw std::runtime_error("Save time " + item + " is not a whole number >= 0");
+      }
+      return x;
+    };
+
+    if (items[0] == "log" || items[0] == "linear")
+    {
+      if (items.size() != 4)
+      {
+        throw std::runtime_error("saveTimes = " + items[0] + " takes 3 numbers");
+      }
+      double first = number(items[1]);
+      double last = number(items[2]);
+      double third = number(items[3]);
+      if (items[0] == "log")
+      {
+        if (first < 1 || last < first || third < 1)
+        {
+          throw std::runtime_error("saveTimes = log needs 1 <= first <= last and num >= 1");
+        }
+        for (double i = 0; i < third; i++)
+        {
+          // The last one exactly, pow can round it down a site
+          double t = (i == third - 1) ? last : first * pow(last / first, i / (third - 1));
+          times.push_back(floor(t));
+        }
+      }
+      else
+      {
+        if (last < first || third < 1)
+        {
+          throw std::runtime_error("saveTimes = linear needs first <= last and step >= 1");
+        }
+        for (double t = first; t <= last; t += third)
+        {
+          times.push_back(t);
+        }
+      }
+    }
+    else
+    {
+      for (auto &item : items)
+      {
+        times.push_back(number(item));
+      }
+    }
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+    return times;
+  }
+} // namespace driver
@@ -0,0 +1,257 @@
+#include <boost/multiprecision/float128.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "../DiffusionCDF/diffusionCDF.hpp"
+#include "../DiffusionPDF/diffusionPDF.hpp"
+#include "../IO/config.h"
+#include "../IO/recorder.h"
+#include "../Scalars/doubleDouble.h"
+#include "driver.h"
+
+/*
+Runs one system from a config file and records it, the same loop as
+evolveAndRecord in the Python wrappers but without Python on the node:
+
+  ./rwre run.cfg [key=value ...]
+
+Anything after the config overrides it, e.g. seed=$SLURM_ARRAY_TASK_ID
+output=Recording$SLURM_ARRAY_TASK_ID.bin. The output is the recorder format
+(IO/recorder.h), read it with fileIO.loadRecording.
+
+  engine = pdf                  # pdf (DiffusionPDF) or cdf (DiffusionTimeCDF)
+  type = f128                   # f64, f80, f128 or dd
+  beta = 1
+  tMax = 100000
+  nParticles = 1e24             # pdf only
+  saveTimes = log 1 100000 500  # also: linear first last step, or a list
+  output = Recording.bin
+
+Observables, each optional (the first three are measured together with
+measure):
+
+  quantiles = 1e10 1e20         # findQuantiles
+  velocities = 0.1 0.5          # getPbAtV
+  gumbelVariance = 1e10 1e20    # getGumbelVariance
+  maxEdge = true                # pdf only
+  probAndV = 1e10               # cdf only
+
+Settings, with their defaults:
+
+  seed = <random>, counterRNG = false, numThreads = 1, append = false,
+  flushRows = 1000, statsLogInterval = 0, storage = <none> (a directory to
+  map the state from when it doesn't fit in RAM, e.g. node local scratch)
+  pdf: probDist = true, window = false, tailSums = false, smallCutoff,
+       largeCutoff (the engine's defaults)
+  cdf: activeBand = false, bandTolerance = 0, wavefrontSteps = 1
+
+With checkpoint = <file> a run starts from that checkpoint if it exists,
+saves it every checkpointSeconds (default 3600) of wall time and at the end,
+and appends to output. The engine settings saved in the checkpoint, the PDF's
+window storage included, win over the config. Rows recorded after the last
+checkpoint are recorded again when a killed job is restarted, so drop repeated
+times when loading.
+
+Numbers in the observables and nParticles are parsed as quads, so they're
+exact to the precision of type. Build with compile.sh, add -static for a
+binary that runs on nodes without the libraries.
+*/
+
+namespace
+{
+  template <class RealType>
+  void addEngineObservers(Config &config, Recorder<DiffusionPDF<RealType>, RealType> &recorder)
+  {
+    if (config.getBool("maxEdge", false))
+    {
+      recorder.addMaxEdge();
+    }
+  }
+
+  template <class RealType>
+  void addEngineObservers(Config &config, Recorder<DiffusionTimeCDF<RealType>, RealType> &recorder)
+  {
+    if (config.has("probAndV"))
+    {
+      recorder.addProbAndV(driver::parseReal<RealType>("probAndV", config.getString("probAndV")));
+    }
+  }
+
+  // Everything after the system is constructed, which is the same for both
+  template <class System, class RealType>
+  void run(Config &config, System &system)
+  {
+    if (config.has("seed"))
+    {
+      system.setBetaSeed(config.getUnsigned("seed"));
+    }
+    system.setCounterRNG(config.getBool("counterRNG", false));
+    system.setNumThreads(config.getUnsigned("numThreads", 1));
+    system.setStatsLogInterval(config.getUnsigned("statsLogInterval", 0));
+
+    std::string checkpointFile = config.getString("checkpoint", "");
+    double checkpointSeconds = config.getDouble("checkpointSeconds", 3600);
+    bool resumed = false;
+    if (!checkpointFile.empty())
+    {
+      FILE *existing = fopen(checkpointFile.c_str(), "rb");
+      if (existing)
+      {
+        fclose(existing);
+        system.loadCheckpoint(checkpointFile);
+        resumed = true;
+        std::cout << "Resuming from " << checkpointFile << " at time " << system.getTime() << std::endl;
+      }
+    }
+
+    std::vector<unsigned long int> times = driver::getSaveTimes(config);
+    bool append = config.getBool("append", false) || resumed;
+    Recorder<System, RealType> recorder(config.getString("output"), append, config.getUnsigned("flushRows", 1000));
+    if (config.has("quantiles") || config.has("velocities") || config.has("gumbelVariance"))
+    {
+      // Same columns as adding them one at a time, measured in one pass
+      std::vector<RealType> quantiles, nParticles;
+      std::vector<double> velocities;
+      if (config.has("quantiles"))
+      {
+        quantiles = driver::getReals<RealType>(config, "quantiles");
+      }
+      if (config.has("velocities"))
+      {
+        velocities = driver::getDoubles(config, "velocities");
+      }
+      if (config.has("gumbelVariance"))
+      {
+        nParticles = driver::getReals<RealType>(config, "gumbelVariance");
+      }
+      recorder.addMeasurement(quantiles, velocities, nParticles);
+    }
+    addEngineObservers(config, recorder);
+    config.checkUsed();
+
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    for (auto &t : times)
+    {
+      // The row at the checkpoint's own time was recorded before it was saved
+      if (t < system.getTime() || (resumed && t == system.getTime()))
+      {
+        continue;
+      }
+      system.evolveToTime(t);
+      recorder.record(system);
+      if (!checkpointFile.empty() &&
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - lastCheckpoint).count() >= checkpointSeconds)
+      {
+        recorder.flush();
+        // Written in the background while the run carries on
+        system.saveCheckpointAsync(checkpointFile);
+        lastCheckpoint = std::chrono::steady_clock::now();
+      }
+    }
+    recorder.close();
+    if (!checkpointFile.empty())
+    {
+      // Waits for the last background save first
+      system.saveCheckpoint(checkpointFile);
+    }
+  }
+
+  template <class RealType>
+  void runPDF(Config &config)
+  {
+    unsigned long int tMax = config.getUnsigned("tMax");
+    DiffusionPDF<RealType> system(driver::parseReal<RealType>("nParticles", config.getString("nParticles")),
+                                  config.getDouble("beta"), tMax, config.getBool("probDist", true),
+                                  config.getBool("window", false), config.getString("storage", ""));
+    system.setTailSums(config.getBool("tailSums", false));
+    if (config.has("smallCutoff"))
+    {
+      system.setSmallCutoff(config.getDouble("smallCutoff"));
+    }
+    if (config.has("largeCutoff"))
+    {
+      system.setLargeCutoff(config.getDouble("largeCutoff"));
+    }
+    run<DiffusionPDF<RealType>, RealType>(config, system);
+  }
+
+  template <class RealType>
+  void runCDF(Config &config)
+  {
+    DiffusionTimeCDF<RealType> system(config.getDouble("beta"), config.getUnsigned("tMax"), config.getString("storage", ""));
+    system.setActiveBand(config.getBool("activeBand", false));
+    system.setBandTolerance(config.getDouble("bandTolerance", 0));
+    system.setWavefrontSteps(config.getUnsigned("wavefrontSteps", 1));
+    run<DiffusionTimeCDF<RealType>, RealType>(config, system);
+  }
+
+  template <class RealType>
+  void runEngine(Config &config)
+  {
+    std::string engine = config.getString("engine");
+    if (engine == "pdf")
+    {
+      runPDF<RealType>(config);
+    }
+    else if (engine == "cdf")
+    {
+      runCDF<RealType>(config);
+    }
+    else
+    {
+      throw std::runtime_error("engine must be pdf or cdf, not " + engine);
+    }
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: " << argv[0] << " config [key=value ...]" << std::endl;
+    return 2;
+  }
+  try
+  {
+    Config config = Config::fromFile(argv[1]);
+    for (int i = 2; i < argc; i++)
+    {
+      config.set(argv[i]);
+    }
+
+    std::string type = config.getString("type", "f128");
+    if (type == "f64")
+    {
+      runEngine<double>(config);
+    }
+    else if (type == "f80")
+    {
+      runEngine<long double>(config);
+    }
+    else if (type == "f128")
+    {
+      runEngine<driver::Quad>(config);
+    }
+    else if (type == "dd")
+    {
+      runEngine<DoubleDouble>(config);
+    }
+    else
+    {
+      throw std::runtime_error("type must be f64, f80, f128 or dd, not " + type);
+    }
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+#include <mpi.h>
+
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../DiffusionCDF/diffusionCDF.hpp"
+#include "../DiffusionEnsemble/diffusionEnsemble.hpp"
+#include "../DiffusionPDF/diffusionPDF.hpp"
+#include "../IO/config.h"
+#include "../IO/recorder.h"
+#include "../Parallel/mpiEnsemble.h"
+#include "driver.h"
+
+/*
+Runs a DiffusionEnsemble over MPI ranks and writes the means and variances
+of the observables at every save time to one recording from rank 0:
+
+  mpirun -n 256 ./rwreEnsemble ensemble.cfg [key=value ...]
+
+The config is the one rwre takes (see rwre.cpp) plus numSystems, for the
+keys that make sense for an ensemble:
+
+  engine, type, beta, tMax, nParticles (pdf), probDist (pdf), numSystems,
+  seed, counterRNG, numThreads (per rank), saveTimes, quantiles,
+  velocities, gumbelVariance, output, flushRows
+
+Realization i is seeded seed + i whatever the number of ranks. Without a seed
+rank 0 draws one and sends it to the others.
+
+The recording has a time column and then "<observable> mean" and
+"<observable> variance" for each quantile, Gumbel variance and velocity, in
+the order DiffusionEnsemble returns them. Read it with fileIO.loadRecording.
+*/
+
+namespace
+{
+  template <template <class> class Engine, class RealType>
+  void run(Config &config, DiffusionEnsemble<Engine, RealType> &ensemble, const int rank)
+  {
+    unsigned int seed = 0;
+    if (config.has("seed"))
+    {
+      seed = config.getUnsigned("seed");
+    }
+    else
+    {
+      if (rank == 0)
+      {
+        std::random_device rd;
+        seed = rd();
+      }
+      mpiEnsemble::check(MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD), "MPI_Bcast");
+    }
+    ensemble.setSeed(seed);
+    ensemble.setCounterRNG(config.getBool("counterRNG", false));
+    ensemble.setNumThreads(config.getUnsigned("numThreads", 1));
+    ensemble.setSaveTimes(driver::getSaveTimes(config));
+    ensemble.setQuantiles(driver::getReals<RealType>(config, "quantiles"));
+    ensemble.setGumbelNParticles(driver::getReals<RealType>(config, "gumbelVariance"));
+    ensemble.setVelocities(driver::getDoubles(config, "velocities"));
+    std::string output = config.getString("output");
+    unsigned long int flushRows = config.getUnsigned("flushRows", 1000);
+    config.checkUsed();
+
+    runMPIEnsemble(ensemble);
+    if (rank != 0)
+    {
+      return;
+    }
+
+    std::vector<std::string> columns = {"time"};
+    std::vector<std::vector<std::vector<RealType>>> moments;
+    auto addColumns = [&](const std::vector<std::string> &names,
+                          std::vector<std::vector<RealType>> mean,
+                          std::vector<std::vector<RealType>> variance) {
+      for (auto &name : names)
+      {
+        columns.push_back(name + " mean");
+        columns.push_back(name + " variance");
+      }
+      moments.push_back(mean);
+      moments.push_back(variance);
+    };
+
+    std::vector<std::string> names;
+    for (auto &q : ensemble.getQuantiles())
+    {
+      names.push_back("quantile " + recorder::toString(q));
+    }
+    addColumns(names, ensemble.getQuantileMean(), ensemble.getQuantileVariance());
+    names.clear();
+    for (auto &N : ensemble.getGumbelNParticles())
+    {
+      names.push_back("gumbelVariance " + recorder::toString(N));
+    }
+    addColumns(names, ensemble.getGumbelVarianceMean(), ensemble.getGumbelVarianceVariance());
+    names.clear();
+    for (auto &v : ensemble.getVelocities())
+    {
+      names.push_back("Pb " + recorder::toString(v));
+    }
+    addColumns(names, ensemble.getPbMean(), ensemble.getPbVariance());
+
+    RecordingFile<RealType> file(output, false, flushRows);
+    file.open(columns);
+    std::vector<unsigned long int> times = ensemble.getSaveTimes();
+    std::vector<RealType> row;
+    for (unsigned long int k = 0; k < times.size(); k++)
+    {
+      row.assign(1, RealType(times[k]));
+      // Mean and variance of each observable next to each other
+      for (unsigned long int m = 0; m < moments.size(); m += 2)
+      {
+        for (unsigned long int j = 0; j < moments[m][k].size(); j++)
+        {
+          row.push_back(moments[m][k][j]);
+          row.push_back(moments[m + 1][k][j]);
+        }
+      }
+      file.writeRow(row);
+    }
+    file.close();
+  }
+
+  template <class RealType>
+  void runEngine(Config &config, const int rank)
+  {
+    std::string engine = config.getString("engine");
+    unsigned long int numSystems = config.getUnsigned("numSystems");
+    if (engine == "pdf")
+    {
+      DiffusionEnsemble<DiffusionPDF, RealType> ensemble(
+          numSystems, driver::parseReal<RealType>("nParticles", config.getString("nParticles")),
+          config.getDouble("beta"), config.getUnsigned("tMax"), config.getBool("probDist", true));
+      run(config, ensemble, rank);
+    }
+    else if (engine == "cdf")
+    {
+      DiffusionEnsemble<DiffusionTimeCDF, RealType> ensemble(numSystems, config.getDouble("beta"),
+                                                             config.getUnsigned("tMax"));
+      run(config, ensemble, rank);
+    }
+    else
+    {
+      throw std::runtime_error("engine must be pdf or cdf, not " + engine);
+    }
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (argc < 2)
+  {
+    if (rank == 0)
+    {
+      std::cerr << "Usage: " << argv[0] << " config [key=value ...]" << std::endl;
+    }
+    MPI_Finalize();
+    return 2;
+  }
+  try
+  {
+    Config config = Config::fromFile(argv[1]);
+    for (int i = 2; i < argc; i++)
+    {
+      config.set(argv[i]);
+    }
+
+    std::string type = config.getString("type", "f128");
+    if (type == "f64")
+    {
+      runEngine<double>(config, rank);
+    }
+    else if (type == "f80")
+    {
+      runEngine<long double>(config, rank);
+    }
+    else if (type == "f128")
+    {
+      runEngine<driver::Quad>(config, rank);
+    }
+    else if (type == "dd")
+    {
+      runEngine<DoubleDouble>(config, rank);
+    }
+    else
+    {
+      throw std::runtime_error("type must be f64, f80, f128 or dd, not " + type);
+    }
+  }
+  catch (const std::exception &e)
+  {
+    // The other ranks would wait in the reduction forever
+    std::cerr << "Error on rank " << rank << ": " << e.what() << std::endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Binary checkpoint files for the engines. The layout is
+
+  checkpoint::Header | sections at the offsets stored in the header
+
+where every section is raw bytes exactly as they are in memory: the
+sequential RNG state (as the text boost writes for it), the edges (PDF only)
+and the occupancy / CDF, which starts on a 64 byte boundary. Nothing is parsed
+so writing is one pass of fwrite and loading is a memcpy out of a read only
+mmap of the file.
+
+The file is written to <fileName>.tmp and then renamed over fileName, so a job
+killed part way through a save still leaves the previous checkpoint intact.
+
+An AsyncWriter saves in the background instead: the engine lays the same file
+out in a Buffer in memory, which is only a copy of the occupied window, and a
+thread writes it out while the engine keeps evolving.
+
+Checkpoints are only meant to be read back on the same kind of machine
+(endianness and the layout of RealType aren't converted).
+*/
+
+namespace checkpoint
+{
+  constexpr char magic[8] = {'R', 'W', 'R', 'E', 'C', 'K', 'P', 'T'};
+  // Version 2 added edgesFirstTime and version 3 the storage mode, older
+  // files are still read
+  constexpr uint32_t version = 3;
+  constexpr uint64_t dataAlignment = 64;
+
+  enum Engine : uint32_t
+  {
+    TimeCDF = 0,
+    PDF = 1
+  };
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t engine;
+
+    // Checked on load so e.g. a long double file can't be read as float128
+    uint32_t scalarBytes;
+    int32_t scalarDigits;
+
+    uint64_t time;
+    double beta;
+    // tMax for the CDF, occupancySize for the PDF
+    uint64_t size;
+    // Number of elements the occupancy / CDF is allocated with
+    uint64_t bufferLength;
+
+    uint64_t seed;
+    uint32_t counterRNG;
+    uint32_t probDistFlag;
+    double smallCutoff;
+    double largeCutoff;
+
+    uint64_t rngStateOffset;
+    uint64_t rngStateBytes;
+
+    // Both edge lists have edgesLength entries, first then second
+    uint64_t edgesOffset;
+    uint64_t edgesLength;
+
+    uint64_t nParticlesOffset;
+
+    // Elements [dataFirst, dataFirst + dataLength) of the buffer
+    uint64_t dataOffset;
+    uint64_t dataFirst;
+    uint64_t dataLength;
+
+    // Time of the first saved edge (PDF window storage with a bounded edge
+    // history), use edgesFirstTime() to read it
+    uint64_t edgesFirstTime;
+
+    // How the PDF stored its occupancy and edges, only there if
+    // hasStorageMode()
+    uint64_t edgeHistoryLength;
+    uint32_t windowStorage;
+  };
+
+  inline uint64_t edgesFirstTime(const Header &header)
+  {
+    // Version 1 headers end before it, those bytes are the next section
+    return (header.version >= 2) ? header.edgesFirstTime : 0;
+  }
+
+  inline bool hasStorageMode(const Header &header)
+  {
+    return header.version >= 3;
+  }
+
+  // Tag the scalar type by its mantissa bits, types without numeric_limits
+  // (e.g. ScaledDouble) get 0
+  template <class RealType>
+  int32_t scalarDigits()
+  {
+    return std::numeric_limits<RealType>::digits;
+  }
+
+  template <class RealType>
+  Header makeHeader(const Engine engine)
+  {
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.engine = engine;
+    header.scalarBytes = sizeof(RealType);
+    header.scalarDigits = scalarDigits<RealType>();
+    return header;
+  }
+
+  class Writer
+  {
+  private:
+    std::string fileName;
+    std::string tmpName;
+    FILE *file;
+    uint64_t offset = 0;
+
+    void fail()
+    {
+      if (file)
+      {
+        fclose(file);
+        file = nullptr;
+      }
+      std::remove(tmpName.c_str());
+      throw std::runtime_error("Could not write checkpoint: " + fileName);
+    }
+
+  public:
+    Writer(const std::string &_fileName) : fileName(_fileName), tmpName(_fileName + ".tmp")
+    {
+      file = fopen(tmpName.c_str(), "wb");
+      if (!file)
+      {
+        throw std::runtime_error("Could not open checkpoint for writing: " + tmpName);
+      }
+    };
+
+    ~Writer()
+    {
+      if (file)
+      {
+        fclose(file);
+        std::remove(tmpName.c_str());
+      }
+    };
+
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    // Write bytes at the current end of the file and return where they went
+    uint64_t write(const void *data, const uint64_t bytes)
+    {
+      uint64_t start = offset;
+      if (bytes && fwrite(data, 1, bytes, file) != bytes)
+      {
+        fail();
+      }
+      offset += bytes;
+      return start;
+    };
+
+    void align(const uint64_t alignment)
+    {
+      static const char zeros[dataAlignment] = {};
+      uint64_t pad = (alignment - offset % alignment) % alignment;
+      write(zeros, pad);
+    };
+
+    // Write the header over the space reserved for it at the start and move
+    // the file into place
+    void finish(const Header &header)
+    {
+      if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)
+      {
+        fail();
+      }
+      if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+      {
+        fail();
+      }
+      if (fclose(file) != 0)
+      {
+        file = nullptr;
+        fail();
+      }
+      file = nullptr;
+      if (std::rename(tmpName.c_str(), fileName.c_str()) != 0)
+      {
+        std::remove(tmpName.c_str());
+        throw std::runtime_error("Could not move checkpoint into place: " + fileName);
+      }
+    };
+  };
+
+  // Stands in for a Writer to build the whole file in memory
+  class Buffer
+  {
+  private:
+    std::vector<char> bytes;
+
+  public:
+    uint64_t write(const void *data, const uint64_t count)
+    {
+      uint64_t start = bytes.size();
+      const char *in = static_cast<const char *>(data);
+      bytes.insert(bytes.end(), in, in + count);
+      return start;
+    };
+
+    void align(const uint64_t alignment)
+    {
+      bytes.resize(bytes.size() + (alignment - bytes.size() % alignment) % alignment, 0);
+    };
+
+    void finish(const Header &header) { std::memcpy(bytes.data(), &header, sizeof(header)); };
+
+    // Keeps the allocation so the next snapshot doesn't have to make it again
+    void clear() { bytes.clear(); };
+
+    const char *data() const { return bytes.data(); };
+    uint64_t size() const { return bytes.size(); };
+  };
+
+  /*
+  Writes one Buffer at a time on a background thread. stage() waits for the
+  write in progress, so the buffer the engine fills is never the one being
+  written, and a failed write is thrown from the next stage() or wait().
+  */
+  class AsyncWriter
+  {
+  private:
+    Buffer staging;
+    std::thread thread;
+    std::atomic<bool> busy{false};
+    std::exception_ptr error;
+
+  public:
+    AsyncWriter() = default;
+    ~AsyncWriter()
+    {
+      // Let a write that's started finish rather than leave a .tmp behind
+      if (thread.joinable())
+      {
+        thread.join();
+      }
+    };
+
+    AsyncWriter(const AsyncWriter &) = delete;
+    AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+    // Empty buffer to lay the next checkpoint out in
+    Buffer &stage()
+    {
+      wait();
+      staging.clear();
+      return staging;
+    };
+
+    // Write the staged buffer to fileName, the same way Writer does
+    void start(const std::string &fileName)
+    {
+      busy = true;
+      thread = std::thread([this, fileName]() {
+        try
+        {
+          Header header;
+          std::memcpy(&header, staging.data(), sizeof(header));
+          Writer writer(fileName);
+          writer.write(staging.data(), staging.size());
+          writer.finish(header);
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+        busy = false;
+      });
+    };
+
+    bool pending() const { return busy; };
+
+    void wait()
+    {
+      if (thread.joinable())
+      {
+        thread.join();
+      }
+      if (error)
+      {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+      }
+    };
+  };
+
+  // Read only memory map of a whole checkpoint file
+  class MappedFile
+  {
+  private:
+    std::string fileName;
+    int fd = -1;
+    void *data = MAP_FAILED;
+    uint64_t length = 0;
+
+  public:
+    MappedFile(const std::string &_fileName) : fileName(_fileName)
+    {
+      fd = open(fileName.c_str(), O_RDONLY);
+      if (fd < 0)
+      {
+        throw std::runtime_error("Could not open checkpoint: " + fileName);
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0)
+      {
+        close(fd);
+        throw std::runtime_error("Could not stat checkpoint: " + fileName);
+      }
+      length = st.st_size;
+      if (length < sizeof(Header))
+      {
+        close(fd);
+        throw std::runtime_error("Checkpoint is too short to have a header: " + fileName);
+      }
+      data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+      {
+        close(fd);
+        throw std::runtime_error("Could not mmap checkpoint: " + fileName);
+      }
+      // We read it through once front to back
+      madvise(data, length, MADV_SEQUENTIAL);
+    };
+
+    ~MappedFile()
+    {
+      if (data != MAP_FAILED)
+      {
+        munmap(data, length);
+      }
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    };
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const Header &header() const { return *static_cast<const Header *>(data); };
+
+    // Pointer to count elements of T at offset, checking they are in the file
+    template <class T>
+    const T *at(const uint64_t offset, const uint64_t count) const
+    {
+      if (offset > length || count > (length - offset) / sizeof(T))
+      {
+        throw std::runtime_error("Checkpoint is truncated: " + fileName);
+      }
+      return reinterpret_cast<const T *>(static_cast<const char *>(data) + offset);
+    };
+  };
+
+  template <class RealType>
+  void checkHeader(const Header &header, const Engine engine, const std::string &fileName)
+  {
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+    {
+      throw std::runtime_error("Not a checkpoint file: " + fileName);
+    }
+    if (header.version < 1 || header.version > version)
+    {
+      throw std::runtime_error("Unsupported checkpoint version " + std::to_string(header.version) +
+                               ": " + fileName);
+    }
+    if (header.engine != engine)
+    {
+      throw std::runtime_error("Checkpoint was saved from a different engine: " + fileName);
+    }
+    if (header.scalarBytes != sizeof(RealType) || header.scalarDigits != scalarDigits<RealType>())
+    {
+      throw std::runtime_error("Checkpoint was saved with a different RealType (" +
+                               std::to_string(header.scalarBytes) + " bytes, " +
+                               std::to_string(header.scalarDigits) + " digits): " + fileName);
+    }
+  }
+
+  template <class T>
+  void copyTo(const T *in, const uint64_t count, T *out)
+  {
+    std::memcpy(static_cast<void *>(out), static_cast<const void *>(in), count * sizeof(T));
+  }
+} // namespace checkpoint
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+Run configuration as key = value lines, e.g.
+
+  # Comments run to the end of the line
+  engine = pdf
+  beta = 1
+  quantiles = 1e10 1e20
+
+A value is everything after the first '=' with the whitespace around it
+trimmed, lists are separated by spaces or commas. set("key=value") overrides
+a key after the file is read, which is how command line arguments go on top
+of a shared config.
+
+Getters take a default for optional keys and throw for a missing required
+one. checkUsed() throws for keys nothing asked for, so a misspelt key is an
+error rather than silently ignored.
+*/
+
+class Config
+{
+private:
+  std::map<std::string, std::string> values;
+  std::set<std::string> used;
+  std::string source;
+
+  static std::string trim(const std::string &s)
+  {
+    const char *space = " \t\r\n";
+    std::size_t first = s.find_first_not_of(space);
+    if (first == std::string::npos)
+    {
+      return "";
+    }
+    return s.substr(first, s.find_last_not_of(space) - first + 1);
+  };
+
+  const std::string &lookup(const std::string &key)
+  {
+    auto it = values.find(key);
+    if (it == values.end())
+    {
+      throw std::runtime_error("Missing config key: " + key + " (" + source + ")");
+    }
+    used.insert(key);
+    return it->second;
+  };
+
+  std::runtime_error badValue(const std::string &key, const std::string &expected)
+  {
+    return std::runtime_error("Config key " + key + " = " + values[key] + " is not " + expected);
+  };
+
+public:
+  Config() : source("no file"){};
+
+  static Config fromFile(const std::string &fileName)
+  {
+    std::ifstream file(fileName);
+    if (!file)
+    {
+      throw std::runtime_error("Could not open config: " + fileName);
+    }
+    Config config;
+    config.source = fileName;
+    std::string line;
+    unsigned long int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+      lineNumber += 1;
+      line = trim(line.substr(0, line.find('#')));
+      if (line.empty())
+      {
+        continue;
+      }
+      if (line.find('=') == std::string::npos)
+      {
+        throw std::runtime_error("Expected key = value on line " + std::to_string(lineNumber) +
+                                 " of " + fileName);
+      }
+      config.set(line);
+    }
+    return config;
+  };
+
+  // "key=value", replaces an earlier value of key
+  void set(const std::string &assignment)
+  {
+    std::size_t eq = assignment.find('=');
+    std::string key = trim(assignment.substr(0, eq));
+    if (eq == std::string::npos || key.empty())
+    {
+      throw std::runtime_error("Expected key=value, got: " + assignment);
+    }
+    values[key] = trim(assignment.substr(eq + 1));
+  };
+
+  bool has(const std::string &key) { return values.count(key) > 0; };
+
+  std::string getString(const std::string &key) { return lookup(key); };
+  std::string getString(const std::string &key, const std::string &fallback)
+  {
+    return has(key) ? lookup(key) : fallback;
+  };
+
+  // Doubles so 1e6 works for an integer
+  double getDouble(const std::string &key)
+  {
+    const std::string &value = lookup(key);
+    char *end;
+    double x = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0')
+    {
+      throw badValue(key, "a number");
+    }
+    return x;
+  };
+  double getDouble(const std::string &key, const double fallback)
+  {
+    return has(key) ? getDouble(key) : fallback;
+  };
+
+  unsigned long int getUnsigned(const std::string &key)
+  {
+    double x = getDouble(key);
+    if (x < 0 || x != static_cast<double>(static_cast<unsigned long int>(x)))
+    {
+      throw badValue(key, "a whole number >= 0");
+    }
+    return static_cast<unsigned long int>(x);
+  };
+  unsigned long int getUnsigned(const std::string &key, const unsigned long int fallback)
+  {
+    return has(key) ? getUnsigned(key) : fallback;
+  };
+
+  bool getBool(const std::string &key)
+  {
+    const std::string &value = lookup(key);
+    if (value == "true" || value == "1")
+    {
+      return true;
+    }
+    if (value == "false" || value == "0")
+    {
+      return false;
+    }
+    throw badValue(key, "true or false");
+  };
+  bool getBool(const std::string &key, const bool fallback)
+  {
+    return has(key) ? getBool(key) : fallback;
+  };
+
+  // Items as strings, empty if the key isn't set
+  std::vector<std::string> getList(const std::string &key)
+  {
+    std::vector<std::string> items;
+    if (!has(key))
+    {
+      return items;
+    }
+    std::string value = lookup(key);
+    for (auto &c : value)
+    {
+      if (c == ',')
+      {
+        c = ' ';
+      }
+    }
+    std::istringstream stream(value);
+    std::string item;
+    while (stream >> item)
+    {
+      items.push_back(item);
+    }
+    return items;
+  };
+
+  void checkUsed()
+  {
+    for (auto &kv : values)
+    {
+      if (!used.count(kv.first))
+      {
+        throw std::runtime_error("Unknown config key: " + kv.first + " (" + source + ")");
+      }
+    }
+  };
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <boost/multiprecision/float128.hpp>
+#include <cstddef>
+#include <vector>
+
+#include "../Scalars/doubleDouble.h"
+#include "../Scalars/scaledDouble.h"
+#include "numpyView.h"
+#include "pybind11_numpy_scalar.h"
+
+/*
+How the scalar types of the engines go to and from Python, shared by every
+module. float128 is a npquad, and ScaledDouble and DoubleDouble are converted
+to and from a npquad so they look the same as it from the Python side (a quad
+holds all of their digits).
+*/
+
+static_assert(sizeof(boost::multiprecision::float128) == 16, "Bad size");
+
+// Boilerplate to get PyBind11 to cast to a npquad precision.
+namespace pybind11
+{
+  namespace detail
+  {
+
+    // Similar to enums in `pybind11/numpy.h`. Determined by doing:
+    // python3 -c 'import numpy as np; print(np.dtype(np.float16).num)'
+    constexpr int NPY_FLOAT16 = 256;
+
+    // Kind of follows:
+    // https://github.com/pybind/pybind11/blob/9bb3313162c0b856125e481ceece9d8faa567716/include/pybind11/numpy.h#L1000
+    template <>
+    struct npy_format_descriptor<boost::multiprecision::float128>
+    {
+      static constexpr auto name = _("RealType");
+      static pybind11::dtype dtype()
+      {
+        handle ptr = npy_api::get().PyArray_DescrFromType_(NPY_FLOAT16);
+        return reinterpret_borrow<pybind11::dtype>(ptr);
+      }
+    };
+
+    template <>
+    struct type_caster<boost::multiprecision::float128> : npy_scalar_caster<boost::multiprecision::float128>
+    {
+      static constexpr auto name = _("RealType");
+    };
+
+    // Goes through the float128 caster, Scalar has fromReal and toReal
+    template <class Scalar>
+    struct quad_scalar_caster
+    {
+      typedef boost::multiprecision::float128 Quad;
+
+      PYBIND11_TYPE_CASTER(Scalar, _("RealType"));
+
+      bool load(handle src, bool convert)
+      {
+        type_caster<Quad> caster;
+        if (!caster.load(src, convert))
+        {
+          return false;
+        }
+        value = Scalar::fromReal(static_cast<Quad &>(caster));
+        return true;
+      }
+
+      static handle cast(Scalar src, return_value_policy policy, handle parent)
+      {
+        return type_caster<Quad>::cast(src.template toReal<Quad>(), policy, parent);
+      }
+    };
+
+    template <>
+    struct type_caster<ScaledDouble> : quad_scalar_caster<ScaledDouble>
+    {
+    };
+
+    template <>
+    struct type_caster<DoubleDouble> : quad_scalar_caster<DoubleDouble>
+    {
+    };
+
+  } // namespace detail
+} // namespace pybind11
+
+// ScaledDouble and DoubleDouble have no numpy dtype so their "views" are
+// converted copies
+inline pybind11::object readOnlyView(const ScaledDouble *data, const std::size_t size, pybind11::handle owner)
+{
+  return pybind11::cast(std::vector<ScaledDouble>(data, data + size));
+}
+
+inline pybind11::object readOnlyView(const DoubleDouble *data, const std::size_t size, pybind11::handle owner)
+{
+  return pybind11::cast(std::vector<DoubleDouble>(data, data + size));
+}
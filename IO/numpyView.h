@@ -0,0 +1,83 @@
+#pragma once
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "storage.h"
+
+/*
+Read only numpy arrays of an engine's buffers without converting a std::vector
+element by element.
+
+guardedView shares memory with a buffer that only moves when asked to (the
+full storage occupancy, the CDF). The array keeps the engine alive and counts
+itself in the engine's storage::Views for as long as it exists, and the calls
+that would move the buffer (setOccupancy, setCDF, loadCheckpoint, ...) throw
+while any view is alive instead of leaving it pointing at freed memory. The
+view follows the buffer as the engine evolves, so it isn't a snapshot.
+
+Buffers that move during the steps themselves (the edges, anything with
+window storage) are only handed out as readOnlyCopy.
+*/
+
+// With a null base numpy copies the data, otherwise the array points at it and
+// keeps base alive
+template <class T>
+pybind11::object readOnlyView(const T *data, const std::size_t size, pybind11::handle base)
+{
+  pybind11::array_t<T> view({static_cast<pybind11::ssize_t>(size)},
+                            {static_cast<pybind11::ssize_t>(sizeof(T))},
+                            data, base);
+  view.attr("flags").attr("writeable") = false;
+  return view;
+}
+
+// [first, last] of v
+template <class T, class Alloc>
+pybind11::object readOnlyCopy(const std::vector<T, Alloc> &v, const std::size_t first, const std::size_t last)
+{
+  return readOnlyView(v.data() + first, last - first + 1, pybind11::handle());
+}
+
+template <class T, class Alloc>
+pybind11::object readOnlyCopy(const std::vector<T, Alloc> &v)
+{
+  return readOnlyView(v.data(), v.size(), pybind11::handle());
+}
+
+// Base for a view that's counted in views and keeps owner alive
+inline pybind11::object viewBase(storage::Views &views, pybind11::handle owner)
+{
+  struct Guard
+  {
+    pybind11::object owner;
+    storage::Views *views;
+  };
+  Guard *guard = new Guard{pybind11::reinterpret_borrow<pybind11::object>(owner), &views};
+  views.add();
+  return pybind11::capsule(guard, [](void *p) {
+    Guard *g = static_cast<Guard *>(p);
+    g->views->release();
+    delete g;
+  });
+}
+
+// [first, last] of v
+template <class T, class Alloc>
+pybind11::object guardedView(const std::vector<T, Alloc> &v,
+                             const std::size_t first,
+                             const std::size_t last,
+                             storage::Views &views,
+                             pybind11::handle owner)
+{
+  return readOnlyView(v.data() + first, last - first + 1, viewBase(views, owner));
+}
+
+template <class T, class Alloc>
+pybind11::object guardedView(const std::vector<T, Alloc> &v, storage::Views &views, pybind11::handle owner)
+{
+  return readOnlyView(v.data(), v.size(), viewBase(views, owner));
+}
@@ -0,0 +1,523 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/multiprecision/float128.hpp>
+
+#include "../Scalars/doubleDouble.h"
+#include "../Scalars/scaledDouble.h"
+#include "../Stats/measurement.h"
+
+/*
+Evaluates a list of observers on an engine (DiffusionTimeCDF or DiffusionPDF)
+at a list of save times and appends one row per time to a binary file. Rows
+are collected in memory and written flushRows at a time, so a long run makes
+a few large writes instead of one small write and flush per row.
+
+File layout:
+
+  magic "RWRERECD" | uint32 version | uint32 scalarBytes | int32 scalarDigits
+  | uint32 numColumns | numColumns x (uint32 length, name)
+  | rows of numColumns values
+
+The first column is always the time. A row is only ever appended whole, but a
+job killed mid write can leave a partial row at the end, loadRecording() in
+fileIO.py drops it.
+
+Observers that need something only one engine has (MaxEdge for the PDF,
+ProbAndV for the CDF) are only instantiated for that engine.
+
+Values are written as recorder::Output<RealType>::type, which is RealType
+unless that's specialized for a type numpy can't read (ScaledDouble and
+DoubleDouble are written as quads, below).
+*/
+
+namespace recorder
+{
+  constexpr char magic[8] = {'R', 'W', 'R', 'E', 'R', 'E', 'C', 'D'};
+  constexpr uint32_t version = 1;
+
+  template <class RealType>
+  struct Output
+  {
+    typedef RealType type;
+    static type convert(const RealType &x) { return x; };
+  };
+
+  template <>
+  struct Output<ScaledDouble>
+  {
+    typedef boost::multiprecision::float128 type;
+    static type convert(const ScaledDouble &x) { return x.toReal<type>(); };
+  };
+
+  template <>
+  struct Output<DoubleDouble>
+  {
+    typedef boost::multiprecision::float128 type;
+    static type convert(const DoubleDouble &x) { return x.toReal<type>(); };
+  };
+
+  template <class RealType>
+  std::string toString(const RealType &x)
+  {
+    std::ostringstream os;
+    os.precision(std::numeric_limits<double>::max_digits10);
+    os << x;
+    return os.str();
+  }
+} // namespace recorder
+
+template <class System, class RealType>
+class Observer
+{
+public:
+  virtual ~Observer(){};
+  virtual std::vector<std::string> columns() = 0;
+  // Append this observer's values for the current state to row
+  virtual void measure(System &system, std::vector<RealType> &row) = 0;
+};
+
+// Quantile positions from findQuantiles, in descending order of quantile
+template <class System, class RealType>
+class QuantileObserver : public Observer<System, RealType>
+{
+private:
+  std::vector<RealType> quantiles;
+
+public:
+  QuantileObserver(std::vector<RealType> _quantiles) : quantiles(_quantiles)
+  {
+    std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+  };
+
+  std::vector<std::string> columns()
+  {
+    std::vector<std::string> names;
+    for (auto &q : quantiles)
+    {
+      names.push_back("quantile " + recorder::toString(q));
+    }
+    return names;
+  };
+
+  void measure(System &system, std::vector<RealType> &row)
+  {
+    auto positions = system.findQuantiles(quantiles);
+    for (auto &x : positions)
+    {
+      row.push_back(RealType(x));
+    }
+  };
+};
+
+// Probability of being at or past v * t
+template <class System, class RealType>
+class PbObserver : public Observer<System, RealType>
+{
+private:
+  std::vector<double> velocities;
+
+public:
+  PbObserver(const std::vector<double> _velocities) : velocities(_velocities){};
+
+  std::vector<std::string> columns()
+  {
+    std::vector<std::string> names;
+    for (auto &v : velocities)
+    {
+      names.push_back("Pb " + recorder::toString(v));
+    }
+    return names;
+  };
+
+  void measure(System &system, std::vector<RealType> &row)
+  {
+    for (auto &v : velocities)
+    {
+      row.push_back(system.getPbAtV(v));
+    }
+  };
+};
+
+template <class System, class RealType>
+class GumbelVarianceObserver : public Observer<System, RealType>
+{
+private:
+  std::vector<RealType> nParticles;
+
+public:
+  GumbelVarianceObserver(const std::vector<RealType> _nParticles) : nParticles(_nParticles){};
+
+  std::vector<std::string> columns()
+  {
+    std::vector<std::string> names;
+    for (auto &N : nParticles)
+    {
+      names.push_back("gumbelVariance " + recorder::toString(N));
+    }
+    return names;
+  };
+
+  void measure(System &system, std::vector<RealType> &row)
+  {
+    std::vector<RealType> vars = system.getGumbelVariance(nParticles);
+    row.insert(row.end(), vars.begin(), vars.end());
+  };
+};
+
+/*
+Quantiles, Pb and Gumbel variances from one call to the engine's measure
+instead of one pass each. Same columns (and in the same order) as a
+QuantileObserver, PbObserver and GumbelVarianceObserver added one after the
+other.
+*/
+template <class System, class RealType>
+class MeasurementObserver : public Observer<System, RealType>
+{
+private:
+  MeasurementPlan<RealType> plan;
+
+public:
+  MeasurementObserver(std::vector<RealType> quantiles, const std::vector<double> velocities,
+                      const std::vector<RealType> nParticles)
+  {
+    std::sort(quantiles.begin(), quantiles.end(), std::greater<RealType>());
+    plan.quantiles = quantiles;
+    plan.velocities = velocities;
+    plan.nParticles = nParticles;
+  };
+
+  std::vector<std::string> columns()
+  {
+    std::vector<std::string> names;
+    for (auto &q : plan.quantiles)
+    {
+      names.push_back("quantile " + recorder::toString(q));
+    }
+    for (auto &v : plan.velocities)
+    {
+      names.push_back("Pb " + recorder::toString(v));
+    }
+    for (auto &N : plan.nParticles)
+    {
+      names.push_back("gumbelVariance " + recorder::toString(N));
+    }
+    return names;
+  };
+
+  void measure(System &system, std::vector<RealType> &row)
+  {
+    auto m = system.measure(plan);
+    for (auto &x : m.quantiles)
+    {
+      row.push_back(RealType(x));
+    }
+    row.insert(row.end(), m.pb.begin(), m.pb.end());
+    row.insert(row.end(), m.gumbelVariance.begin(), m.gumbelVariance.end());
+  };
+};
+
+// Distance of the rightmost occupied site from the center (DiffusionPDF)
+template <class System, class RealType>
+class MaxEdgeObserver : public Observer<System, RealType>
+{
+public:
+  std::vector<std::string> columns() { return {"maxEdge"}; };
+
+  void measure(System &system, std::vector<RealType> &row)
+  {
+    row.push_back(RealType(system.getMaxIdx() - system.getTime() / 2.));
+  };
+};
+
+// Probability and velocity of a quantile from getProbandV (DiffusionTimeCDF)
+template <class System, class RealType>
+class ProbAndVObserver : public Observer<System, RealType>
+{
+private:
+  RealType quantile;
+
+public:
+  ProbAndVObserver(const RealType _quantile) : quantile(_quantile){};
+
+  std::vector<std::string> columns()
+  {
+    std::string q = recorder::toString(quantile);
+    return {"prob " + q, "v " + q};
+  };
+
+  void measure(System &system, std::vector<RealType> &row)
+  {
+    std::pair<RealType, float> probAndV = system.getProbandV(quantile);
+    row.push_back(probAndV.first);
+    row.push_back(RealType(probAndV.second));
+  };
+};
+
+/*
+The file half of a Recorder: writes the header for a list of columns and then
+rows of values, buffered flushRows at a time. Also used on its own for
+results that don't come from observers (the MPI ensemble driver writes its
+reduced moments with it).
+*/
+template <class RealType>
+class RecordingFile
+{
+private:
+  typedef recorder::Output<RealType> Output;
+  typedef typename Output::type OutType;
+
+  std::string fileName;
+  bool append;
+  unsigned long int flushRows;
+  unsigned long int numColumns = 0;
+
+  FILE *file = nullptr;
+  std::vector<char> buffer;
+  unsigned long int bufferedRows = 0;
+
+  static std::string header(const std::vector<std::string> &names)
+  {
+    std::string h(recorder::magic, sizeof(recorder::magic));
+    uint32_t scalarBytes = sizeof(OutType);
+    int32_t scalarDigits = std::numeric_limits<OutType>::digits;
+    uint32_t numColumns = names.size();
+    h.append(reinterpret_cast<const char *>(&recorder::version), sizeof(uint32_t));
+    h.append(reinterpret_cast<const char *>(&scalarBytes), sizeof(uint32_t));
+    h.append(reinterpret_cast<const char *>(&scalarDigits), sizeof(int32_t));
+    h.append(reinterpret_cast<const char *>(&numColumns), sizeof(uint32_t));
+    for (auto &name : names)
+    {
+      uint32_t length = name.size();
+      h.append(reinterpret_cast<const char *>(&length), sizeof(uint32_t));
+      h.append(name);
+    }
+    return h;
+  };
+
+public:
+  RecordingFile(const std::string _fileName, const bool _append = false, const unsigned long int _flushRows = 1000)
+      : fileName(_fileName), append(_append), flushRows(std::max<unsigned long int>(_flushRows, 1)){};
+
+  ~RecordingFile()
+  {
+    if (file)
+    {
+      // Can't throw from here, best effort
+      if (!buffer.empty())
+      {
+        fwrite(buffer.data(), 1, buffer.size(), file);
+      }
+      fclose(file);
+    }
+  };
+
+  RecordingFile(const RecordingFile &) = delete;
+  RecordingFile &operator=(const RecordingFile &) = delete;
+
+  bool isOpen() { return file != nullptr; };
+  unsigned long int getFlushRows() { return flushRows; };
+  void setFlushRows(const unsigned long int _flushRows) { flushRows = std::max<unsigned long int>(_flushRows, 1); };
+
+  // Write the header, or check it matches the file's when appending
+  void open(const std::vector<std::string> &names)
+  {
+    if (file)
+    {
+      throw std::runtime_error("Recording is already open: " + fileName);
+    }
+    numColumns = names.size();
+    std::string h = header(names);
+    if (append)
+    {
+      FILE *existing = fopen(fileName.c_str(), "rb");
+      if (existing)
+      {
+        std::vector<char> old(h.size());
+        size_t read = fread(old.data(), 1, old.size(), existing);
+        fclose(existing);
+        if (read != h.size() || std::memcmp(old.data(), h.data(), h.size()) != 0)
+        {
+          throw std::runtime_error("Can't append to " + fileName +
+                                   ", it was recorded with different columns or RealType");
+        }
+        file = fopen(fileName.c_str(), "ab");
+        if (!file)
+        {
+          throw std::runtime_error("Could not open recording: " + fileName);
+        }
+        return;
+      }
+    }
+    file = fopen(fileName.c_str(), "wb");
+    if (!file || fwrite(h.data(), 1, h.size(), file) != h.size())
+    {
+      throw std::runtime_error("Could not open recording: " + fileName);
+    }
+  };
+
+  void writeRow(const std::vector<RealType> &row)
+  {
+    if (!file)
+    {
+      throw std::runtime_error("Recording isn't open: " + fileName);
+    }
+    if (row.size() != numColumns)
+    {
+      throw std::runtime_error("Row has " + std::to_string(row.size()) + " values for " +
+                               std::to_string(numColumns) + " columns");
+    }
+    for (auto &x : row)
+    {
+      OutType value = Output::convert(x);
+      const char *bytes = reinterpret_cast<const char *>(&value);
+      buffer.insert(buffer.end(), bytes, bytes + sizeof(OutType));
+    }
+    bufferedRows += 1;
+    if (bufferedRows >= flushRows)
+    {
+      flush();
+    }
+  };
+
+  void flush()
+  {
+    if (!file)
+    {
+      return;
+    }
+    if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+    {
+      throw std::runtime_error("Could not write to recording: " + fileName);
+    }
+    buffer.clear();
+    bufferedRows = 0;
+    if (fflush(file) != 0)
+    {
+      throw std::runtime_error("Could not write to recording: " + fileName);
+    }
+  };
+
+  void close()
+  {
+    flush();
+    if (file)
+    {
+      fclose(file);
+      file = nullptr;
+    }
+  };
+};
+
+template <class System, class RealType>
+class Recorder
+{
+private:
+  RecordingFile<RealType> output;
+  std::vector<std::unique_ptr<Observer<System, RealType>>> observers;
+  std::vector<RealType> row;
+
+  std::vector<std::string> allColumns()
+  {
+    std::vector<std::string> names = {"time"};
+    for (auto &observer : observers)
+    {
+      std::vector<std::string> cols = observer->columns();
+      names.insert(names.end(), cols.begin(), cols.end());
+    }
+    return names;
+  };
+
+public:
+  Recorder(const std::string _fileName, const bool _append = false, const unsigned long int _flushRows = 1000)
+      : output(_fileName, _append, _flushRows){};
+
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  void addObserver(Observer<System, RealType> *observer)
+  {
+    if (output.isOpen())
+    {
+      delete observer;
+      throw std::runtime_error("Can't add observers after recording has started");
+    }
+    observers.emplace_back(observer);
+  };
+
+  void addQuantiles(const std::vector<RealType> quantiles)
+  {
+    addObserver(new QuantileObserver<System, RealType>(quantiles));
+  };
+  void addPb(const std::vector<double> velocities)
+  {
+    addObserver(new PbObserver<System, RealType>(velocities));
+  };
+  void addGumbelVariance(const std::vector<RealType> nParticles)
+  {
+    addObserver(new GumbelVarianceObserver<System, RealType>(nParticles));
+  };
+  void addMeasurement(const std::vector<RealType> quantiles, const std::vector<double> velocities,
+                      const std::vector<RealType> nParticles)
+  {
+    addObserver(new MeasurementObserver<System, RealType>(quantiles, velocities, nParticles));
+  };
+  void addMaxEdge() { addObserver(new MaxEdgeObserver<System, RealType>()); };
+  void addProbAndV(const RealType quantile)
+  {
+    addObserver(new ProbAndVObserver<System, RealType>(quantile));
+  };
+
+  std::vector<std::string> getColumns() { return allColumns(); };
+  unsigned long int getFlushRows() { return output.getFlushRows(); };
+  void setFlushRows(const unsigned long int _flushRows) { output.setFlushRows(_flushRows); };
+
+  // Measure every observer now and buffer the row
+  void record(System &system)
+  {
+    // Open the file on the first row so every observer has been added
+    if (!output.isOpen())
+    {
+      output.open(allColumns());
+    }
+    row.clear();
+    row.push_back(RealType(system.getTime()));
+    for (auto &observer : observers)
+    {
+      observer->measure(system, row);
+    }
+    output.writeRow(row);
+  };
+
+  void flush() { output.flush(); };
+  void close() { output.close(); };
+
+  // Evolve to each of times (ascending) and record a row there. Times the
+  // system is already past are skipped.
+  void evolveAndRecord(System &system, std::vector<unsigned long int> times)
+  {
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+    for (auto &t : times)
+    {
+      if (t < system.getTime())
+      {
+        continue;
+      }
+      system.evolveToTime(t);
+      record(system);
+    }
+    flush();
+  };
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+Where the engines keep their big arrays: the CDF of a DiffusionTimeCDF and
+the occupancy and edges of a DiffusionPDF. storage::Vector is a std::vector
+whose allocator either uses the heap as before or, given a directory, maps
+every allocation from a file of its own there. The state can then be bigger
+than RAM and the kernel pages it in and out as the steps sweep over it.
+
+The files are unlinked as soon as they're mapped, so they're scratch space
+that goes away with the process rather than a checkpoint: a step updates the
+mapping in place, so after a crash it would hold part of one step and part of
+the next. Save checkpoints (IO/checkpoint.h) as usual; that only reads the
+occupied part of the mapping.
+
+A new file reads as zeros, so value initializing an element whose zero is all
+zero bytes (double, float128, ...) isn't written when the element already
+reads as zero. Resizing the CDF to tMax + 1 then only reads the file, and
+nothing is dirtied until a step gets there. The mapping is advised MADV_SEQUENTIAL and
+a Prefetch asks for the pages ahead of a sweep with MADV_WILLNEED.
+*/
+
+namespace storage
+{
+  // Bytes MADV_WILLNEED asks for at a time ahead of a sweep
+  constexpr std::size_t prefetchBytes = std::size_t(32) << 20;
+
+  // Whether a value initialized U is all zero bytes, so a new mapping
+  // already holds it
+  template <class U>
+  bool zeroInitialized()
+  {
+    static const bool zero = []() {
+      if (std::is_arithmetic<U>::value)
+      {
+        return true;
+      }
+      U value = U();
+      unsigned char bytes[sizeof(U)] = {};
+      return std::memcmp(static_cast<const void *>(&value), bytes, sizeof(U)) == 0;
+    }();
+    return zero;
+  }
+
+  template <class T>
+  class Allocator
+  {
+  private:
+    template <class U>
+    friend class Allocator;
+
+    struct Mapping
+    {
+      std::string directory;
+      // Bytes of the latest allocation that nothing has been put in yet
+      char *freshBegin = nullptr;
+      char *freshEnd = nullptr;
+    };
+    // Null for the heap
+    std::shared_ptr<Mapping> mapping;
+
+    bool fresh(const void *p) const
+    {
+      const char *c = static_cast<const char *>(p);
+      return c >= mapping->freshBegin && c < mapping->freshEnd;
+    };
+
+  public:
+    typedef T value_type;
+    // Moving or swapping a vector takes its storage along with the data
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    Allocator(){};
+    explicit Allocator(const std::string &_directory)
+    {
+      if (!_directory.empty())
+      {
+        mapping = std::make_shared<Mapping>();
+        mapping->directory = _directory;
+      }
+    };
+    template <class U>
+    Allocator(const Allocator<U> &other) : mapping(other.mapping){};
+
+    bool mapped() const { return mapping != nullptr; };
+    std::string getDirectory() const { return mapping ? mapping->directory : std::string(); };
+
+    T *allocate(const std::size_t n)
+    {
+      if (n == 0)
+      {
+        return nullptr;
+      }
+      if (n > std::size_t(-1) / sizeof(T))
+      {
+        throw std::bad_alloc();
+      }
+      std::size_t bytes = n * sizeof(T);
+      if (!mapping)
+      {
+        return static_cast<T *>(::operator new(bytes));
+      }
+      const std::string &directory = mapping->directory;
+      std::string name = directory + "/rwre-storage-XXXXXX";
+      std::vector<char> path(name.begin(), name.end());
+      path.push_back('\0');
+      int fd = mkstemp(path.data());
+      if (fd < 0)
+      {
+        throw std::runtime_error("Could not create storage file in " + directory);
+      }
+      unlink(path.data());
+      if (ftruncate(fd, bytes) != 0)
+      {
+        close(fd);
+        throw std::runtime_error("Could not make a " + std::to_string(bytes) + " byte storage file in " +
+                                 directory);
+      }
+      void *data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      // The mapping keeps the file open
+      close(fd);
+      if (data == MAP_FAILED)
+      {
+        throw std::runtime_error("Could not mmap " + std::to_string(bytes) + " bytes of storage in " +
+                                 directory);
+      }
+      madvise(data, bytes, MADV_SEQUENTIAL);
+      mapping->freshBegin = static_cast<char *>(data);
+      mapping->freshEnd = mapping->freshBegin + bytes;
+      return static_cast<T *>(data);
+    };
+
+    void deallocate(T *data, const std::size_t n)
+    {
+      if (!data)
+      {
+        return;
+      }
+      if (!mapping)
+      {
+        ::operator delete(data);
+        return;
+      }
+      if (fresh(data))
+      {
+        mapping->freshBegin = mapping->freshEnd = nullptr;
+      }
+      munmap(data, n * sizeof(T));
+    };
+
+    // Value initializing what's already zero bytes is skipped: without
+    // reading it in the part of the latest allocation that's never held
+    // anything, otherwise it's only read (a hole in the file reads as a clean
+    // zero page) and never written
+    template <class U>
+    void construct(U *p)
+    {
+      static const unsigned char zeros[sizeof(U)] = {};
+      if (mapping && zeroInitialized<U>() &&
+          (fresh(p) || std::memcmp(static_cast<const void *>(p), zeros, sizeof(U)) == 0))
+      {
+        return;
+      }
+      ::new (static_cast<void *>(p)) U();
+    };
+    template <class U, class... Args>
+    void construct(U *p, Args &&... args)
+    {
+      ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    };
+
+    // Anything at or past a destroyed element may be reused with different
+    // contents, so it's no longer fresh
+    template <class U>
+    void destroy(U *p)
+    {
+      if (mapping && fresh(p))
+      {
+        mapping->freshEnd = reinterpret_cast<char *>(p);
+      }
+      p->~U();
+    };
+
+    template <class U>
+    bool operator==(const Allocator<U> &other) const
+    {
+      return getDirectory() == other.getDirectory();
+    };
+    template <class U>
+    bool operator!=(const Allocator<U> &other) const
+    {
+      return !(*this == other);
+    };
+  };
+
+  template <class T>
+  using Vector = std::vector<T, Allocator<T>>;
+
+  /*
+  Keeps MADV_WILLNEED up to prefetchBytes ahead of a sweep up v[first, last],
+  called as the sweep reaches each site (in practice each block of them).
+  Does nothing on the heap or for a sweep shorter than prefetchBytes: asking
+  for pages that are already in costs more than the sweep, and the read
+  ahead MADV_SEQUENTIAL turns on covers the short ones anyway.
+  */
+  template <class T>
+  class Prefetch
+  {
+  private:
+    const char *base = nullptr;
+    std::size_t end = 0;
+    // Bytes from base asked for so far
+    std::size_t requested = 0;
+
+  public:
+    Prefetch(const Vector<T> &v, const std::size_t first, const std::size_t last)
+    {
+      if (v.get_allocator().mapped() && first <= last && last < v.size() &&
+          (last - first + 1) * sizeof(T) >= prefetchBytes)
+      {
+        base = reinterpret_cast<const char *>(v.data());
+        end = (last + 1) * sizeof(T);
+        requested = first * sizeof(T);
+      }
+    };
+
+    void reach(const std::size_t idx)
+    {
+      // Ask for the next stretch once the sweep is half way through this one
+      if (!base || requested >= end || idx * sizeof(T) + prefetchBytes / 2 < requested)
+      {
+        return;
+      }
+      static const std::size_t page = sysconf(_SC_PAGESIZE);
+      std::size_t start = requested - requested % page;
+      std::size_t stop = std::min(requested + prefetchBytes, end);
+      madvise(const_cast<char *>(base) + start, stop - start, MADV_WILLNEED);
+      requested = stop;
+    };
+  };
+
+  /*
+  Number of numpy views (IO/numpyView.h) of an engine buffer that are alive.
+  The bindings count views in and out, and whatever would move the buffer
+  calls check() first, so a view never points at freed memory. A copy of the
+  engine starts with none.
+  */
+  class Views
+  {
+  private:
+    std::atomic<unsigned long int> count{0};
+
+  public:
+    Views(){};
+    Views(const Views &){};
+    Views &operator=(const Views &) { return *this; };
+
+    void add() { count += 1; };
+    void release() { count -= 1; };
+    unsigned long int size() const { return count; };
+
+    // Throw if there are views, what is the operation that would move the buffer
+    void check(const std::string &what) const
+    {
+      unsigned long int n = count;
+      if (n)
+      {
+        throw std::runtime_error(what + " would move a buffer " + std::to_string(n) +
+                                 " numpy view(s) still point at, delete them or use the copy getters");
+      }
+    };
+  };
+} // namespace storage
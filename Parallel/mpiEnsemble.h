@@ -0,0 +1,103 @@
+#pragma once
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../DiffusionEnsemble/diffusionEnsemble.hpp"
+#include "../Stats/runningStats.h"
+
+/*
+Runs a DiffusionEnsemble split over the ranks of an MPI communicator and
+reduces it onto one of them, so a sweep over many nodes ends with the same
+running means and variances a single process would have.
+
+Every rank gets a contiguous block of whole systemsPerTask groups. Realization
+i is seeded seed + i on whichever rank runs it, so it's the same ensemble at
+any number of ranks (all of them have to be given the same seed).
+
+The accumulators go through MPI_Reduce with an MPI_Op doing
+RunningStats::merge. It's registered as not commutative so MPI merges in rank
+order and a given number of ranks always gives the same bits. A different
+number of ranks merges the same values in a different tree and agrees to
+rounding. RunningStats is sent as raw bytes, so every rank has to run the same
+build on the same kind of machine.
+*/
+
+namespace mpiEnsemble
+{
+  inline void check(const int err, const char *call)
+  {
+    if (err != MPI_SUCCESS)
+    {
+      throw std::runtime_error(std::string(call) + " failed with MPI error " + std::to_string(err));
+    }
+  }
+
+  // inout[i] = in[i] merged with inout[i], in comes from the lower ranks
+  template <class RealType>
+  void mergeStats(void *in, void *inout, int *len, MPI_Datatype *)
+  {
+    const RunningStats<RealType> *lower = static_cast<const RunningStats<RealType> *>(in);
+    RunningStats<RealType> *upper = static_cast<RunningStats<RealType> *>(inout);
+    for (int i = 0; i < *len; i++)
+    {
+      RunningStats<RealType> merged = lower[i];
+      merged.merge(upper[i]);
+      upper[i] = merged;
+    }
+  }
+
+  // Merge stats over every rank of comm, the result is only left on root.
+  // Every rank has to pass the same number of accumulators.
+  template <class RealType>
+  void reduceStats(std::vector<RunningStats<RealType>> &stats, const int root, MPI_Comm comm)
+  {
+    if (stats.empty())
+    {
+      return;
+    }
+    MPI_Datatype type;
+    check(MPI_Type_contiguous(sizeof(RunningStats<RealType>), MPI_BYTE, &type), "MPI_Type_contiguous");
+    check(MPI_Type_commit(&type), "MPI_Type_commit");
+    MPI_Op op;
+    check(MPI_Op_create(&mergeStats<RealType>, 0, &op), "MPI_Op_create");
+
+    std::vector<RunningStats<RealType>> reduced(stats.size());
+    int err = MPI_Reduce(stats.data(), reduced.data(), static_cast<int>(stats.size()), type, op, root, comm);
+    MPI_Op_free(&op);
+    MPI_Type_free(&type);
+    check(err, "MPI_Reduce");
+
+    int rank;
+    check(MPI_Comm_rank(comm, &rank), "MPI_Comm_rank");
+    if (rank == root)
+    {
+      stats.swap(reduced);
+    }
+  }
+} // namespace mpiEnsemble
+
+// Run this rank's share of ensemble and reduce every observable onto root,
+// where the getters then return the results for the whole ensemble
+template <template <class> class Engine, class RealType>
+void runMPIEnsemble(DiffusionEnsemble<Engine, RealType> &ensemble, const int root = 0, MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank, numRanks;
+  mpiEnsemble::check(MPI_Comm_rank(comm, &rank), "MPI_Comm_rank");
+  mpiEnsemble::check(MPI_Comm_size(comm, &numRanks), "MPI_Comm_size");
+
+  unsigned long int numSystems = ensemble.getNumSystems();
+  unsigned long int numTasks = (numSystems + systemsPerTask - 1) / systemsPerTask;
+  unsigned long int first = std::min(numTasks * rank / numRanks * systemsPerTask, numSystems);
+  unsigned long int last = std::min(numTasks * (rank + 1) / numRanks * systemsPerTask, numSystems);
+  ensemble.setSystemRange(first, last - first);
+  ensemble.run();
+
+  mpiEnsemble::reduceStats(ensemble.viewQuantileStats(), root, comm);
+  mpiEnsemble::reduceStats(ensemble.viewGumbelStats(), root, comm);
+  mpiEnsemble::reduceStats(ensemble.viewPbStats(), root, comm);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Don't split a step over more threads than this many sites per thread, below
+// that the synchronization costs more than the update.
+constexpr unsigned long int minSitesPerThread = 4096;
+
+/*
+Persistent pool of worker threads for splitting up a single timestep.
+
+parallelFor(num, task) runs task(0), ..., task(num-1) across the pool and the
+calling thread and returns once all of them are done. Tasks are handed out
+through an atomic counter so threads that finish early pick up the remaining
+ones. If a task throws, the first exception is rethrown from parallelFor.
+*/
+class ThreadPool
+{
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable startCondition;
+  std::condition_variable doneCondition;
+
+  const std::function<void(std::size_t)> *task = nullptr;
+  std::size_t numTasks = 0;
+  std::atomic<std::size_t> nextTask;
+  unsigned long int generation = 0;
+  unsigned int finishedWorkers = 0;
+  bool stop = false;
+
+  std::exception_ptr error;
+
+  void runTasks()
+  {
+    std::size_t i;
+    while ((i = nextTask.fetch_add(1)) < numTasks)
+    {
+      try
+      {
+        (*task)(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+        {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+
+  void workerLoop()
+  {
+    unsigned long int seenGeneration = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        startCondition.wait(lock, [&] { return stop || generation != seenGeneration; });
+        if (stop)
+        {
+          return;
+        }
+        seenGeneration = generation;
+      }
+
+      runTasks();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      finishedWorkers += 1;
+      if (finishedWorkers == workers.size())
+      {
+        doneCondition.notify_one();
+      }
+    }
+  };
+
+public:
+  // numThreads counts the calling thread, so numThreads - 1 workers are made
+  ThreadPool(const unsigned int numThreads) : nextTask(0)
+  {
+    for (unsigned int i = 1; i < numThreads; i++)
+    {
+      workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+  };
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    startCondition.notify_all();
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+  };
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned int size() { return workers.size() + 1; };
+
+  void parallelFor(const std::size_t num, const std::function<void(std::size_t)> &_task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = &_task;
+      numTasks = num;
+      nextTask = 0;
+      finishedWorkers = 0;
+      error = nullptr;
+      generation += 1;
+    }
+    startCondition.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [&] { return finishedWorkers == workers.size(); });
+    task = nullptr;
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  };
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <boost/random/normal_distribution.hpp>
+#include <cmath>
+#include <cstddef>
+#include <random>
+
+#include "philox.h"
+
+/*
+Draws Beta(beta, beta) distributed biases for the random environment.
+
+The class of distribution (beta = 0, 1, inf or general) is resolved once when
+the sampler is built instead of on every draw, so fill() is a tight loop over
+the buffer with no per-draw dispatch or parameter handling. For the general
+case the two gamma variates are drawn with Marsaglia & Tsang's squeeze method,
+which needs one normal and (almost always) one uniform per gamma, rather than
+going through boost::random::beta_distribution.
+
+The beta = 0 and beta = 1 classes draw from std::uniform_real_distribution in
+the same way the engines always have, so seeded runs with those are unchanged
+for the CDF and for the PDF with ProbDistFlag. The discrete PDF draws a bias
+for every site in [minEdge, maxEdge], empty ones included, so its seeded
+stream is different for every beta.
+
+Any UniformRandomBitGenerator works. With a CounterRNG use fillSites() so each
+bias is keyed on its (time, site).
+*/
+
+// Size of the bias buffer the step kernels refill as they sweep. Small enough
+// to stay in cache.
+constexpr std::size_t biasBlockSize = 1024;
+
+class BetaSampler
+{
+public:
+  enum BetaClass
+  {
+    Zero,    // beta = 0: either 0 or 1
+    Uniform, // beta = 1: uniform on [0, 1)
+    Half,    // beta = inf: always 0.5
+    General  // everything else
+  };
+
+private:
+  double beta;
+  BetaClass betaClass;
+
+  // Constants for Marsaglia & Tsang. If beta < 1 we sample Gamma(beta + 1)
+  // and boost it back down to Gamma(beta).
+  double d;
+  double c;
+
+  std::uniform_real_distribution<> dis;
+  boost::random::normal_distribution<> normal;
+
+  // Gamma(beta + 1) for beta < 1, Gamma(beta) otherwise
+  template <class URNG>
+  double generateGamma(URNG &gen)
+  {
+    while (true)
+    {
+      double x = normal(gen);
+      double v = 1 + c * x;
+      if (v <= 0)
+      {
+        continue;
+      }
+      v = v * v * v;
+      double u = dis(gen);
+      double x2 = x * x;
+      if (u < 1 - 0.0331 * x2 * x2)
+      {
+        return d * v;
+      }
+      if (log(u) < 0.5 * x2 + d * (1 - v + log(v)))
+      {
+        return d * v;
+      }
+    }
+  };
+
+  template <class URNG>
+  double generateGeneral(URNG &gen)
+  {
+    if (beta >= 1)
+    {
+      double x = generateGamma(gen);
+      double y = generateGamma(gen);
+      return x / (x + y);
+    }
+    // For beta < 1, X = G1 * U1^(1/beta) and Y = G2 * U2^(1/beta) can
+    // underflow, so only form the ratio Y / X. 1 - dis(gen) is in (0, 1] so
+    // the log is finite, and exp() going to 0 or inf gives a bias of 1 or 0.
+    double g1 = generateGamma(gen);
+    double g2 = generateGamma(gen);
+    double u1 = 1 - dis(gen);
+    double u2 = 1 - dis(gen);
+    return 1 / (1 + (g2 / g1) * exp(log(u2 / u1) / beta));
+  };
+
+public:
+  BetaSampler(const double _beta = 1) : beta(_beta), dis(0.0, 1.0)
+  {
+    if (beta == 0.0)
+    {
+      betaClass = Zero;
+    }
+    else if (beta == 1.0)
+    {
+      betaClass = Uniform;
+    }
+    else if (std::isinf(beta))
+    {
+      betaClass = Half;
+    }
+    else
+    {
+      betaClass = General;
+    }
+
+    double shape = (beta < 1) ? beta + 1 : beta;
+    d = shape - 1. / 3.;
+    c = 1 / sqrt(9 * d);
+  };
+
+  double getBeta() { return beta; };
+  BetaClass getBetaClass() { return betaClass; };
+
+  // Draw a single bias
+  template <class URNG>
+  double operator()(URNG &gen)
+  {
+    switch (betaClass)
+    {
+    case Zero:
+      return round(dis(gen));
+    case Uniform:
+      return dis(gen);
+    case Half:
+      return 0.5;
+    default:
+      return generateGeneral(gen);
+    }
+  };
+
+  // Fill out[0], ..., out[num-1] with biases
+  template <class URNG>
+  void fill(URNG &gen, double *out, const std::size_t num)
+  {
+    switch (betaClass)
+    {
+    case Zero:
+      for (std::size_t i = 0; i < num; i++)
+      {
+        out[i] = round(dis(gen));
+      }
+      break;
+    case Uniform:
+      for (std::size_t i = 0; i < num; i++)
+      {
+        out[i] = dis(gen);
+      }
+      break;
+    case Half:
+      for (std::size_t i = 0; i < num; i++)
+      {
+        out[i] = 0.5;
+      }
+      break;
+    default:
+      for (std::size_t i = 0; i < num; i++)
+      {
+        out[i] = generateGeneral(gen);
+      }
+      break;
+    }
+  };
+
+  // Fill out[i] with the bias of site firstSite + i at the given time. Each
+  // bias only depends on (seed, time, site) so any part of the environment
+  // can be regenerated independently.
+  void fillSites(CounterRNG &gen,
+                 const unsigned long int time,
+                 const unsigned long int firstSite,
+                 double *out,
+                 const std::size_t num)
+  {
+    for (std::size_t i = 0; i < num; i++)
+    {
+      gen.setPosition(time, firstSite + i);
+      out[i] = (*this)(gen);
+    }
+  };
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <boost/random/normal_distribution.hpp>
+#include <cmath>
+#include <random>
+
+/*
+Draws Binomial(n, p) counts for the discrete particle mode of DiffusionPDF,
+where n and p change on every call (every site, every step).
+
+boost::random::binomial_distribution rebuilds its setup through a param_type
+for every new (n, p) and only takes int counts, so sites with more than 2^31
+particles had to be approximated. Here the method is picked per call and its
+setup is a handful of flops done inline:
+
+  - n <= 8: count n Bernoulli trials
+  - n * min(p, 1 - p) < 10: inversion, a sequential search up from k = 0
+    which takes ~n * p steps and one uniform
+  - otherwise: Hoermann's BTRD (transformed rejection with decomposition,
+    "The generation of binomial random variates", J. Stat. Comput. Simul. 46,
+    1993). Most draws are accepted by the first test with one uniform and no
+    logs, and the expected number of uniforms is < 2.5 for any n.
+
+p > 1/2 is sampled as n - Binomial(n, 1 - p). n is a double so counts up to
+2^53 are exact. normal() is for the medium regime where the binomial is
+replaced by its Gaussian approximation.
+
+Any UniformRandomBitGenerator works, including a CounterRNG positioned on a
+site.
+*/
+
+class BinomialSampler
+{
+private:
+  static constexpr double maxTrials = 8;
+
+  std::uniform_real_distribution<> dis;
+  boost::random::normal_distribution<> gaussian;
+
+  // log(k!) - ((k + 1/2) log(k + 1) - (k + 1) + log(2 pi) / 2), the error of
+  // Stirling's formula for log(k!)
+  static double stirlingCorrection(const double k)
+  {
+    static const double table[10] = {
+        0.08106146679532726, 0.04134069595540929, 0.02767792568499834,
+        0.02079067210376509, 0.01664469118982119, 0.01387612882307075,
+        0.01189670994589177, 0.01041126526197209, 0.009255462182712733,
+        0.008330563433362871};
+    if (k < 10)
+    {
+      return table[static_cast<int>(k)];
+    }
+    double k1 = k + 1;
+    double k1sq = k1 * k1;
+    return (1. / 12 - (1. / 360 - 1. / 1260 / k1sq) / k1sq) / k1;
+  };
+
+  // Sum of n Bernoulli trials, for a handful of particles this is cheaper than
+  // any setup
+  template <class URNG>
+  double trials(URNG &gen, const double n, const double p)
+  {
+    double k = 0;
+    for (double i = 0; i < n; i++)
+    {
+      k += (dis(gen) < p);
+    }
+    return k;
+  };
+
+  // p <= 1/2 and n * p < 10
+  template <class URNG>
+  double inversion(URNG &gen, const double n, const double p)
+  {
+    double s = p / (1 - p);
+    double a = (n + 1) * s;
+    double p0 = exp(n * log1p(-p));
+    while (true)
+    {
+      double u = dis(gen);
+      double r = p0;
+      double k = 0;
+      // Once the pmf underflows (or passes k = n) the uniform landed in the
+      // rounding error of the total, start over
+      while (u > r && r > 0)
+      {
+        u -= r;
+        k += 1;
+        r *= a / k - s;
+      }
+      if (r > 0)
+      {
+        return k;
+      }
+    }
+  };
+
+  // p <= 1/2 and n * p >= 10
+  template <class URNG>
+  double btrd(URNG &gen, const double n, const double p)
+  {
+    double m = floor((n + 1) * p);
+    double r = p / (1 - p);
+    double nr = (n + 1) * r;
+    double npq = n * p * (1 - p);
+    double sqrtNpq = sqrt(npq);
+    double b = 1.15 + 2.53 * sqrtNpq;
+    double a = -0.0873 + 0.0248 * b + 0.01 * p;
+    double c = n * p + 0.5;
+    double alpha = (2.83 + 5.1 / b) * sqrtNpq;
+    double vr = 0.92 - 4.2 / b;
+    double urvr = 0.86 * vr;
+
+    while (true)
+    {
+      double v = dis(gen);
+      double u;
+      // Inside the box under the hat, accept straight away
+      if (v <= urvr)
+      {
+        u = v / vr - 0.43;
+        return floor((2 * a / (0.5 - fabs(u)) + b) * u + c);
+      }
+      if (v >= vr)
+      {
+        u = dis(gen) - 0.5;
+      }
+      else
+      {
+        u = v / vr - 0.93;
+        u = ((u > 0) ? 0.5 : -0.5) - u;
+        v = dis(gen) * vr;
+      }
+
+      double us = 0.5 - fabs(u);
+      double k = floor((2 * a / us + b) * u + c);
+      if (k < 0 || k > n)
+      {
+        continue;
+      }
+      v = v * alpha / (a / (us * us) + b);
+      double km = fabs(k - m);
+
+      // Close to the mode the ratio f(k) / f(m) is cheap to build up
+      if (km <= 15)
+      {
+        double f = 1;
+        if (m < k)
+        {
+          for (double i = m + 1; i <= k; i++)
+          {
+            f *= nr / i - r;
+          }
+        }
+        else if (m > k)
+        {
+          for (double i = k + 1; i <= m; i++)
+          {
+            v *= nr / i - r;
+          }
+        }
+        if (v <= f)
+        {
+          return k;
+        }
+        continue;
+      }
+
+      // Squeeze on log(f(k) / f(m))
+      v = log(v);
+      double rho = (km / npq) * (((km / 3 + 0.625) * km + 1. / 6) / npq + 0.5);
+      double t = -km * km / (2 * npq);
+      if (v < t - rho)
+      {
+        return k;
+      }
+      if (v > t + rho)
+      {
+        continue;
+      }
+
+      double nm = n - m + 1;
+      double h = (m + 0.5) * log((m + 1) / (r * nm)) + stirlingCorrection(m) + stirlingCorrection(n - m);
+      double nk = n - k + 1;
+      if (v <= h + (n + 1) * log(nm / nk) + (k + 0.5) * log(nk * r / (k + 1)) -
+                   stirlingCorrection(k) - stirlingCorrection(n - k))
+      {
+        return k;
+      }
+    }
+  };
+
+public:
+  BinomialSampler() : dis(0.0, 1.0){};
+
+  // Number of successes out of n (a whole number) with probability p
+  template <class URNG>
+  double operator()(URNG &gen, const double n, const double p)
+  {
+    if (p > 0.5)
+    {
+      return n - (*this)(gen, n, 1 - p);
+    }
+    if (n <= maxTrials)
+    {
+      return trials(gen, n, p);
+    }
+    if (n * p < 10)
+    {
+      return inversion(gen, n, p);
+    }
+    return btrd(gen, n, p);
+  };
+
+  // Standard normal, for the Gaussian approximation
+  template <class URNG>
+  double normal(URNG &gen)
+  {
+    return gaussian(gen);
+  };
+};
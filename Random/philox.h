@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+Counter based random number generator (Philox4x32-10 from Salmon et al.,
+"Parallel random numbers: as easy as 1, 2, 3", SC11).
+
+Instead of a sequential state, every block of 128 random bits is a pure
+function of a 64 bit key (the seed) and a 128 bit counter. We lay the counter
+out as (time, site, stream, draw) so the random numbers used at any
+(time, site) can be regenerated on their own, in any order and from any
+thread, without replaying the rest of the history.
+
+CounterRNG satisfies UniformRandomBitGenerator, so it can be handed to the
+std/boost distributions and to BetaSampler like boost::random::mt19937_64.
+Call setPosition() before drawing the numbers for a site.
+
+Limits: time < 2^32, stream < 2^8 and < 2^24 blocks of draws per
+(time, site, stream) which is far more than any rejection loop needs.
+
+Everything here is also callable from CUDA/HIP device code, so a kernel draws
+exactly the same numbers as the host for a (seed, time, site).
+*/
+
+#if defined(__CUDACC__) || defined(__HIPCC__)
+#define PHILOX_HOST_DEVICE __host__ __device__
+#else
+#define PHILOX_HOST_DEVICE
+#endif
+
+namespace philox_detail
+{
+  constexpr uint32_t M0 = 0xD2511F53;
+  constexpr uint32_t M1 = 0xCD9E8D57;
+  constexpr uint32_t W0 = 0x9E3779B9;
+  constexpr uint32_t W1 = 0xBB67AE85;
+
+  PHILOX_HOST_DEVICE inline void round(uint32_t ctr[4], const uint32_t key[2])
+  {
+    uint64_t p0 = uint64_t(M0) * ctr[0];
+    uint64_t p1 = uint64_t(M1) * ctr[2];
+    uint32_t c0 = uint32_t(p1 >> 32) ^ ctr[1] ^ key[0];
+    uint32_t c1 = uint32_t(p1);
+    uint32_t c2 = uint32_t(p0 >> 32) ^ ctr[3] ^ key[1];
+    uint32_t c3 = uint32_t(p0);
+    ctr[0] = c0, ctr[1] = c1, ctr[2] = c2, ctr[3] = c3;
+  }
+} // namespace philox_detail
+
+// out = Philox4x32-10(ctr, key)
+PHILOX_HOST_DEVICE inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4])
+{
+  uint32_t c[4] = {ctr[0], ctr[1], ctr[2], ctr[3]};
+  uint32_t k[2] = {key[0], key[1]};
+  for (int i = 0; i < 10; i++)
+  {
+    philox_detail::round(c, k);
+    k[0] += philox_detail::W0;
+    k[1] += philox_detail::W1;
+  }
+  out[0] = c[0], out[1] = c[1], out[2] = c[2], out[3] = c[3];
+}
+
+class CounterRNG
+{
+private:
+  uint32_t key[2];
+  uint32_t ctr[4];
+  uint32_t block[4];
+  // Which 64 bit half of block to hand out next. 2 means block is used up.
+  int next;
+
+public:
+  typedef uint64_t result_type;
+
+  PHILOX_HOST_DEVICE CounterRNG(const uint64_t seed = 0)
+  {
+    setSeed(seed);
+    setPosition(0, 0);
+  };
+
+  PHILOX_HOST_DEVICE void setSeed(const uint64_t seed)
+  {
+    key[0] = uint32_t(seed);
+    key[1] = uint32_t(seed >> 32);
+    next = 2;
+  };
+
+  PHILOX_HOST_DEVICE uint64_t getSeed() const { return uint64_t(key[0]) | (uint64_t(key[1]) << 32); };
+
+  // Start the stream of draws for a (time, site) pair. Different streams at
+  // the same position are independent, e.g. one for the bias and one for the
+  // number of particles that move.
+  PHILOX_HOST_DEVICE void setPosition(const uint64_t time, const uint64_t site, const uint32_t stream = 0)
+  {
+    ctr[0] = stream << 24;
+    ctr[1] = uint32_t(time);
+    ctr[2] = uint32_t(site);
+    ctr[3] = uint32_t(site >> 32);
+    next = 2;
+  };
+
+  PHILOX_HOST_DEVICE static constexpr result_type min() { return 0; };
+  PHILOX_HOST_DEVICE static constexpr result_type max() { return UINT64_MAX; };
+
+  PHILOX_HOST_DEVICE result_type operator()()
+  {
+    if (next == 2)
+    {
+      philox4x32(ctr, key, block);
+      ctr[0] += 1;
+      next = 0;
+    }
+    result_type value = uint64_t(block[2 * next]) | (uint64_t(block[2 * next + 1]) << 32);
+    next += 1;
+    return value;
+  };
+};
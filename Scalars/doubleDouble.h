@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <ostream>
+
+/*
+Unevaluated sum of two doubles, hi + lo with |lo| <= ulp(hi) / 2. This gives
+~106 bits of precision (float128 has 113) with the range of a double, but
+every operation is a handful of ordinary double adds and multiplies instead
+of a call into libquadmath.
+
+The arithmetic is built from error free transformations: twoSum gives the
+exact rounding error of an add and twoProd the exact rounding error of a
+multiply (one fma when the target has it, compile.sh builds with
+-march=native). +, -, * and / have no branches, so a loop over independent
+values (e.g. the lanes of DiffusionTimeCDFBatch) can still be vectorized by
+the compiler. exp, log and sqrt are scalar.
+
+The range is still only that of a double, a far tail below ~1e-308 is flushed
+to 0 where float128 would resolve it (use ScaledDouble for that). The edges of
+a DiffusionPDF then sit further in, and with the sequential RNG (which draws
+one bias per site between the edges) the realization differs from the
+float128 one from that point on. With the counter RNG they agree to ~1e-30.
+
+None of this survives -ffast-math (or anything else that lets the compiler
+reassociate), the error terms would be optimized away to 0.
+*/
+
+namespace doubleDouble_detail
+{
+  // s + err == a + b exactly
+  inline double twoSum(const double a, const double b, double &err)
+  {
+    double s = a + b;
+    double bb = s - a;
+    err = (a - (s - bb)) + (b - bb);
+    return s;
+  }
+
+  // Same as twoSum if |a| >= |b|
+  inline double quickTwoSum(const double a, const double b, double &err)
+  {
+    double s = a + b;
+    err = b - (s - a);
+    return s;
+  }
+
+  // p + err == a * b exactly
+  inline double twoProd(const double a, const double b, double &err)
+  {
+    double p = a * b;
+#ifdef FP_FAST_FMA
+    err = std::fma(a, b, -p);
+#else
+    // Dekker's split, std::fma would be a (slow) library call here
+    const double splitter = 134217729.0; // 2^27 + 1
+    double t = splitter * a;
+    double aHi = t - (t - a);
+    double aLo = a - aHi;
+    t = splitter * b;
+    double bHi = t - (t - b);
+    double bLo = b - bHi;
+    err = ((aHi * bHi - p) + aHi * bLo + aLo * bHi) + aLo * bLo;
+#endif
+    return p;
+  }
+
+  // log(2) split into a double and the remainder
+  constexpr double log2Hi = 6.931471805599452862e-01;
+  constexpr double log2Lo = 2.319046813846299558e-17;
+} // namespace doubleDouble_detail
+
+class DoubleDouble
+{
+private:
+  double hi;
+  double lo;
+
+  static DoubleDouble normalized(const double a, const double b)
+  {
+    DoubleDouble x;
+    x.hi = doubleDouble_detail::quickTwoSum(a, b, x.lo);
+    return x;
+  };
+
+public:
+  DoubleDouble() : hi(0), lo(0){};
+  DoubleDouble(double x) : hi(x), lo(0){};
+  // Parts have to already be normalized, i.e. hi == hi + lo in double
+  DoubleDouble(double _hi, double _lo) : hi(_hi), lo(_lo){};
+
+  // Convert from/to a wider type, e.g. boost::multiprecision::float128.
+  template <class T>
+  static DoubleDouble fromReal(const T &x)
+  {
+    double high = static_cast<double>(x);
+    if (!std::isfinite(high))
+    {
+      return DoubleDouble(high);
+    }
+    return normalized(high, static_cast<double>(x - T(high)));
+  };
+
+  template <class T>
+  T toReal() const
+  {
+    return T(hi) + T(lo);
+  };
+
+  double high() const { return hi; };
+  double low() const { return lo; };
+
+  explicit operator double() const { return hi; };
+  explicit operator long double() const { return (long double)hi + (long double)lo; };
+
+  DoubleDouble operator-() const { return DoubleDouble(-hi, -lo); };
+
+  DoubleDouble &operator+=(const DoubleDouble &other)
+  {
+    using namespace doubleDouble_detail;
+    // Both parts are summed exactly so cancellation in hi doesn't lose lo
+    double sErr, tErr;
+    double s = twoSum(hi, other.hi, sErr);
+    double t = twoSum(lo, other.lo, tErr);
+    sErr += t;
+    s = quickTwoSum(s, sErr, sErr);
+    sErr += tErr;
+    hi = quickTwoSum(s, sErr, lo);
+    return *this;
+  };
+
+  DoubleDouble &operator-=(const DoubleDouble &other) { return *this += -other; };
+
+  DoubleDouble &operator*=(const DoubleDouble &other)
+  {
+    using namespace doubleDouble_detail;
+    double err;
+    double p = twoProd(hi, other.hi, err);
+    err += hi * other.lo + lo * other.hi;
+    hi = quickTwoSum(p, err, lo);
+    return *this;
+  };
+
+  DoubleDouble &operator/=(const DoubleDouble &other)
+  {
+    // Long division, each quotient digit corrects the remainder of the last
+    double q1 = hi / other.hi;
+    DoubleDouble r = *this - other * DoubleDouble(q1);
+    double q2 = r.hi / other.hi;
+    r -= other * DoubleDouble(q2);
+    double q3 = r.hi / other.hi;
+    return *this = normalized(q1, q2) + DoubleDouble(q3);
+  };
+
+  friend DoubleDouble operator+(DoubleDouble a, const DoubleDouble &b) { return a += b; };
+  friend DoubleDouble operator-(DoubleDouble a, const DoubleDouble &b) { return a -= b; };
+  friend DoubleDouble operator*(DoubleDouble a, const DoubleDouble &b) { return a *= b; };
+  friend DoubleDouble operator/(DoubleDouble a, const DoubleDouble &b) { return a /= b; };
+
+  // The parts are normalized so hi decides unless it's tied
+  friend bool operator==(const DoubleDouble &a, const DoubleDouble &b) { return a.hi == b.hi && a.lo == b.lo; };
+  friend bool operator!=(const DoubleDouble &a, const DoubleDouble &b) { return !(a == b); };
+  friend bool operator<(const DoubleDouble &a, const DoubleDouble &b) { return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo); };
+  friend bool operator>(const DoubleDouble &a, const DoubleDouble &b) { return b < a; };
+  friend bool operator<=(const DoubleDouble &a, const DoubleDouble &b) { return !(b < a); };
+  friend bool operator>=(const DoubleDouble &a, const DoubleDouble &b) { return !(a < b); };
+
+  friend bool isnan(const DoubleDouble &x) { return std::isnan(x.hi); };
+  friend bool isinf(const DoubleDouble &x) { return std::isinf(x.hi); };
+  friend DoubleDouble abs(const DoubleDouble &x) { return x.hi < 0 ? -x : x; };
+  friend DoubleDouble fabs(const DoubleDouble &x) { return abs(x); };
+
+  friend DoubleDouble ldexp(const DoubleDouble &x, int exponent)
+  {
+    return DoubleDouble(std::ldexp(x.hi, exponent), std::ldexp(x.lo, exponent));
+  };
+
+  friend DoubleDouble round(const DoubleDouble &x)
+  {
+    double r = std::round(x.hi);
+    if (r == x.hi)
+    {
+      // hi is already an integer, the fraction is all in lo
+      return normalized(r, std::round(x.lo));
+    }
+    // hi is exactly halfway, lo says which side the value is on
+    if (std::fabs(r - x.hi) == 0.5)
+    {
+      if (r > x.hi && x.lo < 0)
+      {
+        r -= 1;
+      }
+      else if (r < x.hi && x.lo > 0)
+      {
+        r += 1;
+      }
+    }
+    return DoubleDouble(r);
+  };
+
+  friend DoubleDouble sqrt(const DoubleDouble &x)
+  {
+    if (!(x.hi > 0) || std::isinf(x.hi))
+    {
+      return DoubleDouble(std::sqrt(x.hi));
+    }
+    // One Newton step from the double square root doubles the precision
+    using namespace doubleDouble_detail;
+    double a = std::sqrt(x.hi);
+    double err;
+    double a2 = twoProd(a, a, err);
+    DoubleDouble residual = x - DoubleDouble(a2, err);
+    return normalized(a, residual.hi / (2 * a));
+  };
+
+  friend DoubleDouble exp(const DoubleDouble &x)
+  {
+    using namespace doubleDouble_detail;
+    if (x.hi > 709.79)
+    {
+      return DoubleDouble(HUGE_VAL);
+    }
+    if (x.hi < -745.14)
+    {
+      return DoubleDouble(0.0);
+    }
+    if (std::isnan(x.hi))
+    {
+      return x;
+    }
+    // exp(x) = 2^k * exp(r)^1024 with |r| <= log(2) / 2048, so the series for
+    // exp(r) - 1 is done to double double precision after 9 terms
+    const int squarings = 10;
+    double k = std::round(x.hi / log2Hi);
+    DoubleDouble r = x - DoubleDouble(log2Hi, log2Lo) * DoubleDouble(k);
+    r = ldexp(r, -squarings);
+
+    DoubleDouble term = r;
+    DoubleDouble sum = r;
+    for (int n = 2; n <= 9; n++)
+    {
+      term = term * r / DoubleDouble(n);
+      sum += term;
+    }
+    // Square as exp(2r) - 1 = s * (s + 2) so the small value isn't lost to 1
+    for (int i = 0; i < squarings; i++)
+    {
+      sum = sum * (sum + DoubleDouble(2.0));
+    }
+    return ldexp(sum + DoubleDouble(1.0), static_cast<int>(k));
+  };
+
+  friend DoubleDouble log(const DoubleDouble &x)
+  {
+    if (!(x.hi > 0) || std::isinf(x.hi))
+    {
+      return DoubleDouble(std::log(x.hi));
+    }
+    // Newton on exp(y) = x from the double log
+    DoubleDouble y(std::log(x.hi));
+    return y + x * exp(-y) - DoubleDouble(1.0);
+  };
+
+  friend DoubleDouble pow(const DoubleDouble &x, int n)
+  {
+    DoubleDouble result(1.0);
+    DoubleDouble base = n < 0 ? DoubleDouble(1.0) / x : x;
+    for (unsigned int k = n < 0 ? -n : n; k > 0; k >>= 1)
+    {
+      if (k & 1)
+      {
+        result *= base;
+      }
+      base *= base;
+    }
+    return result;
+  };
+
+  friend DoubleDouble pow(const DoubleDouble &x, const DoubleDouble &y)
+  {
+    return exp(y * log(x));
+  };
+
+  friend std::ostream &operator<<(std::ostream &os, const DoubleDouble &x)
+  {
+    // Only to long double precision, use toReal for all the digits
+    return os << static_cast<long double>(x);
+  };
+};
+
+namespace std
+{
+  template <>
+  class numeric_limits<DoubleDouble> : public numeric_limits<double>
+  {
+  public:
+    // Used to tag checkpoints and recordings, so it differs from float128
+    static constexpr int digits = 106;
+    static constexpr int digits10 = 31;
+    static constexpr int max_digits10 = 33;
+
+    static DoubleDouble epsilon() { return DoubleDouble(std::ldexp(1.0, -104)); };
+    static DoubleDouble min() { return DoubleDouble(numeric_limits<double>::min()); };
+    static DoubleDouble max() { return DoubleDouble(numeric_limits<double>::max()); };
+    static DoubleDouble lowest() { return DoubleDouble(numeric_limits<double>::lowest()); };
+    static DoubleDouble infinity() { return DoubleDouble(numeric_limits<double>::infinity()); };
+    static DoubleDouble quiet_NaN() { return DoubleDouble(numeric_limits<double>::quiet_NaN()); };
+  };
+} // namespace std
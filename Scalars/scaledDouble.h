@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cmath>
+#include <ostream>
+
+/*
+Scalar with a double mantissa and a separate base-2 exponent, so the value is
+m * 2^e. This gives ~53 bits of precision (same as a double) but practically
+unlimited range, which is what we need to resolve the far tail of the
+occupancy at large N without paying for software quad arithmetic.
+
+The exponent is only ever moved in steps of 2^chunkBits and the mantissa is
+kept in [2^-chunkBits, 2^chunkBits). That way values of similar size share the
+same exponent, so most adds and multiplies are a plain double operation plus
+an integer compare, and rescaling is an exact multiply by a power of two.
+*/
+
+namespace scaledDouble_detail
+{
+  constexpr double pow2(int n)
+  {
+    return n == 0 ? 1.0 : (n > 0 ? 2.0 * pow2(n - 1) : 0.5 * pow2(n + 1));
+  }
+
+  constexpr int chunkBits = 256;
+  constexpr double scaleUp = pow2(chunkBits);
+  constexpr double scaleDown = pow2(-chunkBits);
+} // namespace scaledDouble_detail
+
+class ScaledDouble
+{
+private:
+  double m;
+  int e;
+
+  void normalize()
+  {
+    using namespace scaledDouble_detail;
+    if (m == 0 || !std::isfinite(m))
+    {
+      e = 0;
+      return;
+    }
+    while (std::fabs(m) >= scaleUp)
+    {
+      m *= scaleDown;
+      e += chunkBits;
+    }
+    while (std::fabs(m) < scaleDown)
+    {
+      m *= scaleUp;
+      e -= chunkBits;
+    }
+  };
+
+  // Mantissa of x expressed with exponent exp >= x.e
+  static double alignTo(const ScaledDouble &x, int exp)
+  {
+    using namespace scaledDouble_detail;
+    double mantissa = x.m;
+    // Anything this far down is below double precision
+    for (int diff = exp - x.e; diff > 0 && mantissa != 0; diff -= chunkBits)
+    {
+      if (diff > 4 * chunkBits)
+      {
+        return 0;
+      }
+      mantissa *= scaleDown;
+    }
+    return mantissa;
+  };
+
+public:
+  ScaledDouble() : m(0), e(0){};
+  ScaledDouble(double x) : m(x), e(0) { normalize(); };
+  ScaledDouble(double mantissa, int exponent) : m(mantissa), e(0)
+  {
+    // Put the exponent on a chunk boundary so it can be shared
+    int rem = exponent % scaledDouble_detail::chunkBits;
+    m = std::ldexp(mantissa, rem);
+    e = exponent - rem;
+    normalize();
+  };
+
+  // Convert from/to a wider type, e.g. boost::multiprecision::float128.
+  template <class T>
+  static ScaledDouble fromReal(const T &x)
+  {
+    using std::frexp;
+    int exponent;
+    T fraction = frexp(x, &exponent);
+    return ScaledDouble(static_cast<double>(fraction), exponent);
+  };
+
+  template <class T>
+  T toReal() const
+  {
+    using std::ldexp;
+    return ldexp(T(m), e);
+  };
+
+  double mantissa() const { return m; };
+  int exponent() const { return e; };
+
+  explicit operator double() const { return std::ldexp(m, e); };
+  explicit operator long double() const { return std::ldexp((long double)m, e); };
+
+  ScaledDouble operator-() const
+  {
+    ScaledDouble x = *this;
+    x.m = -x.m;
+    return x;
+  };
+
+  ScaledDouble &operator+=(const ScaledDouble &other)
+  {
+    if (other.m == 0)
+    {
+      return *this;
+    }
+    if (m == 0)
+    {
+      return *this = other;
+    }
+    if (e == other.e)
+    {
+      m += other.m;
+    }
+    else if (e > other.e)
+    {
+      m += alignTo(other, e);
+    }
+    else
+    {
+      m = alignTo(*this, other.e) + other.m;
+      e = other.e;
+    }
+    normalize();
+    return *this;
+  };
+
+  ScaledDouble &operator-=(const ScaledDouble &other) { return *this += -other; };
+
+  ScaledDouble &operator*=(const ScaledDouble &other)
+  {
+    m *= other.m;
+    e += other.e;
+    normalize();
+    return *this;
+  };
+
+  ScaledDouble &operator/=(const ScaledDouble &other)
+  {
+    m /= other.m;
+    e -= other.e;
+    normalize();
+    return *this;
+  };
+
+  friend ScaledDouble operator+(ScaledDouble a, const ScaledDouble &b) { return a += b; };
+  friend ScaledDouble operator-(ScaledDouble a, const ScaledDouble &b) { return a -= b; };
+  friend ScaledDouble operator*(ScaledDouble a, const ScaledDouble &b) { return a *= b; };
+  friend ScaledDouble operator/(ScaledDouble a, const ScaledDouble &b) { return a /= b; };
+
+  // Sign of a - b
+  friend int compare(const ScaledDouble &a, const ScaledDouble &b)
+  {
+    double diff = (a - b).m;
+    return (diff > 0) - (diff < 0);
+  };
+
+  friend bool operator==(const ScaledDouble &a, const ScaledDouble &b) { return compare(a, b) == 0; };
+  friend bool operator!=(const ScaledDouble &a, const ScaledDouble &b) { return !(a == b); };
+  friend bool operator<(const ScaledDouble &a, const ScaledDouble &b) { return compare(a, b) < 0; };
+  friend bool operator>(const ScaledDouble &a, const ScaledDouble &b) { return compare(a, b) > 0; };
+  friend bool operator<=(const ScaledDouble &a, const ScaledDouble &b) { return compare(a, b) <= 0; };
+  friend bool operator>=(const ScaledDouble &a, const ScaledDouble &b) { return compare(a, b) >= 0; };
+
+  friend bool isnan(const ScaledDouble &x) { return std::isnan(x.m); };
+  friend bool isinf(const ScaledDouble &x) { return std::isinf(x.m); };
+  friend ScaledDouble abs(const ScaledDouble &x) { return x.m < 0 ? -x : x; };
+  friend ScaledDouble fabs(const ScaledDouble &x) { return abs(x); };
+
+  friend ScaledDouble round(const ScaledDouble &x)
+  {
+    int exponent;
+    std::frexp(x.m, &exponent);
+    exponent += x.e;
+    // Already an integer if there are no bits below 1, and rounds to 0 if < 0.25
+    if (exponent > 53)
+    {
+      return x;
+    }
+    if (exponent < -1)
+    {
+      return ScaledDouble(0.0);
+    }
+    return ScaledDouble(std::round(std::ldexp(x.m, x.e)));
+  };
+
+  friend ScaledDouble sqrt(const ScaledDouble &x)
+  {
+    // e is always a multiple of chunkBits so it's even
+    return ScaledDouble(std::sqrt(x.m), x.e / 2);
+  };
+
+  friend ScaledDouble log(const ScaledDouble &x)
+  {
+    return ScaledDouble(std::log(x.m) + x.e * std::log(2.0));
+  };
+
+  friend ScaledDouble exp(const ScaledDouble &x)
+  {
+    // exp(x) = 2^(x * log2(e)) = 2^f * 2^k for the integer part k
+    double y = static_cast<double>(x) / std::log(2.0);
+    if (y > 2e9)
+    {
+      return ScaledDouble(HUGE_VAL);
+    }
+    if (y < -2e9)
+    {
+      return ScaledDouble(0.0);
+    }
+    double k = std::floor(y);
+    return ScaledDouble(std::exp2(y - k), static_cast<int>(k));
+  };
+
+  friend ScaledDouble pow(const ScaledDouble &x, int n)
+  {
+    ScaledDouble result(1.0);
+    ScaledDouble base = n < 0 ? ScaledDouble(1.0) / x : x;
+    for (unsigned int k = n < 0 ? -n : n; k > 0; k >>= 1)
+    {
+      if (k & 1)
+      {
+        result *= base;
+      }
+      base *= base;
+    }
+    return result;
+  };
+
+  friend ScaledDouble pow(const ScaledDouble &x, const ScaledDouble &y)
+  {
+    return exp(y * log(x));
+  };
+
+  friend std::ostream &operator<<(std::ostream &os, const ScaledDouble &x)
+  {
+    // Print as a mantissa and power of 10 so values outside double range work
+    if (x.m == 0 || !std::isfinite(x.m))
+    {
+      return os << x.m;
+    }
+    double log10Value = std::log10(std::fabs(x.m)) + x.e * std::log10(2.0);
+    double power = std::floor(log10Value);
+    double mantissa = std::pow(10.0, log10Value - power);
+    return os << (x.m < 0 ? -mantissa : mantissa) << "e" << power;
+  };
+};
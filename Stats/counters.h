@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+
+/*
+Counters and per phase timers the engines keep on their hot paths, read with
+getStats(). A phase costs a pair of clock reads per step (per block of
+biasBlockSize sites for the RNG and the site update) and a counter is an add,
+which is nothing next to the work being timed.
+
+Build with -DRWRE_NO_STATS to take all of it out: statsEnabled is then false,
+so every method below is an empty inline function and no clock is read.
+
+With threads every chunk keeps its own EngineStats, merged into the engine's
+after the step, so the RNG and update times are summed over threads and can
+add up to more than the step time. Stats aren't saved in checkpoints, they
+describe the run rather than the system.
+*/
+
+#ifdef RWRE_NO_STATS
+constexpr bool statsEnabled = false;
+#else
+constexpr bool statsEnabled = true;
+#endif
+
+namespace stats
+{
+  enum Counter
+  {
+    Steps,
+    SitesUpdated,
+    BiasDraws,
+    // Particles moved in the discrete mode of DiffusionPDF by which tier of
+    // toNextSite they went through (< smallCutoff, between, > largeCutoff)
+    BinomialDraws,
+    GaussianDraws,
+    MeanMoves,
+    // Sites in the window (PDF) or active band (CDF) of the last step
+    WindowWidth,
+    MaxWindowWidth,
+    QuantileCalls,
+    GumbelCalls,
+    // Times the full storage occupancy of DiffusionPDF ran out and doubled
+    OccupancyGrowths,
+    numCounters
+  };
+
+  enum Timer
+  {
+    StepTime,
+    RNGTime,
+    UpdateTime,
+    // Finding the new edges (PDF) or moving the active band (CDF)
+    EdgeTime,
+    QuantileTime,
+    GumbelTime,
+    CheckpointTime,
+    numTimers
+  };
+
+  const char *const counterNames[numCounters] = {
+      "steps", "sitesUpdated", "biasDraws", "binomialDraws", "gaussianDraws",
+      "meanMoves", "windowWidth", "maxWindowWidth", "quantileCalls", "gumbelCalls",
+      "occupancyGrowths"};
+
+  const char *const timerNames[numTimers] = {
+      "stepSeconds", "rngSeconds", "updateSeconds", "edgeSeconds",
+      "quantileSeconds", "gumbelSeconds", "checkpointSeconds"};
+} // namespace stats
+
+class EngineStats
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+private:
+  double counts[stats::numCounters] = {};
+  double seconds[stats::numTimers] = {};
+  // Print every logInterval steps, 0 for never
+  unsigned long int logInterval = 0;
+
+public:
+  void add(const stats::Counter counter, const double x)
+  {
+    if (statsEnabled)
+    {
+      counts[counter] += x;
+    }
+  };
+
+  // Time a phase by hand: start = now() ... addTime(timer, start)
+  static Clock::time_point now() { return statsEnabled ? Clock::now() : Clock::time_point(); };
+
+  void addTime(const stats::Timer timer, const Clock::time_point start)
+  {
+    if (statsEnabled)
+    {
+      seconds[timer] += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+  };
+
+  // A step over width sites is done, time is the time it got to
+  void step(const unsigned long int time, const double width)
+  {
+    if (!statsEnabled)
+    {
+      return;
+    }
+    counts[stats::Steps] += 1;
+    counts[stats::SitesUpdated] += width;
+    counts[stats::WindowWidth] = width;
+    counts[stats::MaxWindowWidth] = std::max(counts[stats::MaxWindowWidth], width);
+    if (logInterval && static_cast<unsigned long int>(counts[stats::Steps]) % logInterval == 0)
+    {
+      log(std::cout, time);
+    }
+  };
+
+  // Add what a chunk of a threaded step counted
+  void merge(const EngineStats &other)
+  {
+    if (!statsEnabled)
+    {
+      return;
+    }
+    for (int i = 0; i < stats::numCounters; i++)
+    {
+      counts[i] += other.counts[i];
+    }
+    for (int i = 0; i < stats::numTimers; i++)
+    {
+      seconds[i] += other.seconds[i];
+    }
+  };
+
+  void reset()
+  {
+    std::fill(counts, counts + stats::numCounters, 0.0);
+    std::fill(seconds, seconds + stats::numTimers, 0.0);
+  };
+
+  void setLogInterval(const unsigned long int steps) { logInterval = steps; };
+  unsigned long int getLogInterval() { return logInterval; };
+
+  // Empty if stats are compiled out
+  std::map<std::string, double> get() const
+  {
+    std::map<std::string, double> values;
+    if (!statsEnabled)
+    {
+      return values;
+    }
+    for (int i = 0; i < stats::numCounters; i++)
+    {
+      values[stats::counterNames[i]] = counts[i];
+    }
+    for (int i = 0; i < stats::numTimers; i++)
+    {
+      values[stats::timerNames[i]] = seconds[i];
+    }
+    return values;
+  };
+
+  // One line of everything that isn't 0
+  void log(std::ostream &os, const unsigned long int time) const
+  {
+    os << "Stats at time " << time << ":";
+    for (auto &value : get())
+    {
+      if (value.second != 0)
+      {
+        os << " " << value.first << "=" << value.second;
+      }
+    }
+    os << std::endl;
+  };
+};
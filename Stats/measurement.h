@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+/*
+Everything a save time asks an engine for, measured in one pass down from the
+top of the occupancy / CDF with DiffusionPDF::measure or
+DiffusionTimeCDF::measure instead of one pass (and sometimes a copy) per
+observable. The pass stops as soon as every observable has what it needs.
+
+Results come back in the order they're given in the plan. Quantiles and Pb
+are what findQuantiles and getPbAtV return (Pb as with setTailSums for the
+PDF, the sum is taken from the top down). The Gumbel variances are the same
+sums as gumbelVarianceFused in stat.h taken in the other order, so they agree
+with getGumbelVariance to rounding. For the PDF the complementary CDF comes
+from the sum above each site rather than 1 - the sum below it, which is more
+accurate far in the tail where the variances for large N live.
+*/
+template <class RealType>
+struct MeasurementPlan
+{
+  std::vector<RealType> quantiles;
+  std::vector<double> velocities;
+  std::vector<RealType> nParticles;
+};
+
+// Position is double for the PDF (distance from the center) and unsigned long
+// int for the CDF (2n + 2 - t) like their findQuantiles
+template <class RealType, class Position>
+struct Measurement
+{
+  std::vector<Position> quantiles;
+  std::vector<RealType> pb;
+  std::vector<RealType> gumbelVariance;
+};
+
+/*
+Variance of the max of N particles for each N, fed one site at a time from
+the top down with the weight at or above x, c = norm P(position >= x) (the
+PDF passes its running sum and nParticles, the CDF the CDF and 1, so neither
+divides per site). The probability the max is at x is
+exp(-N c(x + 2)) - exp(-N c(x)), one exp per site and N. The moments follow
+the current site down until the pass crosses N c = 1 (the pivot
+gumbelVarianceFused uses) and are then taken about that site, so they stay
+small where most of the mass is without knowing the pivot in advance. An N is
+done once exp(-N c) underflows to 0.
+*/
+template <class RealType>
+class DescendingGumbelVariance
+{
+private:
+  struct Accumulator
+  {
+    // N / norm
+    RealType scale;
+    // c at or below this has 1 - c scale == 1
+    RealType cSkip;
+    RealType ePrev = 1;
+    RealType S0 = 0;
+    RealType S1 = 0;
+    RealType S2 = 0;
+    long int pivot;
+    bool crossed = false;
+    bool done = false;
+  };
+  std::vector<Accumulator> accumulators;
+  unsigned long int numDone = 0;
+  // Below this exp(-y) is 1 - y + y^2 / 2 - y^3 / 6 to rounding
+  RealType ySeries = 1;
+
+public:
+  DescendingGumbelVariance(const std::vector<RealType> &nParticles, const long int xTop, const RealType norm = 1)
+  {
+    accumulators.resize(nParticles.size());
+    for (unsigned long int j = 0; j < nParticles.size(); j++)
+    {
+      RealType scale = nParticles[j] / norm;
+      accumulators[j].scale = scale;
+      accumulators[j].pivot = xTop;
+      // Found once here so the top of the occupancy, where c can be
+      // subnormal, is passed over with a comparison instead of arithmetic
+      RealType cSkip = 1 / scale;
+      while (cSkip > 0 && 1 - cSkip * scale != 1)
+      {
+        cSkip /= 2;
+      }
+      accumulators[j].cSkip = cSkip;
+    }
+    while (1 + ySeries * ySeries * ySeries * ySeries / 24 != 1)
+    {
+      ySeries /= 2;
+    }
+  };
+
+  bool done() const { return numDone == accumulators.size(); };
+
+  void add(const long int x, const RealType &c)
+  {
+    using std::exp;
+    for (auto &a : accumulators)
+    {
+      if (a.done)
+      {
+        continue;
+      }
+      if (c <= a.cSkip)
+      {
+        a.pivot = x;
+        continue;
+      }
+      RealType y = c * a.scale;
+      if (!a.crossed)
+      {
+        // Move the moments so far down to x, a site at a time so the shift
+        // never cancels much
+        if (a.S0 != 0)
+        {
+          RealType shift = RealType(a.pivot - x);
+          a.S2 += 2 * shift * a.S1 + shift * shift * a.S0;
+          a.S1 += shift * a.S0;
+        }
+        a.pivot = x;
+        a.crossed = (y > 1);
+      }
+      // exp(-y) is between 1 - y and 1, so it's 1 too and so is ePrev: the
+      // top of the occupancy adds nothing (gumbelVarianceFused doesn't stream
+      // over it either)
+      if (1 - y == 1)
+      {
+        continue;
+      }
+      // Most of the sites that aren't skipped are still far enough up that
+      // the series does, which is much cheaper than exp for the wide types
+      RealType e = (y < ySeries) ? 1 - y * (1 - y * (RealType(0.5) - y / 6)) : exp(-y);
+      RealType p = a.ePrev - e;
+      a.ePrev = e;
+      RealType dx = RealType(x - a.pivot);
+      a.S0 += p;
+      a.S1 += p * dx;
+      a.S2 += p * dx * dx;
+      if (e == 0)
+      {
+        a.done = true;
+        numDone += 1;
+      }
+    }
+  };
+
+  std::vector<RealType> variances() const
+  {
+    std::vector<RealType> vars(accumulators.size());
+    for (unsigned long int j = 0; j < accumulators.size(); j++)
+    {
+      const Accumulator &a = accumulators[j];
+      // Same as gumbelVarianceFused, the PDF isn't renormalized
+      RealType d = RealType(a.pivot) * (a.S0 - 1) + a.S1;
+      vars[j] = a.S2 - 2 * d * a.S1 + d * d * a.S0;
+    }
+    return vars;
+  };
+};
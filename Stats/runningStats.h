@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+Running mean and variance of a stream of values (Welford's algorithm), so an
+ensemble can be reduced without keeping every realization around. Two
+accumulators can be merged (Chan et al.) which gives the same result as if
+all the values had been pushed into one.
+
+getVariance() is the population variance sum((x - mean)^2) / count, the same
+as np.var's default.
+*/
+template <class RealType>
+class RunningStats
+{
+private:
+  unsigned long int count = 0;
+  RealType mean = 0;
+  RealType M2 = 0;
+
+public:
+  RunningStats(){};
+  RunningStats(const unsigned long int _count, const RealType _mean, const RealType _M2)
+      : count(_count), mean(_mean), M2(_M2){};
+
+  void push(const RealType x)
+  {
+    count += 1;
+    RealType delta = x - mean;
+    mean += delta / RealType(count);
+    M2 += delta * (x - mean);
+  };
+
+  void merge(const RunningStats &other)
+  {
+    if (other.count == 0)
+    {
+      return;
+    }
+    if (count == 0)
+    {
+      *this = other;
+      return;
+    }
+    RealType n1 = RealType(count);
+    RealType n2 = RealType(other.count);
+    RealType n = n1 + n2;
+    RealType delta = other.mean - mean;
+    mean += delta * n2 / n;
+    M2 += other.M2 + delta * delta * n1 * n2 / n;
+    count += other.count;
+  };
+
+  unsigned long int getCount() const { return count; };
+  RealType getMean() const { return mean; };
+  RealType getM2() const { return M2; };
+  RealType getVariance() const
+  {
+    if (count == 0)
+    {
+      return 0;
+    }
+    return M2 / RealType(count);
+  };
+};
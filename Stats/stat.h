@@ -1,11 +1,15 @@
+#pragma once
+
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
 #include <vector>
 #include <iostream>
 #include <utility>
 #include <string>
 
-template<typename T>
-std::vector<T> slice(std::vector<T> &v, const unsigned long int m, const unsigned long int n){
+template<typename T, class Alloc>
+std::vector<T> slice(std::vector<T, Alloc> &v, const unsigned long int m, const unsigned long int n){
   std::vector<T> vec(n - m + 1);
   std::copy(v.begin() + m, v.begin() + n + 1, vec.begin());
   return vec;
@@ -31,6 +35,7 @@ RealType calculateMeanFromPDF(std::vector<x_numeric> xvals, std::vector<RealType
 template <class RealType, class x_numeric>
 RealType calculateVarianceFromPDF(std::vector<x_numeric> xvals, std::vector<RealType> PDF){
   checkVectorLengths(xvals, PDF);
+  using std::pow; // ADL picks up pow for multiprecision types
   RealType mean = calculateMeanFromPDF(xvals, PDF);
   RealType var = 0;
   for (unsigned long int i=0; i < PDF.size(); i++){
@@ -58,6 +63,7 @@ RealType calculateMeanFromCDF(std::vector<x_numeric> xvals, std::vector<RealType
 
 template <class RealType>
 std::vector<RealType> getDiscretePDF(std::vector<RealType> comp_cdf, RealType nParticles){
+  using std::exp;
   std::vector<RealType> pdf(comp_cdf.size()-1);
   RealType cdf_current, cdf_prev;
   for (unsigned long int i=1; i < comp_cdf.size(); i++){
@@ -71,6 +77,7 @@ std::vector<RealType> getDiscretePDF(std::vector<RealType> comp_cdf, RealType nP
 template <class RealType>
 std::vector<std::vector<RealType> > getDiscretePDF(std::vector<RealType> comp_cdf, std::vector<RealType> nParticles){
   // Need to construct a 2D array where each element is a PDF for a different particle.
+  using std::exp;
   std::vector<std::vector<RealType> > pdf(nParticles.size(), std::vector<RealType>(comp_cdf.size()-1));
 
   RealType cdf_current, cdf_prev;
@@ -119,3 +126,103 @@ RealType getGumbelVariancePDF(std::vector<x_numeric> xvals, std::vector<RealType
   std::vector<RealType> comp_cdf = pdf_to_comp_cdf(pdf, norm);
   return getGumbelVarianceCDF(xvals, comp_cdf, nParticles);
 }
+
+// Smallest i in [lo, hi) with pred(i) (or hi if there isn't one) for a pred
+// that goes from false to true once
+template <class Pred>
+unsigned long int firstTrue(unsigned long int lo, unsigned long int hi, const Pred &pred){
+  while (lo < hi){
+    unsigned long int mid = lo + (hi - lo) / 2;
+    if (pred(mid)){
+      hi = mid;
+    }
+    else{
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+/*
+Gumbel variance for every N in nParticles in one pass over a complementary
+CDF, without building the discrete PDFs. compCDF(i) for i in [0, numX] is
+the complementary CDF at x_i = x0 + 2 i, with compCDF(numX) the probability
+past the last x (usually 0). It's taken as a callable so the engines can pass
+their buffers in place. Gives the same as getGumbelVarianceCDF up to rounding.
+
+The discrete PDF of the max of N is exp(-N compCDF(i+1)) - exp(-N compCDF(i))
+so every exp is shared by two neighbouring PDF values. Since compCDF doesn't
+increase, exp(-N compCDF) only goes up from 0 to 1, and the sites where it
+is still exactly 0 or already exactly 1 add nothing. They're found with a
+binary search instead of being streamed over (compCDF has to be non
+increasing for that, as any complementary CDF is). Moments are taken about where
+N compCDF crosses 1 (near the mean of the max) so the single pass is stable.
+*/
+template <class RealType, class CompCDF>
+std::vector<RealType> gumbelVarianceFused(const CompCDF &compCDF,
+                                          const unsigned long int numX,
+                                          const long int x0,
+                                          const std::vector<RealType> &nParticles){
+  using std::exp;
+  const unsigned long int numN = nParticles.size();
+  std::vector<RealType> vars(numN, RealType(0));
+  if (numX == 0){
+    return vars;
+  }
+
+  // PDF values [first[j], last[j]] are the only ones that can be non zero
+  std::vector<unsigned long int> first(numN), last(numN);
+  std::vector<long int> pivot(numN);
+  std::vector<RealType> ePrev(numN), S0(numN, RealType(0)), S1(numN, RealType(0)), S2(numN, RealType(0));
+  unsigned long int streamFirst = numX, streamLast = 0;
+  for (unsigned long int j = 0; j < numN; j++){
+    const RealType N = nParticles[j];
+    unsigned long int nonZero = firstTrue(0, numX + 1, [&](unsigned long int i){ return exp(-compCDF(i) * N) > 0; });
+    // Only cut the top if it ends at exactly 1, a complementary CDF that's
+    // gone negative from rounding (1 - sum / norm) keeps changing to the end
+    unsigned long int one = numX + 1;
+    if (exp(-compCDF(numX) * N) == 1){
+      one = firstTrue(0, numX + 1, [&](unsigned long int i){ return exp(-compCDF(i) * N) >= 1; });
+    }
+    first[j] = (nonZero == 0) ? 0 : nonZero - 1;
+    last[j] = std::min(one, numX) - 1;
+    if (nonZero > numX || one == 0){
+      // Nothing but 0s or nothing but 1s, so the PDF is all 0
+      first[j] = 1;
+      last[j] = 0;
+      continue;
+    }
+    unsigned long int cross = firstTrue(0, numX + 1, [&](unsigned long int i){ return compCDF(i) * N <= 1; });
+    pivot[j] = x0 + 2 * (long int)std::min(std::max<unsigned long int>(cross, 1) - 1, numX - 1);
+    ePrev[j] = exp(-compCDF(first[j]) * N);
+    streamFirst = std::min(streamFirst, first[j]);
+    streamLast = std::max(streamLast, last[j]);
+  }
+
+  for (unsigned long int i = streamFirst; i <= streamLast && streamFirst <= streamLast; i++){
+    const RealType next = compCDF(i + 1);
+    const long int x = x0 + 2 * (long int)i;
+    for (unsigned long int j = 0; j < numN; j++){
+      if (i < first[j] || i > last[j]){
+        continue;
+      }
+      RealType e = exp(-next * nParticles[j]);
+      RealType p = e - ePrev[j];
+      ePrev[j] = e;
+      RealType dx = RealType(x - pivot[j]);
+      S0[j] += p;
+      S1[j] += p * dx;
+      S2[j] += p * dx * dx;
+    }
+  }
+
+  for (unsigned long int j = 0; j < numN; j++){
+    if (first[j] > last[j]){
+      continue;
+    }
+    // mean = sum x p, same as calculateMeanFromPDF (the PDF isn't renormalized)
+    RealType d = RealType(pivot[j]) * (S0[j] - 1) + S1[j];
+    vars[j] = S2[j] - 2 * d * S1[j] + d * d * S0[j];
+  }
+  return vars;
+}
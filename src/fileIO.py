@@ -1,6 +1,7 @@
 import numpy as np
 import npquad
 import csv
+import struct
 
 
 def loadArrayQuad(fileName, delimiter=",", dtype=np.quad, skiprows=0):
@@ -70,3 +71,61 @@ def saveArrayQuad(save_file, arr):
         else:
             for row in range(arr.shape[0]):
                 writer.writerow(arr[row, :])
+
+
+def loadRecording(fileName):
+    """
+    Load a binary recording written by RecorderPDF / RecorderTimeCDF.
+
+    Parameters
+    ----------
+    fileName : str
+        name of file to read
+
+    Returns
+    -------
+    columns : list of str
+        Name of each column, the first is always "time"
+
+    numpy array
+        Recorded rows of shape (number of rows, number of columns). The dtype
+        is np.float64, np.longdouble or np.quad depending on what the
+        recording was made with.
+
+    Note
+    ----
+    A partial row at the end (from a job killed mid write) is dropped.
+    """
+
+    with open(fileName, "rb") as file:
+        data = file.read()
+
+    if data[:8] != b"RWRERECD":
+        raise ValueError("Not a recording file: " + fileName)
+    version, scalarBytes, scalarDigits, numColumns = struct.unpack_from("<IIiI", data, 8)
+    if version != 1:
+        raise ValueError("Unsupported recording version {}: {}".format(version, fileName))
+
+    offset = 8 + struct.calcsize("<IIiI")
+    columns = []
+    for _ in range(numColumns):
+        (length,) = struct.unpack_from("<I", data, offset)
+        offset += 4
+        columns.append(data[offset : offset + length].decode())
+        offset += length
+
+    dtypes = {53: np.float64, 64: np.longdouble, 113: np.quad}
+    if scalarDigits not in dtypes:
+        raise ValueError("Unknown scalar type ({} digits): {}".format(scalarDigits, fileName))
+    dtype = np.dtype(dtypes[scalarDigits])
+    if dtype.itemsize != scalarBytes:
+        raise ValueError(
+            "Recording has {} byte scalars but {} is {} bytes: {}".format(
+                scalarBytes, dtype, dtype.itemsize, fileName
+            )
+        )
+
+    rowBytes = scalarBytes * numColumns
+    numRows = (len(data) - offset) // rowBytes
+    array = np.frombuffer(data, dtype=dtype, count=numRows * numColumns, offset=offset)
+    return columns, array.reshape((numRows, numColumns)).copy()
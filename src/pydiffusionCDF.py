@@ -41,7 +41,10 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
     CDF : numpy array (dtype of np.quad)
         The current recurrance vector Z_B(n, t) in the original Barraquand-Corwin paper.
         This relates to the CDF of the system through the relation:
-        Z_B(n, t) = 1 - CDF(2*n + 2 - t, t).
+        Z_B(n, t) = 1 - CDF(2*n + 2 - t, t). This is a read only view of the
+        C++ buffer, so it follows the system as it evolves. While a view is
+        alive setCDF and loadCheckpoint throw, use getCDFCopy() for a
+        snapshot that doesn't block them.
 
     tMax : int
         Maximum time that can be iterated to. This sets the allocated size of the CDF.
@@ -81,11 +84,15 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
     getProbandV(quantile)
         Get the probability and velocity of a quantile.
 
-    saveState()
-        Saves the current state of the system to a file.
+    saveState(block=True)
+        Saves the current state of the system to a binary checkpoint, in the
+        background with block=False.
+
+    fromCheckpoint(checkpoint_file, id=None, save_dir=None)
+        Load a DiffusionTimeCDF object from a checkpoint.
 
     fromFiles(cdf_file, scalars_file)
-        Load a DiffusionTimeCDF object from saved files.
+        Load a DiffusionTimeCDF object from csv files saved by older versions.
 
     evolveAndGetVariance(times, nParticles, file)
         Get the gumbel variance at specific times and save to file.
@@ -102,6 +109,7 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
         super().__init__(*args, **kwargs)
         self._last_saved_time = time.process_time()  # seconds
         self._save_interval = 3600 * 6  # Set to save occupancy every 6 hours.
+        self._evolve_chunk = 1000  # Steps run in C++ between save checks.
         self.id = None
         self.save_dir = "."
 
@@ -146,6 +154,7 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
 
     @property
     def CDF(self):
+        # Read only view of the C++ buffer, use getCDFCopy() for a snapshot
         return self.getCDF()
 
     @CDF.setter
@@ -197,27 +206,46 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
             time. This would normally Core Dump since trying to allocate memory
             outside array.
         """
-        if (time.process_time() - self._last_saved_time) > self._save_interval:
-            self.saveState()
-            self._last_saved_time = time.process_time()
+        self._saveIfNeeded()
 
         if self.time >= self.tMax:
             raise ValueError(f"Cannot evolve to time greater than tMax: {self.tMax}")
 
         super().iterateTimeStep()
 
+    def _saveIfNeeded(self):
+        """
+        Save the state of the system if it hasn't been saved in the last
+        _save_interval seconds.
+        """
+
+        if (time.process_time() - self._last_saved_time) > self._save_interval:
+            self.saveState(block=False)
+            self._last_saved_time = time.process_time()
+
     def evolveToTime(self, time):
         """
-        Evolve the system to a time t.
+        Evolve the system to a time t. The timesteps are run in C++ (without
+        holding the GIL) in chunks of _evolve_chunk steps so the state can still
+        be saved periodically.
 
         Parameters
         ----------
         time : int
             Time to iterate the system forward to.
+
+        Raises
+        ------
+        ValueError
+            If trying to evolve the system to a time greater than tMax.
         """
 
+        if time > self.tMax:
+            raise ValueError(f"Cannot evolve to time greater than tMax: {self.tMax}")
+
         while self.time < time:
-            self.iterateTimeStep()
+            self._saveIfNeeded()
+            super().evolveToTime(min(time, self.time + self._evolve_chunk))
 
     def evolveTimesteps(self, num):
         """
@@ -229,8 +257,7 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
             Number of timesteps to evolve the system
         """
 
-        for _ in range(num):
-            self.iterateTimeStep()
+        self.evolveToTime(self.time + num)
 
     def findQuantile(self, quantile):
         """
@@ -313,38 +340,66 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
 
         return super().getProbandV(quantile)
 
-    def saveState(self):
+    def saveState(self, block=True):
         """
-        Save all the simulation constants to a scalars file and the occupancy
-        to a seperate file.
+        Save the state of the system to a binary checkpoint.
 
         Note
         ----
         Must have defined the ID attribute for this to work properly.
-        The scalars are saved to a file Scalars{id}.json and the occupancy
-        is saved to Occupancy{id}.txt.
+        The state is saved to Checkpoint{id}.bin in save_dir and can be loaded
+        back with fromCheckpoint().
+
+        Parameters
+        ----------
+        block : bool (optional)
+            Whether to wait for the file to be written. With False the state
+            is copied and written on a background thread while the
+            simulation carries on, call waitForCheckpoint() before relying on
+            the file.
         """
 
-        cdf_file = os.path.join(self.save_dir, f"CDF{self.id}.txt")
-        scalars_file = os.path.join(self.save_dir, f"Scalars{self.id}.json")
+        checkpoint_file = os.path.join(self.save_dir, f"Checkpoint{self.id}.bin")
+        if block:
+            self.saveCheckpoint(checkpoint_file)
+        else:
+            self.saveCheckpointAsync(checkpoint_file)
+
+    @classmethod
+    def fromCheckpoint(cls, checkpoint_file, id=None, save_dir=None):
+        """
+        Load a DiffusionTimeCDF object from a checkpoint written by saveState().
 
-        fileIO.saveArrayQuad(cdf_file, self.getSaveCDF())
+        Parameters
+        ----------
+        checkpoint_file : str
+            Checkpoint file to load.
 
-        vars = {
-            "time": self.time,
-            "beta": self.beta,
-            "tMax": self.tMax,
-            "id": self.id,
-            "save_dir": self.save_dir,
-        }
+        id : int (optional)
+            System ID to keep saving the state with.
 
-        with open(scalars_file, "w+") as f:
-            json.dump(vars, f)
+        save_dir : str (optional)
+            Directory to keep saving the state to. Defaults to the directory
+            of checkpoint_file.
+
+        Returns
+        -------
+        DiffusionTimeCDF
+            Object loaded from file. Should be equivalent to the saved object,
+            including the state of the random number generator.
+        """
+
+        d = cls(beta=1, tMax=0)
+        d.loadCheckpoint(checkpoint_file)
+        d.id = id
+        d.save_dir = save_dir if save_dir is not None else (os.path.dirname(checkpoint_file) or ".")
+        return d
 
     @classmethod
     def fromFiles(cls, cdf_file, scalars_file):
         """
-        Load a DiffusionTimeCDF object from saved files.
+        Load a DiffusionTimeCDF object from csv files saved by older
+        versions. New checkpoints are loaded with fromCheckpoint().
 
         Parameters
         ----------
@@ -454,6 +509,65 @@ class DiffusionTimeCDF(diffusionCDF.DiffusionTimeCDF):
             writer.writerow(row)
         f.close()
 
+    def evolveAndRecord(
+        self,
+        time,
+        file,
+        quantiles=None,
+        vs=None,
+        nParticles=None,
+        probAndV=None,
+        append=False,
+        flushRows=1000,
+    ):
+        """
+        Evolve the system to specific times and record observables there to a
+        binary file. The whole loop runs in C++ without the GIL and rows are
+        written flushRows at a time. Read it back with fileIO.loadRecording.
+
+        Parameters
+        ----------
+        time : numpy array or list
+            Times to evolve the system to and record at
+
+        file : str
+            File to save the recording to.
+
+        quantiles : list (dtype np.quad) or None
+            Quantiles to record the position of
+
+        vs : list or None
+            Velocities to record Pb(vt, t) at
+
+        nParticles : list (dtype np.quad) or None
+            Number of particles to record the Gumbel variance for
+
+        probAndV : np.quad or None
+            Quantile to record the probability and velocity of, as in
+            evolveAndGetProbAndV.
+
+        append : bool (False)
+            Whether or not to append to an existing recording. The columns
+            must be the same as the ones it was made with.
+
+        flushRows : int (1000)
+            Number of rows to buffer before writing them to the file.
+        """
+
+        # Measured in one pass with DiffusionTimeCDF::measure, the columns are
+        # in the same order as adding each observable on its own
+        recorder = diffusionCDF.RecorderTimeCDF(file, append, flushRows)
+        if quantiles is not None or vs is not None or nParticles is not None:
+            recorder.addMeasurement(
+                list(quantiles) if quantiles is not None else [],
+                list(vs) if vs is not None else [],
+                list(nParticles) if nParticles is not None else [],
+            )
+        if probAndV is not None:
+            recorder.addProbAndV(probAndV)
+        recorder.evolveAndRecord(self, [int(t) for t in time])
+        recorder.close()
+
     def evolveAndGetProbAndV(self, quantile, time, save_file):
         """
         Measure the probability and velocity of a quantile at different times.
@@ -0,0 +1,116 @@
+import sys
+import os
+
+# Need to link to diffusionEnsemble library (PyBind11 code)
+path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "DiffusionEnsemble")
+sys.path.append(path)
+
+import diffusionEnsemble
+import numpy as np
+import npquad
+import fileIO
+
+
+class _EnsembleResults:
+    """
+    Helpers shared by the ensemble classes to get the reduced observables
+    back as numpy arrays.
+    """
+
+    def getResults(self):
+        """
+        Get the mean and variance over the ensemble of every observable.
+
+        Returns
+        -------
+        dict :
+            Arrays (dtype of np.quad) of shape (number of save times, number
+            of observables) keyed by name. Quantile columns are in descending
+            order of quantile.
+        """
+
+        results = {
+            "times": np.array(self.getSaveTimes()),
+            "quantiles": np.array(self.getQuantiles(), dtype=np.quad),
+            "gumbelNParticles": np.array(self.getGumbelNParticles(), dtype=np.quad),
+            "velocities": np.array(self.getVelocities()),
+            "quantileMean": np.array(self.getQuantileMean(), dtype=np.quad),
+            "quantileVariance": np.array(self.getQuantileVariance(), dtype=np.quad),
+            "gumbelVarianceMean": np.array(self.getGumbelVarianceMean(), dtype=np.quad),
+            "gumbelVarianceVariance": np.array(self.getGumbelVarianceVariance(), dtype=np.quad),
+            "pbMean": np.array(self.getPbMean(), dtype=np.quad),
+            "pbVariance": np.array(self.getPbVariance(), dtype=np.quad),
+        }
+        return results
+
+    def saveResults(self, save_dir):
+        """
+        Save the results of getResults() as one csv file per array.
+
+        Parameters
+        ----------
+        save_dir : str
+            Directory to save the files to.
+        """
+
+        os.makedirs(save_dir, exist_ok=True)
+        for name, arr in self.getResults().items():
+            if arr.size == 0:
+                continue
+            fileIO.saveArrayQuad(os.path.join(save_dir, name + ".txt"), arr)
+
+
+class DiffusionTimeCDFEnsemble(_EnsembleResults, diffusionEnsemble.DiffusionTimeCDFEnsemble):
+    """
+    Many independent DiffusionTimeCDF realizations at the same beta and tMax,
+    run on a pool of threads. Instead of saving each realization, the
+    observables at every save time are reduced into a running mean and
+    variance.
+
+    Parameters
+    ----------
+    numSystems : int
+        Number of realizations.
+
+    beta : float
+        Value of beta for the beta distribution to draw random probabilities
+        from.
+
+    tMax : int
+        Maximum time that will be iterated to.
+
+    Examples
+    --------
+    >>> ensemble = DiffusionTimeCDFEnsemble(1000, np.inf, 10000)
+    >>> ensemble.setSeed(0)
+    >>> ensemble.setNumThreads(8)
+    >>> ensemble.setSaveTimes([100, 1000, 10000])
+    >>> ensemble.setQuantiles([np.quad("1e10"), np.quad("1e20")])
+    >>> ensemble.run()
+    >>> results = ensemble.getResults()
+    """
+
+
+class DiffusionPDFEnsemble(_EnsembleResults, diffusionEnsemble.DiffusionPDFEnsemble):
+    """
+    Many independent DiffusionPDF realizations with the same parameters, run
+    on a pool of threads. See DiffusionTimeCDFEnsemble.
+
+    Parameters
+    ----------
+    numSystems : int
+        Number of realizations.
+
+    nParticles : np.quad
+        Number of particles in each realization.
+
+    beta : float
+        Value of beta for the beta distribution to draw random probabilities
+        from.
+
+    occupancySize : int
+        Maximum time the realizations can be iterated to.
+
+    probDistFlag : bool
+        Whether to evolve the probability distribution or discrete particles.
+    """
@@ -38,10 +38,17 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
         round the particles shifting and if False then rounds the particles so
         there is always a whole number of particles.
 
+    windowStorage : bool (false)
+        Only store the occupied band of the occupancy (and grow the edges as
+        it goes) instead of allocating occupancySize sites up front. The
+        occupancy then starts at site getOccupancyOffset(). Use
+        setEdgeHistoryLength to also bound how many past edges are kept.
+
     Attributes
     ----------
     time : numpy array
-        Time of the system
+        Times the edges are stored for, from getEdgesOffset() to the current
+        time (all of them unless the edge history is bounded)
 
     currentTime : int
         Current time of the system. This is the maximum of the time array.
@@ -58,7 +65,10 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
 
     occupancy : numpy array (dtype = np.quad)
         Number of particles at each position in the system. More formally, this
-        is referred to as the partition function.
+        is referred to as the partition function. This is a read only view of
+        the C++ buffer (a copy with window storage), so it follows the system
+        as it evolves. While a view is alive setOccupancy and loadCheckpoint
+        throw, use getOccupancyCopy() for a snapshot that doesn't block them.
 
     nParticles : float
         Number of particles in the system
@@ -73,11 +83,14 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
 
     smallCutoff : int
         Used in the discrete simulations to determine when to use the binomial
-        distribution.
+        distribution. Sites with fewer particles draw an exact binomial, can be
+        at most 2^53.
 
     largeCutoff : int
         Used in the discrete simulations to determine when to approximate the
-        number of particles moving to the right as (beta * number of particles at position)
+        number of particles moving to the right as (beta * number of particles at position).
+        Between smallCutoff and largeCutoff the Gaussian approximation to the
+        binomial is used.
 
     save_dir : str
         Directory to save the Occupancy and Scalars file that will save periodically
@@ -94,11 +107,12 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
         super().__init__(*args, **kwargs)
         self._last_saved_time = time.process_time()  # seconds
         self._save_interval = 3600 * 6  # Set to save occupancy every 2 hours.
+        self._evolve_chunk = 1000  # Steps run in C++ between save checks.
         self.id = None  # Need to also get SLURM ID
         self.save_dir = "."
 
     def __str__(self):
-        return f"DiffusionPDF(N={self.getNParticles()}, beta={self.getBeta()}, size={len(self.getEdges()[0])}, time={self.getTime()})"
+        return f"DiffusionPDF(N={self.getNParticles()}, beta={self.getBeta()}, size={self.getOccupancySize()}, time={self.getTime()})"
 
     def __repr__(self):
         return self.__str__()
@@ -116,7 +130,8 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
             and self.nParticles == other.nParticles
             and self.beta == other.beta
             and self.probDistFlag == other.probDistFlag
-            and self.edges == other.edges
+            and np.array_equal(self.edges[0], other.edges[0])
+            and np.array_equal(self.edges[1], other.edges[1])
             and self.id == other.id
             and self.save_dir == other.save_dir
         ):
@@ -126,7 +141,7 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
 
     @property
     def time(self):
-        return np.arange(0, self.getTime() + 1)
+        return np.arange(self.getEdgesOffset(), self.getTime() + 1)
 
     @property
     def currentTime(self):
@@ -152,7 +167,8 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
 
     @property
     def occupancy(self):
-        return np.array(self.getOccupancy(), dtype=np.quad)
+        # Read only view of the C++ buffer, use getOccupancyCopy() for a snapshot
+        return self.getOccupancy()
 
     @occupancy.setter
     def occupancy(self, occupancy):
@@ -210,7 +226,9 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
     def catch(self, sig, frame):
         """
         We just want to save all the relevant data so we can restart the simulation
-        and then exit.
+        and then exit. This save blocks: the process can't exit before the
+        file is in place, and it waits for a periodic save still being written
+        in the background first.
         """
 
         self.saveState()
@@ -228,50 +246,69 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
 
         super().resizeOccupancyAndEdges(size)
 
-    def saveState(self):
+    def saveState(self, block=True):
         """
-        Save all the simulation constants to a scalars file and the occupancy
-        to a seperate file.
+        Save the state of the system to a binary checkpoint.
 
         Note
         ----
         Must have defined the ID attribute for this to work properly.
 
-        The scalars are saved to a file Scalars{id}.json and the occupancy
-        is saved to Occupancy{id}.txt.
+        The state is saved to Checkpoint{id}.bin in save_dir and can be loaded
+        back with fromCheckpoint().
+
+        Parameters
+        ----------
+        block : bool (optional)
+            Whether to wait for the file to be written. With False the state
+            is copied and written on a background thread while the
+            simulation carries on, call waitForCheckpoint() before relying on
+            the file.
         """
 
-        occupancy_file = os.path.join(self.save_dir, f"Occupancy{self.id}.txt")
-        scalars_file = os.path.join(self.save_dir, f"Scalars{self.id}.json")
+        checkpoint_file = os.path.join(self.save_dir, f"Checkpoint{self.id}.bin")
+        if block:
+            self.saveCheckpoint(checkpoint_file)
+        else:
+            self.saveCheckpointAsync(checkpoint_file)
 
-        fileIO.saveArrayQuad(occupancy_file, self.getSaveOccupancy())
-        minEdge, maxEdge = self.getSaveEdges()
-        minIdx, maxIdx = minEdge[-1], maxEdge[-1]
+    @classmethod
+    def fromCheckpoint(cls, checkpoint_file, id=None, save_dir=None):
+        """
+        Create a DiffusionPDF class from a checkpoint written by saveState().
 
-        vars = {
-            "time": self.currentTime,
-            "minEdges": minEdge,
-            "maxEdges": maxEdge,
-            "minIdx": minIdx,
-            "maxIdx": maxIdx,
-            "nParticles": str(self.nParticles),
-            "beta": self.beta,
-            "probDistFlag": self.probDistFlag,
-            "smallCutoff": self.smallCutoff,
-            "largeCutoff": self.largeCutoff,
-            "occupancySize": self.getOccupancySize() + 1,
-            "id": self.id,
-            "save_dir": self.save_dir,
-        }
+        Parameters
+        ----------
+        checkpoint_file : str
+            Checkpoint file to load.
+
+        id : int (optional)
+            System ID to keep saving the state with.
 
-        with open(scalars_file, "w+") as file:
-            json.dump(vars, file)
+        save_dir : str (optional)
+            Directory to keep saving the state to. Defaults to the directory
+            of checkpoint_file.
+
+        Returns
+        -------
+        d : DiffusionPDF
+            Diffusion object ready to pick up the simulation, including the
+            state of the random number generator and the storage mode (window
+            storage and its edge history length) it was saved with.
+        """
+
+        # loadCheckpoint sets everything, the storage mode included
+        d = cls(np.quad(1), 1, 0, True)
+        d.loadCheckpoint(checkpoint_file)
+        d.id = id
+        d.save_dir = save_dir if save_dir is not None else (os.path.dirname(checkpoint_file) or ".")
+        return d
 
     @classmethod
     def fromFiles(cls, variables_file, occupancy_file):
         """
-        Create a DiffusionPDF class from variables saved with saveVariables()
-        and saveState().
+        Create a DiffusionPDF class from the csv files saved by older
+        versions. New checkpoints are loaded with fromCheckpoint().
 
         Parameters
         ----------
@@ -328,7 +365,7 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
             Seed for random beta distribution generator
         """
 
-        self.setBetaSeed(seed)
+        super().setBetaSeed(seed)
 
     def iterateTimestep(self):
         """
@@ -336,15 +373,23 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
         distribution.
         """
         # Save the occupancy periodically so we can start it up later.
-        if (time.process_time() - self._last_saved_time) > self._save_interval:
-            self.saveState()
-            self._last_saved_time = time.process_time()
+        self._saveIfNeeded()
 
         # Need to throw error if trying to go past the edges
         if self.currentTime + 1 > self.getOccupancySize():
             raise RuntimeError("Cannot iterate past the size of the edges")
         super().iterateTimestep()
 
+    def _saveIfNeeded(self):
+        """
+        Save the occupancy if it hasn't been saved in the last _save_interval
+        seconds.
+        """
+
+        if (time.process_time() - self._last_saved_time) > self._save_interval:
+            self.saveState(block=False)
+            self._last_saved_time = time.process_time()
+
     def findQuantile(self, quantile):
         """
         Get the rightmost Nth quantile of the occupancy.
@@ -470,22 +515,32 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
             Number of timesteps to iterate forward
         """
 
-        for _ in range(iterations):
-            self.iterateTimestep()
+        self.evolveToTime(self.getTime() + iterations)
 
     def evolveToTime(self, time):
         """
-        Evolve the system to a specified time. If the input time is greater than
-        the system's current time it won't actually do anything.
+        Evolve the system to a specified time. If the input time is less than
+        the system's current time it won't actually do anything. The timesteps
+        are run in C++ (without holding the GIL) in chunks of _evolve_chunk
+        steps so the occupancy can still be saved periodically.
 
         Parameters
         ----------
         time : int
             System time to evolve the system forward to
+
+        Raises
+        ------
+        RuntimeError
+            If trying to evolve past the size of the edges.
         """
 
+        if time > self.getOccupancySize():
+            raise RuntimeError("Cannot iterate past the size of the edges")
+
         while self.getTime() < time:
-            self.iterateTimestep()
+            self._saveIfNeeded()
+            super().evolveToTime(min(time, self.getTime() + self._evolve_chunk))
 
     def evolveAndSaveQuantiles(self, time, quantiles, file, append=False):
         """
@@ -565,6 +620,67 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
             f.flush()
         f.close()
 
+    def evolveAndRecord(
+        self,
+        time,
+        file,
+        quantiles=None,
+        vs=None,
+        nParticles=None,
+        maxEdge=False,
+        append=False,
+        flushRows=1000,
+    ):
+        """
+        Evolve the system to specific times and record observables there to a
+        binary file. The whole loop runs in C++ without the GIL and rows are
+        written flushRows at a time. Read it back with fileIO.loadRecording.
+
+        Parameters
+        ----------
+        time : numpy array or list
+            Times to evolve the system to and record at
+
+        file : str
+            File to save the recording to.
+
+        quantiles : list (dtype np.quad) or None
+            Quantiles to record the position of
+
+        vs : list or None
+            Velocities to record Pb(vt, t) at
+
+        nParticles : list (dtype np.quad) or None
+            Number of particles to record the Gumbel variance for
+
+        maxEdge : bool (False)
+            Whether to record the distance of the rightmost occupied site from
+            the center.
+
+        append : bool (False)
+            Whether or not to append to an existing recording. The columns
+            must be the same as the ones it was made with.
+
+        flushRows : int (1000)
+            Number of rows to buffer before writing them to the file.
+        """
+
+        # Measured with DiffusionPDF::measure, the columns are in the same
+        # order as adding each observable on its own
+        recorder = diffusionPDF.RecorderPDF(file, append, flushRows)
+        if quantiles is not None:
+            recorder.addMeasurement(list(quantiles), [], [])
+        if maxEdge:
+            recorder.addMaxEdge()
+        if vs is not None or nParticles is not None:
+            recorder.addMeasurement(
+                [],
+                list(vs) if vs is not None else [],
+                list(nParticles) if nParticles is not None else [],
+            )
+        recorder.evolveAndRecord(self, [int(t) for t in time])
+        recorder.close()
+
     def evolveAndSaveV(self, time, vs, file):
         """
         Incrementally evolves the system forward to the specified times and saves
@@ -673,6 +789,11 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
         file : str
             File to save the first passage time to
 
+        Note
+        ----
+        Runs in C++ until every position is reached or the edges run out at
+        occupancySize.
+
         Examples
         --------
         >>> d = DiffusionPDF(1, np.inf, 6, ProbDistFlag=True)
@@ -681,27 +802,16 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
         [2. 4. 6.]
         """
 
-        idx = 0
+        times = super().evolveAndSaveFirstPassage([int(p) for p in positions])
         f = open(file, "a")
         writer = csv.writer(f)
         header = ["Distance", "Time"]
         writer.writerow(header)
-        f.flush()
-        while idx < len(positions):
-            self.iterateTimestep()
-            maxIdx = self.getMaxIdx()
-            minIdx = self.getMinIdx()
-            maxPosition = 2 * (
-                maxIdx - self.currentTime / 2
-            )  # multiply by 2 since the theory is +/- 1 for each step
-            minPosition = 2 * (minIdx - self.currentTime / 2)
-            if (
-                maxPosition >= positions[idx] or abs(minPosition) >= positions[idx]
-            ):  # also want to check the minimum position
-                row = [positions[idx], self.currentTime]
-                writer.writerow(row)
-                f.flush()
-                idx += 1
+        # Positions the edges never got to (time 0) are left out
+        for position, t in sorted(zip(positions, times)):
+            if t != 0:
+                writer.writerow([position, t])
+        f.close()
 
     def evolveAndSaveFirstPassageQuantile(self, positions, quantiles):
         """
@@ -716,11 +826,19 @@ class DiffusionPDF(diffusionPDF.DiffusionPDF):
         quantiles : list or numpy array
             Quantiles to record the positions for
 
-        file : str
-            File to save the first passage time to
+        Returns
+        -------
+        numpy array
+            First passage times of shape (len(positions), len(quantiles)). 0
+            where the quantile never reached the position before the edges ran
+            out at occupancySize.
         """
 
-        return super().evolveAndSaveFirstPassageQuantile(positions, quantiles)
+        return np.array(
+            super().evolveAndSaveFirstPassageQuantile(
+                [int(p) for p in positions], list(quantiles)
+            )
+        )
 
     def ProbBiggerX(self, vs, timesteps):
         """